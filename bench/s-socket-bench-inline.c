@@ -0,0 +1,7 @@
+// Second source of s-socket-bench-inline, for the S-Socket C API
+// ------------------------------------------------------------------------------
+//
+// Inlines the library again next to bench/s-socket-bench.c. S_SOCKET_INLINE gives every file defining it
+// a private copy, so the target only links if nothing in that copy has external linkage.
+
+#include "s-socket.h"
@@ -0,0 +1,672 @@
+// Benchmarks for the S-Socket C API
+// ------------------------------------------------------------------------------
+//
+// usage: s-socket-bench [--seconds s] [--sizes 64,1024,...] [--threads 1,4,...] [--only name,...] [--port p]
+//
+// Every benchmark runs over loopback for each payload size and thread count and prints one csv row:
+//
+//   bench,payload,threads,ops_per_sec,mbytes_per_sec,p50_us,p99_us,p999_us
+//
+// udp_recv / udp_recv_batch    datagrams/s through one receiver, flooded by `threads` sender threads
+// udp_send / udp_send_batch    datagrams/s out of `threads` sender threads, each with its own socket
+// tcp_stream                   bytes/s over `threads` connections, one writer and one reader thread each
+// tcp_echo                     round trips of `payload` bytes over `threads` connections, with latency percentiles
+// tcp_accept                   connections/s one listener accepts from `threads` connecting threads
+// setaddrinfo_numeric/_cached/_uncached   resolves/s of "127.0.0.1", and of "localhost" with and without the cache
+//
+// Benchmarks that don't move payloads report it as 0, and only the echo benchmark reports latencies. Every run
+// listens on its own loopback port, counting up from --port.
+
+#include "s-socket.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  typedef HANDLE bench_thread;
+  typedef DWORD (WINAPI *bench_proc)(void*);
+#else
+  #include <pthread.h>
+  #include <time.h>
+  typedef pthread_t bench_thread;
+  typedef void *(*bench_proc)(void*);
+#endif
+
+#define BATCH 64
+#define LIST_MAX 16
+#define LATENCY_MAX (1 << 20) // samples kept per echo connection
+#define STREAM_CHUNK 65536
+
+static double now_sec(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, t;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+#ifdef _WIN32
+static int thread_start(bench_thread *t, bench_proc fn, void *arg)
+{
+    *t = CreateThread(NULL, 0, fn, arg, 0, NULL);
+    return *t ? 0 : -1;
+}
+static void thread_join(bench_thread t) { WaitForSingleObject(t, INFINITE); CloseHandle(t); }
+#define THREAD_FN(name) DWORD WINAPI name(void *arg)
+#define THREAD_RET return 0
+#else
+static int thread_start(bench_thread *t, bench_proc fn, void *arg)
+{
+    return pthread_create(t, NULL, fn, arg);
+}
+static void thread_join(bench_thread t) { pthread_join(t, NULL); }
+#define THREAD_FN(name) void *name(void *arg)
+#define THREAD_RET return NULL
+#endif
+
+// Per thread state; every benchmark uses the fields it needs and sums ops/bytes after joining
+struct worker {
+    bench_thread thread;
+    struct AddrInfo *dest;
+    struct TCPSocket *tcp;
+    size_t payload;
+    double deadline;
+    volatile int *stop;
+    int batched;
+    unsigned long long ops, bytes;
+    double *lat;
+    size_t nlat;
+};
+
+static double seconds = 2.0;
+static size_t next_port = 27001; // below the usual ephemeral ranges, each run takes the next port
+
+// Each run gets a fresh port, so nothing left in TIME_WAIT by the previous one gets in the way
+static struct AddrInfo* fresh_addr(void)
+{
+    struct AddrInfo *addr = mkaddrinfo();
+    if (addr && setaddrinfo("127.0.0.1", next_port++, addr) != 0) {
+        addrinfo_free(addr);
+        return NULL;
+    }
+    return addr;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *bench, size_t payload, int threads, double ops, double bytes, double elapsed,
+                   struct worker *w)
+{
+    double *lat = NULL;
+    size_t nlat = 0, i;
+    int t;
+
+    printf("%s,%zu,%d,%.0f,%.2f,", bench, payload, threads, ops / elapsed, bytes / elapsed / 1e6);
+    for (t = 0; w && t < threads; ++t)
+        nlat += w[t].nlat;
+    if (nlat > 0 && (lat = malloc(nlat * sizeof(double)))) {
+        nlat = 0;
+        for (t = 0; t < threads; ++t)
+            for (i = 0; i < w[t].nlat; ++i)
+                lat[nlat++] = w[t].lat[i];
+        qsort(lat, nlat, sizeof(double), cmp_double);
+        printf("%.1f,%.1f,%.1f\n", lat[nlat / 2], lat[(size_t)(nlat * 0.99)], lat[(size_t)(nlat * 0.999)]);
+        free(lat);
+    } else {
+        printf(",,\n");
+    }
+    fflush(stdout);
+}
+
+static int send_all(struct TCPSocket *sock, char *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        int sent = tcp_send(sock, buf + done, len - done, 0);
+        if (sent <= 0)
+            return -1;
+        done += sent;
+    }
+    return 0;
+}
+
+static int recv_all(struct TCPSocket *sock, char *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        int got = tcp_recv(sock, buf + done, len - done, 0);
+        if (got <= 0)
+            return -1;
+        done += got;
+    }
+    return 0;
+}
+
+static void start_all(struct worker *w, int n, bench_proc fn)
+{
+    int i;
+    for (i = 0; i < n; ++i) {
+        if (thread_start(&w[i].thread, fn, &w[i]) != 0) {
+            fprintf(stderr, "could not start thread\n");
+            exit(1);
+        }
+    }
+}
+
+static void join_all(struct worker *w, int n, unsigned long long *ops, unsigned long long *bytes)
+{
+    int i;
+    *ops = *bytes = 0;
+    for (i = 0; i < n; ++i) {
+        thread_join(w[i].thread);
+        *ops += w[i].ops;
+        *bytes += w[i].bytes;
+    }
+}
+
+
+// ---- udp ----
+
+static THREAD_FN(flood_main)
+{
+    struct worker *w = arg;
+    struct UDPSocket *sock = udp_mksocket();
+    char *buf = calloc(1, w->payload);
+
+    while (sock && buf && !*w->stop)
+        udp_send(sock, w->dest, buf, w->payload, 0);
+
+    free(buf);
+    udp_free(sock);
+    THREAD_RET;
+}
+
+static void bench_udp_recv(size_t payload, int threads, int batched)
+{
+    struct AddrInfo *local = fresh_addr();
+    struct UDPSocket *sock = udp_mksocket();
+    struct worker *w = calloc(threads, sizeof(*w));
+    struct UDPMsg msgs[BATCH];
+    char *bufs = malloc(BATCH * payload);
+    unsigned long long count = 0, ops, bytes;
+    volatile int stop = 0;
+    double start, end, t;
+    int i, rc = -1;
+
+    if (!local || !sock || !w || !bufs || (rc = udp_bind(sock, local)) != 0) {
+        fprintf(stderr, "udp setup failed: %s\n", rc < 0 ? get_error(rc) : "out of memory");
+        exit(1);
+    }
+    udp_mod_sock(sock, UDP_MOD_RCVTIMEO, 1000);
+    for (i = 0; i < BATCH; ++i) {
+        msgs[i].msgbuf = bufs + i * payload;
+        msgs[i].buflen = payload;
+        msgs[i].addr = NULL;
+        msgs[i].stamp = NULL;
+    }
+    for (i = 0; i < threads; ++i) {
+        w[i].dest = local;
+        w[i].payload = payload;
+        w[i].stop = &stop;
+    }
+    start_all(w, threads, flood_main);
+
+    start = t = now_sec();
+    end = start + seconds;
+    while (t < end) {
+        int got = batched ? udp_recv_batch(sock, msgs, BATCH, 0)
+                          : udp_recv(sock, bufs, payload, 0, NULL);
+        if (got < 0) {
+            fprintf(stderr, "receive failed: %s\n", get_error(got));
+            break;
+        }
+        count += batched ? got : 1;
+        t = now_sec();
+    }
+
+    stop = 1;
+    join_all(w, threads, &ops, &bytes);
+    report(batched ? "udp_recv_batch" : "udp_recv", payload, threads, (double)count, (double)count * payload,
+           t - start, NULL);
+
+    free(bufs);
+    free(w);
+    udp_free(sock);
+    addrinfo_free(local);
+}
+
+static THREAD_FN(udp_send_main)
+{
+    struct worker *w = arg;
+    struct UDPSocket *sock = udp_mksocket();
+    struct UDPMsg msgs[BATCH];
+    char *buf = calloc(1, w->payload);
+    int i;
+
+    for (i = 0; i < BATCH; ++i) {
+        msgs[i].addr = w->dest;
+        msgs[i].msgbuf = buf;
+        msgs[i].buflen = w->payload;
+    }
+    while (sock && buf && now_sec() < w->deadline) {
+        int sent = w->batched ? udp_send_batch(sock, msgs, BATCH, 0) : udp_send(sock, w->dest, buf, w->payload, 0);
+        if (sent < 0)
+            continue; // a full loopback queue pushes back with ENOBUFS, just try again
+        w->ops += w->batched ? (unsigned)sent : 1;
+    }
+    w->bytes = w->ops * w->payload;
+
+    free(buf);
+    udp_free(sock);
+    THREAD_RET;
+}
+
+static void bench_udp_send(size_t payload, int threads, int batched)
+{
+    struct AddrInfo *local = fresh_addr();
+    struct UDPSocket *sink = udp_mksocket();
+    struct worker *w = calloc(threads, sizeof(*w));
+    unsigned long long ops, bytes;
+    double start = now_sec();
+    int i;
+
+    // the sink is never read, so this measures the send path and the kernel drops what doesn't fit
+    if (!local || !sink || !w || udp_bind(sink, local) != 0) {
+        fprintf(stderr, "udp setup failed\n");
+        exit(1);
+    }
+    for (i = 0; i < threads; ++i) {
+        w[i].dest = local;
+        w[i].payload = payload;
+        w[i].batched = batched;
+        w[i].deadline = start + seconds;
+    }
+    start_all(w, threads, udp_send_main);
+    join_all(w, threads, &ops, &bytes);
+    report(batched ? "udp_send_batch" : "udp_send", payload, threads, (double)ops, (double)bytes,
+           now_sec() - start, NULL);
+
+    free(w);
+    udp_free(sink);
+    addrinfo_free(local);
+}
+
+
+// ---- tcp ----
+
+// Connects `threads` client/server pairs through one listener: w[i].tcp gets the client end and, when
+// servers is given, servers[i] the accepted end
+static struct TCPSocket* connect_pairs(struct AddrInfo *local, struct worker *w, struct TCPSocket **servers, int threads)
+{
+    struct TCPSocket *listener = tcp_mksocket();
+    int i, rc = -1;
+
+    if (!listener || (rc = tcp_mod_sock(listener, TCP_MOD_REUSEADDR, 1)) != 0 ||
+        (rc = tcp_bind(listener, local)) != 0 || (rc = tcp_listen(listener, 128)) != 0) {
+        fprintf(stderr, "tcp setup failed: %s\n", rc < 0 ? get_error(rc) : "out of memory");
+        exit(1);
+    }
+    for (i = 0; servers && i < threads; ++i) {
+        w[i].tcp = tcp_mksocket();
+        servers[i] = tcp_mksocket();
+        if (!w[i].tcp || !servers[i] || (rc = tcp_connect(w[i].tcp, local)) != 0 ||
+            (rc = tcp_accept(listener, servers[i], NULL, 0)) != 0) {
+            fprintf(stderr, "tcp connect failed: %s\n", rc < 0 ? get_error(rc) : "out of memory");
+            exit(1);
+        }
+        tcp_mod_sock(w[i].tcp, TCP_MOD_NODELAY, 1);
+        tcp_mod_sock(servers[i], TCP_MOD_NODELAY, 1);
+    }
+    return listener;
+}
+
+static THREAD_FN(stream_writer_main)
+{
+    struct worker *w = arg;
+    char *buf = calloc(1, w->payload);
+
+    while (buf && now_sec() < w->deadline && send_all(w->tcp, buf, w->payload) == 0)
+        ;
+    free(buf);
+    tcp_free(w->tcp);
+    THREAD_RET;
+}
+
+static THREAD_FN(stream_reader_main)
+{
+    struct worker *w = arg;
+    char *buf = malloc(STREAM_CHUNK);
+    int got;
+
+    while (buf && (got = tcp_recv(w->tcp, buf, STREAM_CHUNK, 0)) > 0) {
+        w->bytes += got;
+        w->ops++;
+    }
+    free(buf);
+    THREAD_RET;
+}
+
+static void bench_tcp_stream(size_t payload, int threads)
+{
+    struct AddrInfo *local = fresh_addr();
+    struct worker *writers = calloc(threads, sizeof(*writers));
+    struct worker *readers = calloc(threads, sizeof(*readers));
+    struct TCPSocket **servers = calloc(threads, sizeof(*servers));
+    struct TCPSocket *listener;
+    unsigned long long ops, bytes, wops, wbytes;
+    double start;
+    int i;
+
+    if (!local || !writers || !readers || !servers) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    listener = connect_pairs(local, writers, servers, threads);
+
+    start = now_sec();
+    for (i = 0; i < threads; ++i) {
+        writers[i].payload = payload;
+        writers[i].deadline = start + seconds;
+        readers[i].tcp = servers[i];
+    }
+    start_all(readers, threads, stream_reader_main);
+    start_all(writers, threads, stream_writer_main);
+    join_all(writers, threads, &wops, &wbytes);
+    join_all(readers, threads, &ops, &bytes);
+    report("tcp_stream", payload, threads, (double)bytes / payload, (double)bytes, now_sec() - start, NULL);
+
+    for (i = 0; i < threads; ++i)
+        tcp_free(servers[i]);
+    tcp_free(listener);
+    free(servers);
+    free(readers);
+    free(writers);
+    addrinfo_free(local);
+}
+
+static THREAD_FN(echo_server_main)
+{
+    struct worker *w = arg;
+    char *buf = malloc(STREAM_CHUNK);
+    int got;
+
+    while (buf && (got = tcp_recv(w->tcp, buf, STREAM_CHUNK, 0)) > 0 && send_all(w->tcp, buf, got) == 0)
+        ;
+    free(buf);
+    THREAD_RET;
+}
+
+static THREAD_FN(echo_client_main)
+{
+    struct worker *w = arg;
+    char *buf = calloc(1, w->payload);
+    double t = now_sec();
+
+    while (buf && t < w->deadline) {
+        double sent = t;
+        if (send_all(w->tcp, buf, w->payload) != 0 || recv_all(w->tcp, buf, w->payload) != 0)
+            break;
+        t = now_sec();
+        if (w->nlat < LATENCY_MAX)
+            w->lat[w->nlat++] = (t - sent) * 1e6;
+        w->ops++;
+        w->bytes += w->payload;
+    }
+    free(buf);
+    tcp_free(w->tcp);
+    THREAD_RET;
+}
+
+static void bench_tcp_echo(size_t payload, int threads)
+{
+    struct AddrInfo *local = fresh_addr();
+    struct worker *clients = calloc(threads, sizeof(*clients));
+    struct worker *servers = calloc(threads, sizeof(*servers));
+    struct TCPSocket **accepted = calloc(threads, sizeof(*accepted));
+    struct TCPSocket *listener;
+    unsigned long long ops, bytes, sops, sbytes;
+    double start;
+    int i;
+
+    if (!local || !clients || !servers || !accepted) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    listener = connect_pairs(local, clients, accepted, threads);
+
+    start = now_sec();
+    for (i = 0; i < threads; ++i) {
+        clients[i].payload = payload;
+        clients[i].deadline = start + seconds;
+        if (!(clients[i].lat = malloc(LATENCY_MAX * sizeof(double)))) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        servers[i].tcp = accepted[i];
+    }
+    start_all(servers, threads, echo_server_main);
+    start_all(clients, threads, echo_client_main);
+    join_all(clients, threads, &ops, &bytes);
+    join_all(servers, threads, &sops, &sbytes);
+    report("tcp_echo", payload, threads, (double)ops, (double)bytes, now_sec() - start, clients);
+
+    for (i = 0; i < threads; ++i) {
+        free(clients[i].lat);
+        tcp_free(accepted[i]);
+    }
+    tcp_free(listener);
+    free(accepted);
+    free(servers);
+    free(clients);
+    addrinfo_free(local);
+}
+
+static THREAD_FN(connect_main)
+{
+    struct worker *w = arg;
+
+    while (now_sec() < w->deadline) {
+        struct TCPSocket *sock = tcp_mksocket();
+        if (sock && tcp_connect(sock, w->dest) == 0)
+            w->ops++;
+        tcp_free(sock);
+    }
+    THREAD_RET;
+}
+
+static THREAD_FN(accept_main)
+{
+    struct worker *w = arg;
+    struct TCPSocket *client = tcp_mksocket();
+    char byte;
+
+    // The one client handle is reused and each accept closes the previous connection. Waiting for the peer
+    // to hang up first leaves TIME_WAIT on the connecting side, whose port picks skip it; TIME_WAIT here
+    // makes later SYNs on a recycled port stall for a retransmit
+    while (client && !*w->stop) {
+        if (tcp_accept(w->tcp, client, NULL, 0) == 0) {
+            while (tcp_recv(client, &byte, 1, 0) > 0)
+                ;
+            w->ops++;
+        }
+    }
+    tcp_free(client);
+    THREAD_RET;
+}
+
+static void bench_tcp_accept(int threads)
+{
+    struct AddrInfo *local = fresh_addr();
+    struct worker *clients = calloc(threads, sizeof(*clients));
+    struct worker server;
+    struct TCPSocket *wake;
+    unsigned long long ops, bytes;
+    volatile int stop = 0;
+    double start, elapsed;
+    int i;
+
+    if (!local || !clients) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memset(&server, 0, sizeof(server));
+    server.tcp = connect_pairs(local, NULL, NULL, threads);
+    server.stop = &stop;
+    start_all(&server, 1, accept_main);
+
+    start = now_sec();
+    for (i = 0; i < threads; ++i) {
+        clients[i].dest = local;
+        clients[i].deadline = start + seconds;
+    }
+    start_all(clients, threads, connect_main);
+    join_all(clients, threads, &ops, &bytes);
+
+    // one last connection wakes the blocked accept so the server can see the stop flag
+    elapsed = now_sec() - start;
+    stop = 1;
+    wake = tcp_mksocket();
+    if (wake)
+        tcp_connect(wake, local);
+    tcp_free(wake);
+    join_all(&server, 1, &ops, &bytes);
+    report("tcp_accept", 0, threads, (double)(ops > 0 ? ops - 1 : 0), 0, elapsed, NULL);
+
+    tcp_free(server.tcp);
+    free(clients);
+    addrinfo_free(local);
+}
+
+
+// ---- resolver ----
+
+static char *resolve_host;
+
+static THREAD_FN(resolve_main)
+{
+    struct worker *w = arg;
+    struct AddrInfo *addr = mkaddrinfo();
+
+    while (addr && now_sec() < w->deadline)
+        if (setaddrinfo(resolve_host, 80, addr) == 0)
+            w->ops++;
+    addrinfo_free(addr);
+    THREAD_RET;
+}
+
+static void bench_setaddrinfo(const char *name, char *host, unsigned ttl_ms, int threads)
+{
+    struct worker *w = calloc(threads, sizeof(*w));
+    unsigned long long ops, bytes;
+    double start = now_sec();
+    int i;
+
+    if (!w) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    resolve_host = host;
+    setaddrinfo_cache_ttl(ttl_ms);
+    for (i = 0; i < threads; ++i)
+        w[i].deadline = start + seconds;
+    start_all(w, threads, resolve_main);
+    join_all(w, threads, &ops, &bytes);
+    report(name, 0, threads, (double)ops, 0, now_sec() - start, NULL);
+
+    setaddrinfo_cache_ttl(SOCK_DNS_TTL_DEFAULT);
+    free(w);
+}
+
+
+// ---- driver ----
+
+static int parse_list(char *arg, size_t *out)
+{
+    int n = 0;
+    char *tok;
+    for (tok = strtok(arg, ","); tok && n < LIST_MAX; tok = strtok(NULL, ","))
+        if (atoi(tok) > 0)
+            out[n++] = (size_t)atoi(tok);
+    return n;
+}
+
+static char *only;
+
+static int selected(const char *bench)
+{
+    const char *p;
+    size_t len = strlen(bench);
+
+    if (!only)
+        return 1;
+    for (p = strstr(only, bench); p; p = strstr(p + 1, bench))
+        if ((p == only || p[-1] == ',') && (p[len] == '\0' || p[len] == ','))
+            return 1;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t sizes[LIST_MAX] = {64, 1024, 16384};
+    size_t threads[LIST_MAX] = {1, 4};
+    int nsizes = 3, nthreads = 2;
+    int i, s, t;
+
+    for (i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--seconds") == 0)
+            seconds = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--sizes") == 0)
+            nsizes = parse_list(argv[i + 1], sizes);
+        else if (strcmp(argv[i], "--threads") == 0)
+            nthreads = parse_list(argv[i + 1], threads);
+        else if (strcmp(argv[i], "--only") == 0)
+            only = argv[i + 1];
+        else if (strcmp(argv[i], "--port") == 0)
+            next_port = (size_t)atoi(argv[i + 1]);
+        else
+            break;
+    }
+    if (i < argc || seconds <= 0 || nsizes == 0 || nthreads == 0) {
+        fprintf(stderr, "usage: %s [--seconds s] [--sizes 64,1024,...] [--threads 1,4,...] [--only name,...] "
+                        "[--port p]\n", argv[0]);
+        return 1;
+    }
+    if (sock_startup() != 0) {
+        fprintf(stderr, "could not start the socket layer\n");
+        return 1;
+    }
+
+    printf("bench,payload,threads,ops_per_sec,mbytes_per_sec,p50_us,p99_us,p999_us\n");
+    for (t = 0; t < nthreads; ++t) {
+        int n = (int)threads[t];
+        for (s = 0; s < nsizes; ++s) {
+            // a datagram can't carry more than this, larger sizes only make sense for the stream benchmarks
+            int dgram = sizes[s] <= 65507;
+            if (dgram && selected("udp_recv"))       bench_udp_recv(sizes[s], n, 0);
+            if (dgram && selected("udp_recv_batch")) bench_udp_recv(sizes[s], n, 1);
+            if (dgram && selected("udp_send"))       bench_udp_send(sizes[s], n, 0);
+            if (dgram && selected("udp_send_batch")) bench_udp_send(sizes[s], n, 1);
+            if (selected("tcp_stream"))              bench_tcp_stream(sizes[s], n);
+            if (selected("tcp_echo"))                bench_tcp_echo(sizes[s], n);
+        }
+        if (selected("tcp_accept"))                  bench_tcp_accept(n);
+        if (selected("setaddrinfo_numeric"))         bench_setaddrinfo("setaddrinfo_numeric", "127.0.0.1", SOCK_DNS_TTL_DEFAULT, n);
+        if (selected("setaddrinfo_cached"))          bench_setaddrinfo("setaddrinfo_cached", "localhost", SOCK_DNS_TTL_DEFAULT, n);
+        if (selected("setaddrinfo_uncached"))        bench_setaddrinfo("setaddrinfo_uncached", "localhost", 0, n);
+    }
+
+    sock_cleanup();
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Loopback check of tcp_connect_fastest for the S-Socket C API
+// ------------------------------------------------------------------------------
+//
+// Three candidates, tried 1000 ms apart: a listener whose full backlog drops SYNs, a port nobody listens on,
+// and a live listener. The refused attempt fails as soon as it starts, which must start the live one at
+// once rather than a stagger later, so the whole connect takes about one stagger, not two.
+
+#include "s-socket.h"
+#include "networking.h"
+
+#include <stdio.h>
+
+#define CHECK_PORT 39160   // blackholed listener, then the refused and live ports
+#define CHECK_STAGGER 1000
+
+static int add_candidate(struct AddrInfo *dest, size_t port)
+{
+    struct AddrInfo *one = mkaddrinfo();
+    int rc = one ? setaddrinfo("127.0.0.1", port, one) : -1;
+
+    if (rc == 0)
+        dest->list[dest->count++] = one->addr;
+    addrinfo_free(one);
+    return rc;
+}
+
+int main(void)
+{
+    struct TCPSocket *blackhole = tcp_mksocket(), *live = tcp_mksocket(), *sock = tcp_mksocket();
+    struct TCPSocket *fill[3];
+    struct AddrInfo *dest = mkaddrinfo(), *addr = mkaddrinfo();
+    unsigned long long start;
+    int i, rc;
+
+    if (sock_startup() != 0 || !blackhole || !live || !sock || !dest || !addr)
+        return 1;
+
+    // a backlog of 0 holds one handshake, the fillers take it and every later SYN goes unanswered
+    setaddrinfo("127.0.0.1", CHECK_PORT, addr);
+    tcp_mod_sock(blackhole, TCP_MOD_REUSEADDR, 1);
+    if (tcp_bind(blackhole, addr) != 0 || tcp_listen(blackhole, 0) != 0)
+        return fprintf(stderr, "can't listen on %d\n", CHECK_PORT), 1;
+    for (i = 0; i < 3; ++i) {
+        fill[i] = tcp_mksocket();
+        tcp_mod_sock(fill[i], TCP_MOD_NONBLOCK, 1);
+        tcp_connect(fill[i], addr);
+    }
+
+    setaddrinfo("127.0.0.1", CHECK_PORT + 2, addr);
+    tcp_mod_sock(live, TCP_MOD_REUSEADDR, 1);
+    if (tcp_bind(live, addr) != 0 || tcp_listen(live, 8) != 0)
+        return fprintf(stderr, "can't listen on %d\n", CHECK_PORT + 2), 1;
+
+    for (i = 0; i < 3; ++i)
+        if (add_candidate(dest, CHECK_PORT + i) != 0)
+            return 1;
+    dest->addr = dest->list[0];
+
+    start = sockNowMs();
+    rc = tcp_connect_fastest(sock, dest, CHECK_STAGGER, 5000);
+    start = sockNowMs() - start;
+    printf("tcp_connect_fastest: rc %d after %llu ms\n", rc, start);
+
+    for (i = 0; i < 3; ++i)
+        tcp_free(fill[i]);
+    tcp_free(sock);
+    tcp_free(live);
+    tcp_free(blackhole);
+    addrinfo_free(dest);
+    addrinfo_free(addr);
+    sock_cleanup();
+    return rc == 0 && start < CHECK_STAGGER * 3 / 2 ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+// Loopback check of the S-Socket C++ API in s-socket.hpp
+// ------------------------------------------------------------------------------
+//
+// One TCP echo and one sleep, each a coroutine resumed by EventLoop::run_once, with the handles moved in
+// and out of Results along the way.
+
+#include "s-socket.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#define CHECK_PORT 39170
+
+namespace {
+
+int done = 0;
+bool failed = false;
+
+void fail(const char *what, ssock::Error error)
+{
+    std::fprintf(stderr, "%s: %s\n", what, error.message());
+    failed = true;
+}
+
+ssock::Task<std::size_t> echo_once(ssock::EventLoop &loop, ssock::TcpSocket &listener)
+{
+    ssock::Result<ssock::TcpSocket> client = ssock::TcpSocket::make();
+    std::byte buf[64];
+
+    if (!client)
+        co_return 0;
+    if (ssock::Result<void> r = co_await loop.accept(listener, *client); !r) {
+        fail("accept", r.error());
+        co_return 0;
+    }
+    ssock::Result<std::size_t> n = co_await loop.recv(*client, buf);
+    if (!n)
+        co_return 0;
+    ssock::Result<std::size_t> sent = co_await loop.send(*client, std::span<const std::byte>(buf, *n));
+    co_return sent.value_or(0);
+}
+
+ssock::Task<> server(ssock::EventLoop &loop, ssock::TcpSocket &listener)
+{
+    std::size_t echoed = co_await echo_once(loop, listener);
+    if (echoed != 5)
+        failed = true;
+    done++;
+}
+
+ssock::Task<> client(ssock::EventLoop &loop, ssock::Address &addr)
+{
+    ssock::Result<ssock::TcpSocket> made = ssock::TcpSocket::make();
+    ssock::TcpSocket sock = std::move(*made);
+    std::byte buf[64];
+
+    if (!sock || !sock.set_nonblocking(true)) {
+        failed = true;
+        co_return;
+    }
+    if (ssock::Result<void> r = co_await loop.connect(sock, addr); !r) {
+        fail("connect", r.error());
+        co_return;
+    }
+    if (ssock::Result<std::size_t> r = co_await loop.send(sock, ssock::bytes("hello")); !r) {
+        fail("send", r.error());
+        co_return;
+    }
+    ssock::Result<std::size_t> n = co_await loop.recv(sock, buf);
+    if (!n || *n != 5 || std::memcmp(buf, "hello", 5) != 0)
+        failed = true;
+    done++;
+}
+
+ssock::Task<> sleeper(ssock::EventLoop &loop)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    co_await loop.sleep(50);
+    if (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(40))
+        failed = true;
+    done++;
+}
+
+} // namespace
+
+int main()
+{
+    ssock::Startup startup;
+    ssock::Result<ssock::EventLoop> loop = ssock::EventLoop::make();
+    ssock::Result<ssock::Address> addr = ssock::Address::resolve("127.0.0.1", CHECK_PORT);
+    ssock::Result<ssock::TcpSocket> listener = ssock::TcpSocket::make();
+    int rounds = 0;
+
+    if (!startup.status() || !loop || !addr || !listener)
+        return 1;
+    (void)listener->mod(TCP_MOD_REUSEADDR, 1);
+    if (ssock::Result<void> r = listener->bind(*addr); !r || !listener->listen(8) || !listener->set_nonblocking(true)) {
+        std::fprintf(stderr, "can't listen on %d\n", CHECK_PORT);
+        return 1;
+    }
+
+    server(*loop, *listener).detach();
+    client(*loop, *addr).detach();
+    sleeper(*loop).detach();
+    while (done < 3 && !failed && rounds++ < 100)
+        if (!loop->run_once(100))
+            failed = true;
+
+    std::printf("s-socket.hpp: %d of 3 coroutines finished%s\n", done, failed ? ", with failures" : "");
+    return done == 3 && !failed ? 0 : 1;
+}
@@ -1,59 +1,582 @@
+#ifndef S_SOCKET_NETWORKING_H
+#define S_SOCKET_NETWORKING_H
+
+#include "s-socket.h"
+
 #ifdef _WIN32
   /* See http://stackoverflow.com/questions/12765743/getaddrinfo-on-win32 */
   #ifndef _WIN32_WINNT
-    #define _WIN32_WINNT 0x0501  /* Windows XP. */
+    #define _WIN32_WINNT 0x0600  /* Windows Vista, needed for inet_ntop/inet_pton. */
   #endif
   #include <winsock2.h>
   #include <Ws2tcpip.h>
+  #include <windows.h>
+  #include <afunix.h> /* AF_UNIX, Windows 10 1803 and later */
+  #include <stdlib.h>
+  #include <string.h>
 #else
   /* Assume that any non-Windows platform uses POSIX-style sockets instead. */
   #include <sys/socket.h>
   #include <arpa/inet.h>
+  #include <netinet/in.h>
+  #include <sys/un.h>
   #include <netdb.h>  /* Needed for getaddrinfo() and freeaddrinfo() */
   #include <unistd.h> /* Needed for close() */
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <pthread.h>
+  #include <time.h>
+  #include <stdlib.h>
+  #include <string.h>
+#endif
+
+#ifdef _WIN32
+  typedef SOCKET sock_t;
+  #define SOCK_INVALID INVALID_SOCKET
+#else
+  typedef int sock_t;
+  #define SOCK_INVALID (-1)
 #endif
 
+/* Negative error values for argument and allocation failures, as the platform would report them */
 #ifdef _WIN32
-  typedef sock_t unsigned int;
+  #define SOCK_EINVAL (-WSAEINVAL)
+  #define SOCK_ENOMEM (-WSA_NOT_ENOUGH_MEMORY)
+  #define SOCK_ENOBUFS (-WSAENOBUFS)
+#else
+  #define SOCK_EINVAL (-EINVAL)
+  #define SOCK_ENOMEM (-ENOMEM)
+  #define SOCK_ENOBUFS (-ENOBUFS)
+#endif
+
+#ifdef _MSC_VER
+  #define SOCK_THREAD_LOCAL __declspec(thread)
+#else
+  #define SOCK_THREAD_LOCAL __thread
+#endif
+
+/* Linkage of the helpers and data the sources share with each other. In S_SOCKET_INLINE mode they are
+ * private to the including file like the API itself, so several files can each carry a copy of the library */
+#ifdef S_SOCKET_INLINE
+  #define SOCK_INTERNAL static
+  #define SOCK_INTERNAL_DATA static
+#else
+  #define SOCK_INTERNAL
+  #define SOCK_INTERNAL_DATA extern
+#endif
+
+
+/* Atomic read-modify-write returning the previous value, sequentially consistent */
+#ifdef _MSC_VER
+  #include <intrin.h>
+  static inline long sockAtomicAdd(volatile long *p, long v) { return _InterlockedExchangeAdd(p, v); }
+  static inline long sockAtomicOr(volatile long *p, long v) { return _InterlockedOr(p, v); }
+  static inline int sockAtomicCas(volatile long *p, long expect, long want)
+  {
+    return _InterlockedCompareExchange(p, want, expect) == expect;
+  }
+  static inline int sockAtomicCasPtr(void *volatile *p, void *expect, void *want)
+  {
+    return _InterlockedCompareExchangePointer(p, want, expect) == expect;
+  }
+  static inline void* sockAtomicXchgPtr(void *volatile *p, void *v) { return _InterlockedExchangePointer(p, v); }
 #else
-  typedef sock_t int;
+  static inline long sockAtomicAdd(volatile long *p, long v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+  static inline long sockAtomicOr(volatile long *p, long v) { return __atomic_fetch_or(p, v, __ATOMIC_SEQ_CST); }
+  static inline int sockAtomicCas(volatile long *p, long expect, long want)
+  {
+    return __atomic_compare_exchange_n(p, &expect, want, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  }
+  static inline int sockAtomicCasPtr(void *volatile *p, void *expect, void *want)
+  {
+    return __atomic_compare_exchange_n(p, &expect, want, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  }
+  static inline void* sockAtomicXchgPtr(void *volatile *p, void *v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
 #endif
 
+/* Process-wide winsock reference, thread safe; s-socket-win.c keeps the count */
+#ifdef _WIN32
+  int sockInit(void);
+  int sockQuit(void);
+#else
+  static inline int sockInit(void) { return 0; }
+  static inline int sockQuit(void) { return 0; }
+#endif
 
-int sockInit(void)
+/* Note: For POSIX, typedef SOCKET as an int. */
+
+static inline int sockClose(sock_t sock)
 {
+
+  int status = 0;
+
+  /* shutdown() fails on sockets that were never connected (e.g. UDP), which must not stop us from closing */
   #ifdef _WIN32
-    WSADATA wsa_data;
-    return WSAStartup(MAKEWORD(1,1), &wsa_data);
+    shutdown(sock, SD_BOTH);
+    status = closesocket(sock);
   #else
-    return 0;
+    shutdown(sock, SHUT_RDWR);
+    status = close(sock);
   #endif
+
+  return status;
+
 }
 
-int sockQuit(void)
+/* Platform error code as the negative value s-socket calls return */
+static inline int sockCode(int err)
 {
   #ifdef _WIN32
-    return WSACleanup();
+    if (err == WSAEWOULDBLOCK) return SOCK_ERR_WOULDBLOCK;
   #else
-    return 0;
+    if (err == EAGAIN || err == EWOULDBLOCK) return SOCK_ERR_WOULDBLOCK;
   #endif
+  return -err;
 }
 
-/* Note: For POSIX, typedef SOCKET as an int. */
+/* Last socket error as the negative value s-socket calls return */
+static inline int sockErr(void)
+{
+  #ifdef _WIN32
+    return sockCode(WSAGetLastError());
+  #else
+    return sockCode(errno);
+  #endif
+}
+
+static inline int sockNonblock(sock_t sock, int enable)
+{
+  #ifdef _WIN32
+    u_long mode = enable != 0;
+    return ioctlsocket(sock, FIONBIO, &mode) == SOCKET_ERROR ? sockErr() : 0;
+  #else
+    int fl = fcntl(sock, F_GETFL);
+    if (fl < 0)
+      return sockErr();
+    fl = enable ? (fl | O_NONBLOCK) : (fl & ~O_NONBLOCK);
+    return fcntl(sock, F_SETFL, fl) < 0 ? sockErr() : 0;
+  #endif
+}
 
-int sockClose(sock_t sock)
+/* Monotonic clock in milliseconds, for timeouts and cache expiry */
+static inline unsigned long long sockNowMs(void)
 {
+  #ifdef _WIN32
+    return GetTickCount64();
+  #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  #endif
+}
 
-  int status = 0;
 
+/* Minimal locking and thread shims for the parts of the library that run work off the caller's thread */
+
+#ifdef _WIN32
+  typedef SRWLOCK sock_mutex;
+  typedef CONDITION_VARIABLE sock_cond;
+  #define SOCK_MUTEX_INIT SRWLOCK_INIT
+  #define SOCK_COND_INIT CONDITION_VARIABLE_INIT
+  #define SOCK_THREAD_FN(name) DWORD WINAPI name(void *arg)
+  #define SOCK_THREAD_RET return 0
+  typedef DWORD (WINAPI *sock_thread_fn)(void*);
+#else
+  typedef pthread_mutex_t sock_mutex;
+  typedef pthread_cond_t sock_cond;
+  #define SOCK_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+  #define SOCK_COND_INIT PTHREAD_COND_INITIALIZER
+  #define SOCK_THREAD_FN(name) void *name(void *arg)
+  #define SOCK_THREAD_RET return NULL
+  typedef void *(*sock_thread_fn)(void*);
+#endif
+
+static inline void sockLock(sock_mutex *m)
+{
   #ifdef _WIN32
-    status = shutdown(sock, SD_BOTH);
-    if (status == 0) { status = closesocket(sock); }
+    AcquireSRWLockExclusive(m);
   #else
-    status = shutdown(sock, SHUT_RDWR);
-    if (status == 0) { status = close(sock); }
+    pthread_mutex_lock(m);
   #endif
+}
 
-  return status;
+static inline void sockUnlock(sock_mutex *m)
+{
+  #ifdef _WIN32
+    ReleaseSRWLockExclusive(m);
+  #else
+    pthread_mutex_unlock(m);
+  #endif
+}
 
+/* Releases m while waiting, like pthread_cond_wait */
+static inline void sockWait(sock_cond *c, sock_mutex *m)
+{
+  #ifdef _WIN32
+    SleepConditionVariableSRW(c, m, INFINITE, 0);
+  #else
+    pthread_cond_wait(c, m);
+  #endif
+}
+
+static inline void sockSignal(sock_cond *c)
+{
+  #ifdef _WIN32
+    WakeConditionVariable(c);
+  #else
+    pthread_cond_signal(c);
+  #endif
 }
+
+/* Starts a detached thread running fn(arg), zero on success */
+static inline int sockThread(sock_thread_fn fn, void *arg)
+{
+  #ifdef _WIN32
+    HANDLE t = CreateThread(NULL, 0, fn, arg, 0, NULL);
+    if (!t)
+      return -(int)GetLastError();
+    CloseHandle(t);
+    return 0;
+  #else
+    pthread_t t;
+    int rc = pthread_create(&t, NULL, fn, arg);
+    if (rc != 0)
+      return -rc;
+    pthread_detach(t);
+    return 0;
+  #endif
+}
+
+
+/* Handle definitions shared by the platform backends */
+
+struct AddrInfo {
+  struct sockaddr_storage addr;                /* the address every call uses, ipv4, ipv6 or a unix path */
+  struct sockaddr_storage list[SOCK_ADDR_MAX]; /* candidates from the last setaddrinfo, see addrinfo_select */
+  unsigned count;
+  char host[INET6_ADDRSTRLEN];
+};
+
+/* Handle state bits kept in the flags field */
+enum {
+  SOCK_F_NONBLOCK = 1 << 0,
+  SOCK_F_ZEROCOPY = 1 << 1,
+  SOCK_F_INET6    = 1 << 2, /* AF_INET6 socket, reaching ipv4 peers through v4-mapped addresses */
+  SOCK_F_EXTERNAL = 1 << 3, /* handle lives in caller or pool storage, free closes it without releasing memory */
+  SOCK_F_UNIX     = 1 << 4  /* AF_UNIX socket, see sockFamily */
+};
+
+/* Length of an ipv4, ipv6 or unix socket address */
+static inline socklen_t sockAddrLen(const struct sockaddr_storage *a)
+{
+  if (a->ss_family == AF_UNIX)
+    return sizeof(struct sockaddr_un);
+  return a->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+/*
+ * Unnamed unix peers are reported as a bare family, leaving the path alone, so receive and accept
+ * calls empty it first for gethost to find
+ */
+static inline void sockNameClear(struct sockaddr_storage *a)
+{
+  ((struct sockaddr_un*)a)->sun_path[0] = '\0';
+}
+
+/*
+ * Opens a socket of the given type, ipv6 dual stack when the host has ipv6 and ipv4 otherwise,
+ * recording which in *flags. Every call can then take either family of AddrInfo.
+ */
+static inline sock_t sockOpen(int type, unsigned *flags)
+{
+  int off = 0;
+  sock_t fd = socket(AF_INET6, type, 0);
+
+  if (fd != SOCK_INVALID) {
+    /* windows defaults to v6 only and linux follows a sysctl, so always ask for dual stack */
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (char*)&off, sizeof(off));
+    *flags |= SOCK_F_INET6;
+    return fd;
+  }
+  *flags &= ~SOCK_F_INET6;
+  return socket(AF_INET, type, 0);
+}
+
+/*
+ * Gives a handle the socket family an address needs before bind or connect: an AF_UNIX socket for a unix
+ * path, one from sockOpen for anything else. Sockets start out as sockOpen made them, so this replaces the
+ * descriptor only when a handle first meets the other kind, dropping any options set on the old one.
+ */
+static inline int sockFamily(sock_t *fd, int type, unsigned *flags, const struct sockaddr_storage *a)
+{
+  int want = a->ss_family == AF_UNIX;
+  unsigned fresh = *flags & ~(SOCK_F_INET6 | SOCK_F_UNIX | SOCK_F_ZEROCOPY);
+  sock_t sock;
+
+  if (want == ((*flags & SOCK_F_UNIX) != 0))
+    return 0;
+  sock = want ? socket(AF_UNIX, type, 0) : sockOpen(type, &fresh);
+  if (sock == SOCK_INVALID)
+    return sockErr();
+  if ((fresh & SOCK_F_NONBLOCK) && sockNonblock(sock, 1) != 0) {
+    int rc = sockErr();
+    sockClose(sock);
+    return rc;
+  }
+  if (*fd != SOCK_INVALID)
+    sockClose(*fd);
+  *fd = sock;
+  *flags = fresh | (want ? SOCK_F_UNIX : 0);
+  return 0;
+}
+
+/*
+ * Address to hand the kernel for a on a socket with the given handle flags. ipv6 sockets see
+ * ipv4 addresses in v4-mapped form, built in tmp.
+ */
+static inline struct sockaddr* sockName(unsigned flags, struct sockaddr_storage *a, struct sockaddr_in6 *tmp, socklen_t *len)
+{
+  if ((flags & SOCK_F_INET6) && a->ss_family == AF_INET) {
+    struct sockaddr_in *v4 = (struct sockaddr_in*)a;
+    memset(tmp, 0, sizeof(*tmp));
+    tmp->sin6_family = AF_INET6;
+    tmp->sin6_port = v4->sin_port;
+    tmp->sin6_addr.s6_addr[10] = 0xff;
+    tmp->sin6_addr.s6_addr[11] = 0xff;
+    memcpy(&tmp->sin6_addr.s6_addr[12], &v4->sin_addr, 4);
+    *len = sizeof(*tmp);
+    return (struct sockaddr*)tmp;
+  }
+  *len = sockAddrLen(a);
+  return (struct sockaddr*)a;
+}
+
+/* Largest udp payload one datagram to a can carry: 65535 less the udp header, and less the ipv4 header
+ * too unless a is ipv6, whose header isn't counted in its payload length */
+static inline size_t sockUdpPayloadMax(const struct sockaddr_storage *a)
+{
+  return a->ss_family == AF_INET6 ? 65527 : 65507;
+}
+
+/* Turns a v4-mapped address the kernel reported back into the plain ipv4 form callers use */
+static inline void sockUnmap(struct sockaddr_storage *a)
+{
+  struct sockaddr_in6 *v6 = (struct sockaddr_in6*)a;
+  struct sockaddr_in v4;
+
+  if (a->ss_family != AF_INET6 || !IN6_IS_ADDR_V4MAPPED(&v6->sin6_addr))
+    return;
+  memset(&v4, 0, sizeof(v4));
+  v4.sin_family = AF_INET;
+  v4.sin_port = v6->sin6_port;
+  memcpy(&v4.sin_addr, &v6->sin6_addr.s6_addr[12], 4);
+  memcpy(a, &v4, sizeof(v4));
+}
+
+/*
+ * Data call counters, compiled in with S_SOCKET_STATS. Each handle keeps its own, updated with relaxed
+ * atomics since a handle may be shared between threads, and every thread keeps a block of process-wide
+ * totals that only it writes, so counting never bounces a shared cache line. See s-socket-stats.c
+ */
+#ifdef S_SOCKET_STATS
+enum {
+  SOCK_STAT_BYTES_SENT,     /* send and receive counters alternate, so a direction is an offset of 0 or 1 */
+  SOCK_STAT_BYTES_RECEIVED,
+  SOCK_STAT_SENDS,
+  SOCK_STAT_RECEIVES,
+  SOCK_STAT_SHORT_SENDS,
+  SOCK_STAT_SHORT_RECEIVES,
+  SOCK_STAT_WOULDBLOCK,
+  SOCK_STAT_ERRORS,
+  SOCK_STAT_COUNT
+};
+
+struct SockCounters {
+  volatile long long v[SOCK_STAT_COUNT];
+};
+
+/* This thread's block, NULL until its first counted call */
+SOCK_INTERNAL_DATA SOCK_THREAD_LOCAL struct SockCounters *sock_thread_counters;
+SOCK_INTERNAL struct SockCounters* sockThreadCounters(void);
+
+#ifdef _MSC_VER
+  /* aligned 64-bit loads and stores don't tear on x64, which is all the owner-only thread blocks need */
+  static inline void sockStatAdd(volatile long long *p, long long v) { _InterlockedExchangeAdd64(p, v); }
+  static inline void sockStatBump(volatile long long *p, long long v) { *p += v; }
+  static inline long long sockStatLoad(volatile long long *p) { return *p; }
+#else
+  static inline void sockStatAdd(volatile long long *p, long long v) { __atomic_fetch_add(p, v, __ATOMIC_RELAXED); }
+  static inline void sockStatBump(volatile long long *p, long long v)
+  {
+    __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+  }
+  static inline long long sockStatLoad(volatile long long *p) { return __atomic_load_n(p, __ATOMIC_RELAXED); }
+#endif
+
+static inline void sockCount(struct SockCounters *c, int stat, long long n)
+{
+  struct SockCounters *t = sock_thread_counters ? sock_thread_counters : sockThreadCounters();
+  sockStatAdd(&c->v[stat], n);
+  sockStatBump(&t->v[stat], n);
+}
+
+/*
+ * Accounts for one data call of direction dir (0 send, 1 receive) that returned rc. want is what a stream
+ * call asked to move, so a smaller positive result counts as short; 0 where that doesn't apply
+ */
+static inline void sockStatCall(struct SockCounters *c, int dir, size_t want, long long rc)
+{
+  if (rc >= 0) {
+    sockCount(c, SOCK_STAT_BYTES_SENT + dir, rc);
+    sockCount(c, SOCK_STAT_SENDS + dir, 1);
+    if (rc > 0 && (size_t)rc < want)
+      sockCount(c, SOCK_STAT_SHORT_SENDS + dir, 1);
+  } else {
+    sockCount(c, rc == SOCK_ERR_WOULDBLOCK ? SOCK_STAT_WOULDBLOCK : SOCK_STAT_ERRORS, 1);
+  }
+}
+
+/* Bytes a vectored call asks to move */
+static inline size_t sockBufsLen(struct SockBuf *bufs, size_t nbufs)
+{
+  size_t i, len = 0;
+  for (i = 0; i < nbufs; ++i)
+    len += bufs[i].len;
+  return len;
+}
+
+/* A batch call counts each datagram it moved, or its error if it moved none */
+static inline void sockStatBatch(struct SockCounters *c, int dir, struct UDPMsg *msgs, int n)
+{
+  int i;
+  if (n < 0)
+    sockStatCall(c, dir, 0, n);
+  for (i = 0; i < n; ++i)
+    sockStatCall(c, dir, 0, msgs[i].result);
+}
+
+  #define SOCK_STATS_INIT(sock) memset(&(sock)->stats, 0, sizeof((sock)->stats))
+  #define SOCK_STAT_SEND(sock, want, rc) sockStatCall(&(sock)->stats, 0, want, rc)
+  #define SOCK_STAT_RECV(sock, want, rc) sockStatCall(&(sock)->stats, 1, want, rc)
+  #define SOCK_STAT_BATCH(sock, dir, msgs, n) sockStatBatch(&(sock)->stats, dir, msgs, n)
+#else
+  #define SOCK_STATS_INIT(sock) ((void)0)
+  #define SOCK_STAT_SEND(sock, want, rc) ((void)0)
+  #define SOCK_STAT_RECV(sock, want, rc) ((void)0)
+  #define SOCK_STAT_BATCH(sock, dir, msgs, n) ((void)0)
+#endif
+
+struct UDPSocket {
+  sock_t fd;
+  unsigned flags;
+  volatile long refs;    /* see sockEnter */
+  struct SockPool *pool; /* pool the handle goes back to on free, NULL otherwise */
+#ifdef S_SOCKET_STATS
+  struct SockCounters stats;
+#endif
+};
+
+struct TCPSocket {
+  sock_t fd;
+  unsigned flags;
+  volatile long refs;
+  struct SockPool *pool;
+#ifdef S_SOCKET_STATS
+  struct SockCounters stats;
+#endif
+};
+
+/*
+ * Handle lifetime: refs holds SOCK_REF_ONE for the owner plus one for every call in flight, with
+ * SOCK_REF_CLOSING set once free has started. Whoever drops the last reference closes the
+ * descriptor and releases the memory, so a free racing a blocked recv never pulls the fd out
+ * from under it.
+ */
+enum {
+  SOCK_REF_CLOSING = 1,
+  SOCK_REF_ONE     = 2
+};
+
+/* Takes a call reference, zero if the handle is being freed (the reference must still be dropped) */
+static inline int sockEnter(volatile long *refs)
+{
+  return (sockAtomicAdd(refs, SOCK_REF_ONE) & SOCK_REF_CLOSING) == 0;
+}
+
+/* Drops a reference, non-zero if it was the last one and the handle must now be destroyed */
+static inline int sockLeave(volatile long *refs)
+{
+  return sockAtomicAdd(refs, -SOCK_REF_ONE) == (SOCK_REF_ONE | SOCK_REF_CLOSING);
+}
+
+/* Starts freeing a handle, zero if that had already happened */
+static inline int sockClosing(volatile long *refs)
+{
+  return (sockAtomicOr(refs, SOCK_REF_CLOSING) & SOCK_REF_CLOSING) == 0;
+}
+
+/* Caller storage is sized from the public constants, so the handles must never outgrow them */
+typedef char sock_udp_size_check[sizeof(struct UDPSocket) <= S_SOCKET_UDP_SIZE ? 1 : -1];
+typedef char sock_tcp_size_check[sizeof(struct TCPSocket) <= S_SOCKET_TCP_SIZE ? 1 : -1];
+
+/* Receive buffer pool, shared with the completion ring, see s-socket-pool.c */
+struct SockBufPool {
+  unsigned char *arena;  /* count buffers, stride bytes apart */
+  size_t size;           /* usable bytes per buffer */
+  size_t stride;         /* size rounded up to whole cache lines */
+  size_t count;
+  size_t *free;          /* stack of free buffer indices */
+  size_t nfree;
+  sock_mutex lock;
+};
+
+/* Index of a buffer in its pool's arena, -1 if buf is not the start of one */
+static inline long sockBufIndex(struct SockBufPool *pool, void *buf)
+{
+  unsigned char *p = buf;
+  if (p < pool->arena || p >= pool->arena + pool->count * pool->stride ||
+      (size_t)(p - pool->arena) % pool->stride != 0)
+    return -1;
+  return (long)((size_t)(p - pool->arena) / pool->stride);
+}
+
+/* Hierarchical timing wheel behind the loop timers, one per SockLoop, see s-socket-timer.c. Level n slots
+ * cover 64^n milliseconds each, so four levels reach about 4.6 hours and later deadlines are re-queued */
+#define SOCK_WHEEL_BITS 6
+#define SOCK_WHEEL_SLOTS (1 << SOCK_WHEEL_BITS)
+#define SOCK_WHEEL_LEVELS 4
+
+struct SockWheel {
+  struct SockTimer *slots[SOCK_WHEEL_LEVELS][SOCK_WHEEL_SLOTS];
+  unsigned long long occupied[SOCK_WHEEL_LEVELS];  /* bit per non-empty slot */
+  struct SockTimer *expired, *expired_tail;        /* fired, not yet reported by loop_wait */
+  unsigned long long now;                          /* next millisecond tick to process */
+};
+
+SOCK_INTERNAL void sock_wheel_init(struct SockWheel *wheel);
+SOCK_INTERNAL void sock_wheel_add(struct SockWheel *wheel, struct SockTimer *timer, unsigned timeout_ms, void *udata);
+SOCK_INTERNAL void sock_wheel_del(struct SockWheel *wheel, struct SockTimer *timer);
+/* timeout_ms shortened to the next deadline */
+SOCK_INTERNAL int sock_wheel_timeout(struct SockWheel *wheel, int timeout_ms);
+/* Stores up to maxevents fired timers as SOCK_EV_TIMER events */
+SOCK_INTERNAL size_t sock_wheel_expire(struct SockWheel *wheel, struct SockEvent *events, size_t maxevents);
+
+/* Cpu placement for the runtime workers, see s-socket-linux.c and s-socket-win.c. sock_cpu_for maps a
+ * worker index to a cpu the process may run on, interleaving numa nodes when numa is set so neighbouring
+ * workers land on different memory controllers; sock_cpu_pin binds the calling thread to that cpu */
+SOCK_INTERNAL int sock_cpu_for(int worker, int numa);
+SOCK_INTERNAL int sock_cpu_pin(int cpu);
+
+/* Returns a pooled handle's slot, see s-socket-pool.c */
+SOCK_INTERNAL void sock_pool_put(struct SockPool *pool, void *handle);
+
+/* Releases a handle's memory once its descriptor is closed, wherever that memory came from */
+static inline void sockRelease(void *handle, struct SockPool *pool, unsigned flags)
+{
+  if (pool)
+    sock_pool_put(pool, handle);
+  else if (!(flags & SOCK_F_EXTERNAL))
+    free(handle);
+}
+
+#endif /* S_SOCKET_NETWORKING_H */
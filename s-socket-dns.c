@@ -0,0 +1,371 @@
+// Resolver for the S-Socket C API, shared by both backends, see s-socket.h for documentation
+// ------------------------------------------------------------------------------
+
+#include "s-socket.h"
+#include "networking.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Cache slots, a (host, port) key may live in any of DNS_CACHE_WAYS slots starting at its hash
+#define DNS_CACHE_SLOTS 256
+#define DNS_CACHE_WAYS 4
+
+// Longest hostname the cache keeps, longer names are always resolved
+#define DNS_HOST_MAX 256
+
+// Most resolver threads setaddrinfo_async runs at once
+#define DNS_WORKERS_MAX 4
+
+
+// -----------------------
+// ---- Resolver core ----
+// -----------------------
+
+// Sets the port of an ipv4 or ipv6 address
+static void dns_port(struct sockaddr_storage *a, size_t port)
+{
+    if (a->ss_family == AF_INET6)
+        ((struct sockaddr_in6*)a)->sin6_port = htons((unsigned short)port);
+    else
+        ((struct sockaddr_in*)a)->sin_port = htons((unsigned short)port);
+}
+
+static int dns_numeric(const char *host, size_t port, struct AddrInfo *out)
+{
+    struct sockaddr_storage addr;
+    struct sockaddr_in *v4 = (struct sockaddr_in*)&addr;
+    struct sockaddr_in6 *v6 = (struct sockaddr_in6*)&addr;
+
+    memset(&addr, 0, sizeof(addr));
+    if (inet_pton(AF_INET, host, &v4->sin_addr) == 1)
+        addr.ss_family = AF_INET;
+    else if (inet_pton(AF_INET6, host, &v6->sin6_addr) == 1)
+        addr.ss_family = AF_INET6;
+    else
+        return 0;
+    dns_port(&addr, port);
+    out->addr = addr;
+    out->list[0] = addr;
+    out->count = 1;
+    return 1;
+}
+
+static int dns_same(const struct sockaddr_storage *a, const struct addrinfo *ai)
+{
+    return a->ss_family == ai->ai_family && memcmp(a, ai->ai_addr, ai->ai_addrlen) == 0;
+}
+
+static int dns_lookup(const char *host, size_t port, struct AddrInfo *out)
+{
+    struct addrinfo hints, *res, *ai;
+    struct sockaddr_storage found[SOCK_ADDR_MAX];
+    unsigned i, n = 0, first = 0, other = 0;
+    int rc;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    // only ask for ipv6 answers when the host has an ipv6 address configured, and vice versa
+    hints.ai_flags = AI_ADDRCONFIG;
+
+    // getaddrinfo needs winsock to be started even if no socket exists yet
+    if (sockInit() != 0)
+        return sockErr();
+    rc = getaddrinfo(host, NULL, &hints, &res);
+    if (rc == 0) {
+        // Keep every distinct address in resolver order, getaddrinfo repeats them per protocol
+        for (ai = res; ai && n < SOCK_ADDR_MAX; ai = ai->ai_next) {
+            if ((ai->ai_family != AF_INET && ai->ai_family != AF_INET6) || ai->ai_addrlen > sizeof(found[0]))
+                continue;
+            for (i = 0; i < n; ++i)
+                if (dns_same(&found[i], ai))
+                    break;
+            if (i == n) {
+                memset(&found[n], 0, sizeof(found[n]));
+                memcpy(&found[n], ai->ai_addr, ai->ai_addrlen);
+                dns_port(&found[n++], port);
+            }
+        }
+        freeaddrinfo(res);
+
+        // Alternate families starting with the resolver's preferred one (RFC 8305 section 4),
+        // so tcp_connect_fastest tries the other family second rather than last
+        for (i = 0; i < n; ++i) {
+            int want = (i % 2 == 0) ? found[0].ss_family : (found[0].ss_family == AF_INET ? AF_INET6 : AF_INET);
+            unsigned *next = want == found[0].ss_family ? &first : &other;
+            while (*next < n && found[*next].ss_family != want)
+                ++*next;
+            if (*next == n) {
+                // that family ran out, the rest comes from the other one
+                next = next == &first ? &other : &first;
+                want = want == AF_INET ? AF_INET6 : AF_INET;
+                while (*next < n && found[*next].ss_family != want)
+                    ++*next;
+            }
+            out->list[i] = found[(*next)++];
+        }
+        out->addr = out->list[0];
+        out->count = n;
+        if (n == 0)
+            rc = -1;
+    }
+    sockQuit();
+
+    return rc == 0 ? 0 : SOCK_ERR_RESOLVE;
+}
+
+
+// -------------------
+// ---- TTL cache ----
+// -------------------
+
+struct DNSEntry {
+    char host[DNS_HOST_MAX];
+    size_t port;
+    unsigned long long expires; // sockNowMs() deadline, zero for an empty slot
+    struct AddrInfo info;
+};
+
+static struct DNSEntry dns_cache[DNS_CACHE_SLOTS];
+static unsigned dns_ttl = SOCK_DNS_TTL_DEFAULT;
+static sock_mutex dns_cache_lock = SOCK_MUTEX_INIT;
+
+// FNV-1a over the host followed by the port
+static unsigned dns_hash(const char *host, size_t port)
+{
+    unsigned h = 2166136261u;
+    for (; *host; ++host)
+        h = (h ^ (unsigned char)*host) * 16777619u;
+    h = (h ^ (unsigned)port) * 16777619u;
+    return h;
+}
+
+static int dns_cache_get(const char *host, size_t len, size_t port, struct AddrInfo *out)
+{
+    unsigned h = dns_hash(host, port);
+    unsigned long long now;
+    int i, hit = 0;
+
+    if (len >= DNS_HOST_MAX)
+        return 0;
+
+    now = sockNowMs();
+    sockLock(&dns_cache_lock);
+    for (i = 0; i < DNS_CACHE_WAYS; ++i) {
+        struct DNSEntry *e = &dns_cache[(h + i) % DNS_CACHE_SLOTS];
+        if (e->expires > now && e->port == port && strcmp(e->host, host) == 0) {
+            *out = e->info;
+            hit = 1;
+            break;
+        }
+    }
+    sockUnlock(&dns_cache_lock);
+    return hit;
+}
+
+static void dns_cache_put(const char *host, size_t len, size_t port, const struct AddrInfo *info)
+{
+    unsigned h = dns_hash(host, port);
+    unsigned long long now;
+    struct DNSEntry *victim = NULL;
+    int i;
+
+    if (len >= DNS_HOST_MAX)
+        return;
+
+    now = sockNowMs();
+    sockLock(&dns_cache_lock);
+    if (dns_ttl != 0) {
+        // Refresh the existing entry if there is one, otherwise evict whichever expires first
+        for (i = 0; i < DNS_CACHE_WAYS; ++i) {
+            struct DNSEntry *e = &dns_cache[(h + i) % DNS_CACHE_SLOTS];
+            if (e->port == port && strcmp(e->host, host) == 0) {
+                victim = e;
+                break;
+            }
+            if (!victim || e->expires < victim->expires)
+                victim = e;
+        }
+        memcpy(victim->host, host, len + 1);
+        victim->port = port;
+        victim->info = *info;
+        victim->expires = now + dns_ttl;
+    }
+    sockUnlock(&dns_cache_lock);
+}
+
+void setaddrinfo_cache_ttl(unsigned ttl_ms)
+{
+    sockLock(&dns_cache_lock);
+    dns_ttl = ttl_ms;
+    if (ttl_ms == 0)
+        memset(dns_cache, 0, sizeof(dns_cache));
+    sockUnlock(&dns_cache_lock);
+}
+
+
+// -------------------------
+// ---- Synchronous API ----
+// -------------------------
+
+// Resolves without blocking when possible, returns 1 if out was filled from the fast paths
+static int dns_fast(const char *host, size_t len, size_t port, struct AddrInfo *out)
+{
+    return dns_numeric(host, port, out) || dns_cache_get(host, len, port, out);
+}
+
+int setaddrinfo(char *host,
+                size_t port,
+                struct AddrInfo *out)
+{
+    size_t len;
+    int rc;
+
+    if (!host || !out || port > 65535)
+        return SOCK_EINVAL;
+
+    len = strlen(host);
+    if (dns_fast(host, len, port, out))
+        return 0;
+
+    rc = dns_lookup(host, port, out);
+    if (rc == 0)
+        dns_cache_put(host, len, port, out);
+    return rc;
+}
+
+int setaddrinfo_unix(char *path,
+                     struct AddrInfo *out)
+{
+    struct sockaddr_un *un;
+    size_t len;
+
+    if (!path || !out)
+        return SOCK_EINVAL;
+    un = (struct sockaddr_un*)&out->addr;
+    len = strlen(path);
+    // the path has to fit with its terminator, sockAddrLen hands the kernel the whole structure
+    if (len == 0 || len >= sizeof(un->sun_path))
+        return SOCK_EINVAL;
+
+    memset(&out->addr, 0, sizeof(out->addr));
+    un->sun_family = AF_UNIX;
+    memcpy(un->sun_path, path, len);
+    out->list[0] = out->addr;
+    out->count = 1;
+    return 0;
+}
+
+
+// --------------------------
+// ---- Asynchronous API ----
+// --------------------------
+
+struct DNSJob {
+    struct DNSJob *next;
+    struct AddrInfo *out;
+    sock_resolve_cb cb;
+    void *udata;
+    size_t port;
+    size_t len;
+    char host[]; // len + 1 bytes
+};
+
+static struct DNSJob *dns_head, *dns_tail;
+static int dns_workers, dns_idle;
+static int dns_queued; // jobs no worker has claimed yet
+static sock_mutex dns_queue_lock = SOCK_MUTEX_INIT;
+static sock_cond dns_queue_cond = SOCK_COND_INIT;
+
+static SOCK_THREAD_FN(dns_worker)
+{
+    (void)arg;
+
+    for (;;) {
+        struct DNSJob *job;
+        int rc;
+
+        sockLock(&dns_queue_lock);
+        ++dns_idle;
+        while (!dns_head)
+            sockWait(&dns_queue_cond, &dns_queue_lock);
+        --dns_idle;
+        --dns_queued;
+        job = dns_head;
+        dns_head = job->next;
+        if (!dns_head)
+            dns_tail = NULL;
+        sockUnlock(&dns_queue_lock);
+
+        // An earlier job for the same name may have filled the cache while this one was queued
+        if (dns_cache_get(job->host, job->len, job->port, job->out)) {
+            rc = 0;
+        } else {
+            rc = dns_lookup(job->host, job->port, job->out);
+            if (rc == 0)
+                dns_cache_put(job->host, job->len, job->port, job->out);
+        }
+
+        job->cb(job->out, rc, job->udata);
+        free(job);
+    }
+
+    SOCK_THREAD_RET;
+}
+
+int setaddrinfo_async(char *host,
+                      size_t port,
+                      struct AddrInfo *out,
+                      sock_resolve_cb cb,
+                      void *udata)
+{
+    struct DNSJob *job;
+    size_t len;
+    int rc = 0;
+
+    if (!host || !out || !cb || port > 65535)
+        return SOCK_EINVAL;
+
+    len = strlen(host);
+    if (dns_fast(host, len, port, out)) {
+        cb(out, 0, udata);
+        return 0;
+    }
+
+    job = malloc(sizeof(*job) + len + 1);
+    if (!job)
+        return SOCK_ENOMEM;
+    job->next = NULL;
+    job->out = out;
+    job->cb = cb;
+    job->udata = udata;
+    job->port = port;
+    job->len = len;
+    memcpy(job->host, host, len + 1);
+
+    sockLock(&dns_queue_lock);
+    // Grow the worker pool once the jobs waiting, this one included, outnumber the idle workers; a worker
+    // that was signalled but hasn't woken yet still counts as idle, and as bound to an earlier job
+    if (dns_queued >= dns_idle && dns_workers < DNS_WORKERS_MAX) {
+        rc = sockThread(dns_worker, NULL);
+        if (rc == 0)
+            ++dns_workers;
+        else if (dns_workers > 0)
+            rc = 0; // the running workers will get to it
+    }
+    if (rc == 0) {
+        if (dns_tail)
+            dns_tail->next = job;
+        else
+            dns_head = job;
+        dns_tail = job;
+        ++dns_queued;
+        sockSignal(&dns_queue_cond);
+    }
+    sockUnlock(&dns_queue_lock);
+
+    if (rc != 0)
+        free(job);
+    return rc;
+}
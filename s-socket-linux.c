@@ -1,2 +1,2362 @@
-struct AddrInfo {
+// Linux backend for the S-Socket C API, see s-socket.h for documentation
+// ------------------------------------------------------------------------------
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "s-socket.h"
+#include "networking.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sched.h>
+#include <poll.h>
+#include <linux/filter.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/tls.h>
+
+// Most datagrams handed to the kernel in a single recvmmsg/sendmmsg call
+#define UDP_BATCH_MAX 64
+
+// Most epoll events collected per epoll_wait call
+#define LOOP_EVENTS_MAX 256
+
+// Older libc headers lack the UDP offload options, the kernel ABI values are fixed
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// Same for kernel TLS, which arrived later still
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef TLS_TX_ZEROCOPY_RO
+#define TLS_TX_ZEROCOPY_RO 3
+#endif
+
+
+// ---------------------
+// ---- Library API ----
+// ---------------------
+
+// Nothing to start on linux, sockets work without any process-wide setup
+int sock_startup()
+{
+    return 0;
+}
+
+int sock_cleanup()
+{
+    return 0;
+}
+
+// Bit (1 << feature) per SOCK_FEATURE_*, with FEATURES_PROBED set once the probe has run
+#define FEATURES_PROBED (1 << 30)
+static volatile long sock_features;
+
+// Each feature is an option the kernel rejects when it doesn't know it
+static long features_probe(void)
+{
+    long found = FEATURES_PROBED;
+    int udp = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int tcp = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int value = 0;
+    socklen_t len = sizeof(value);
+
+    if (udp >= 0) {
+        if (getsockopt(udp, SOL_UDP, UDP_SEGMENT, &value, &len) == 0)
+            found |= 1 << SOCK_FEATURE_UDP_GSO;
+        value = 0;
+        if (setsockopt(udp, SOL_UDP, UDP_GRO, &value, sizeof(value)) == 0)
+            found |= 1 << SOCK_FEATURE_UDP_GRO;
+        if (setsockopt(udp, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value)) == 0)
+            found |= 1 << SOCK_FEATURE_REUSEPORT;
+        close(udp);
+    }
+    if (tcp >= 0) {
+        value = 0;
+        if (setsockopt(tcp, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) == 0)
+            found |= 1 << SOCK_FEATURE_ZEROCOPY;
+        // the tls module only takes connected sockets, one that's present says so
+        if (setsockopt(tcp, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0 && errno == ENOTCONN)
+            found |= 1 << SOCK_FEATURE_KTLS;
+        close(tcp);
+    }
+    return found;
+}
+
+int sock_supports(int feature)
+{
+    long found = sock_features;
+
+    if (feature < SOCK_FEATURE_UDP_GSO || feature > SOCK_FEATURE_KTLS)
+        return 0;
+    // racing first callers all probe and store the same answer
+    if (!(found & FEATURES_PROBED)) {
+        found = features_probe();
+        sockAtomicOr(&sock_features, found);
+    }
+    return (found >> feature) & 1;
+}
+
+
+// ---------------------
+// ---- Address API ----
+// ---------------------
+
+struct AddrInfo* mkaddrinfo()
+{
+    return calloc(1, sizeof(struct AddrInfo));
+}
+
+void addrinfo_free(struct AddrInfo *info)
+{
+    free(info);
+}
+
+int addrinfo_count(struct AddrInfo *info)
+{
+    return info ? (int)info->count : -EINVAL;
+}
+
+int addrinfo_select(struct AddrInfo *info, size_t index)
+{
+    if (!info || index >= info->count)
+        return -EINVAL;
+    info->addr = info->list[index];
+    return 0;
+}
+
+char* gethost(struct AddrInfo *in)
+{
+    const void *ip;
+
+    if (!in)
+        return NULL;
+    if (in->addr.ss_family == AF_UNIX)
+        return ((struct sockaddr_un*)&in->addr)->sun_path;
+    ip = in->addr.ss_family == AF_INET6 ? (const void*)&((struct sockaddr_in6*)&in->addr)->sin6_addr
+                                        : (const void*)&((struct sockaddr_in*)&in->addr)->sin_addr;
+    if (!inet_ntop(in->addr.ss_family, ip, in->host, sizeof(in->host)))
+        return NULL;
+    return in->host;
+}
+
+int getport(struct AddrInfo *in)
+{
+    if (!in)
+        return -EINVAL;
+    if (in->addr.ss_family == AF_UNIX)
+        return 0;
+    if (in->addr.ss_family == AF_INET6)
+        return ntohs(((struct sockaddr_in6*)&in->addr)->sin6_port);
+    return ntohs(((struct sockaddr_in*)&in->addr)->sin_port);
+}
+
+
+// -----------------
+// ---- UDP API ----
+// -----------------
+
+// Option helpers shared by udp_mod_sock/tcp_mod_sock and their getters
+static int opt_set(sock_t fd, int level, int name, int value)
+{
+    return setsockopt(fd, level, name, &value, sizeof(value)) < 0 ? sockErr() : 0;
+}
+
+static int opt_get(sock_t fd, int level, int name, int *value)
+{
+    socklen_t len = sizeof(*value);
+    *value = 0;
+    return getsockopt(fd, level, name, value, &len) < 0 ? sockErr() : 0;
+}
+
+static int opt_get_bool(sock_t fd, int level, int name, int *value)
+{
+    int rc = opt_get(fd, level, name, value);
+    *value = *value != 0;
+    return rc;
+}
+
+static int opt_set_timeo(sock_t fd, int name, int ms)
+{
+    struct timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    return setsockopt(fd, SOL_SOCKET, name, &tv, sizeof(tv)) < 0 ? sockErr() : 0;
+}
+
+static int opt_get_timeo(sock_t fd, int name, int *ms)
+{
+    struct timeval tv;
+    socklen_t len = sizeof(tv);
+    if (getsockopt(fd, SOL_SOCKET, name, &tv, &len) < 0)
+        return sockErr();
+    *ms = (int)(tv.tv_sec * 1000 + tv.tv_usec / 1000);
+    return 0;
+}
+
+// Dual stack sockets carry ipv4 traffic too, so options that exist once per family (traffic class and
+// TOS, multicast hops and TTL, ...) are set at both levels
+static int opt_set_dual(sock_t fd, unsigned flags, int name6, int name4, int value)
+{
+    int rc;
+    if ((flags & SOCK_F_INET6) && (rc = opt_set(fd, IPPROTO_IPV6, name6, value)) < 0)
+        return rc;
+    return opt_set(fd, IPPROTO_IP, name4, value);
+}
+
+static int opt_get_dual(sock_t fd, unsigned flags, int name6, int name4, int *value)
+{
+    return (flags & SOCK_F_INET6) ? opt_get(fd, IPPROTO_IPV6, name6, value) : opt_get(fd, IPPROTO_IP, name4, value);
+}
+
+// IP_MULTICAST_IF takes an address or, in an ip_mreqn, an interface index
+static int opt_set_mcast_if(sock_t fd, unsigned flags, int ifindex)
+{
+    struct ip_mreqn req;
+    int rc;
+
+    if ((flags & SOCK_F_INET6) && (rc = opt_set(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, ifindex)) < 0)
+        return rc;
+    memset(&req, 0, sizeof(req));
+    req.imr_ifindex = ifindex;
+    return setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &req, sizeof(req)) < 0 ? sockErr() : 0;
+}
+
+// Room for the SCM_TIMESTAMPING control message of one receive
+#define TSTAMP_CONTROL CMSG_SPACE(sizeof(struct scm_timestamping))
+
+// Maps SOCK_TSTAMP_* bits to SO_TIMESTAMPING: generate receive stamps and report them in the control data
+static int tstamp_mod(sock_t fd, int bits)
+{
+    int value = 0;
+    if (bits & SOCK_TSTAMP_SOFTWARE)
+        value |= SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (bits & SOCK_TSTAMP_HARDWARE)
+        value |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+    return opt_set(fd, SOL_SOCKET, SO_TIMESTAMPING, value);
+}
+
+static int tstamp_get(sock_t fd, int *bits)
+{
+    int value, rc = opt_get(fd, SOL_SOCKET, SO_TIMESTAMPING, &value);
+    *bits = ((value & SOF_TIMESTAMPING_RX_SOFTWARE) ? SOCK_TSTAMP_SOFTWARE : 0) |
+            ((value & SOF_TIMESTAMPING_RX_HARDWARE) ? SOCK_TSTAMP_HARDWARE : 0);
+    return rc;
+}
+
+// scm_timestamping holds the software stamp in ts[0] and the raw hardware stamp in ts[2]
+static void tstamp_parse(struct msghdr *msg, struct SockTimestamp *stamp)
+{
+    struct cmsghdr *cm;
+
+    stamp->software = 0;
+    stamp->hardware = 0;
+    for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING) {
+            struct scm_timestamping ts;
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            stamp->software = ts.ts[0].tv_sec * 1000000000LL + ts.ts[0].tv_nsec;
+            stamp->hardware = ts.ts[2].tv_sec * 1000000000LL + ts.ts[2].tv_nsec;
+        }
+    }
+}
+
+// Turns SO_ZEROCOPY on or off and tracks it so sends know to pass MSG_ZEROCOPY
+static int zerocopy_mod(sock_t fd, unsigned *flags, int enable)
+{
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) < 0)
+        return sockErr();
+    *flags = enable ? (*flags | SOCK_F_ZEROCOPY) : (*flags & ~SOCK_F_ZEROCOPY);
+    return 0;
+}
+
+// Drains zero copy notifications off the error queue; MSG_ERRQUEUE reads never block
+static int zerocopy_reap(sock_t fd, struct SockZeroCopy *done, size_t n)
+{
+    size_t found = 0;
+
+    while (found < n) {
+        char control[128];
+        struct msghdr msg;
+        struct cmsghdr *cm;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return found > 0 ? (int)found : sockErr();
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err *ee;
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+            ee = (struct sock_extended_err*)CMSG_DATA(cm);
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            done[found].first = ee->ee_info;
+            done[found].last = ee->ee_data;
+            done[found].copied = (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+            found++;
+        }
+    }
+
+    return (int)found;
+}
+
+// copies up to SOCK_IOV_MAX SockBufs into iovecs, returning how many were used
+static size_t sock_iovecs(struct iovec *iovs, struct SockBuf *bufs, size_t nbufs)
+{
+    size_t i;
+    if (nbufs > SOCK_IOV_MAX)
+        nbufs = SOCK_IOV_MAX;
+    for (i = 0; i < nbufs; ++i) {
+        iovs[i].iov_base = bufs[i].buf;
+        iovs[i].iov_len = bufs[i].len;
+    }
+    return nbufs;
+}
+
+static int udp_send_flags(struct UDPSocket *sock, size_t flags)
+{
+    int sysflags = 0;
+    if (flags & UDP_SEND_DONTROUTE)    sysflags |= MSG_DONTROUTE;
+    if (sock->flags & SOCK_F_ZEROCOPY) sysflags |= MSG_ZEROCOPY;
+    return sysflags;
+}
+
+static int udp_recv_flags(size_t flags)
+{
+    int sysflags = 0;
+    if (flags & UDP_RECV_PEEK) sysflags |= MSG_PEEK;
+    return sysflags;
+}
+
+// Builds a handle in place around a fresh socket
+static struct UDPSocket* udp_setup(struct UDPSocket *sock, unsigned flags)
+{
+    sock->flags = flags;
+    sock->refs = SOCK_REF_ONE;
+    sock->pool = NULL;
+    SOCK_STATS_INIT(sock);
+    sock->fd = sockOpen(SOCK_DGRAM, &sock->flags);
+    return sock->fd == SOCK_INVALID ? NULL : sock;
+}
+
+struct UDPSocket* udp_mksocket()
+{
+    struct UDPSocket *sock = malloc(sizeof(*sock));
+    if (!sock)
+        return NULL;
+
+    if (!udp_setup(sock, 0)) {
+        free(sock);
+        return NULL;
+    }
+    return sock;
+}
+
+struct UDPSocket* udp_mksocket_in(void *storage)
+{
+    return storage ? udp_setup(storage, SOCK_F_EXTERNAL) : NULL;
+}
+
+// Closes the socket and releases the handle once its last reference is gone
+static int udp_destroy(struct UDPSocket *sock)
+{
+    int status = sockClose(sock->fd) < 0 ? sockErr() : 0;
+    sockRelease(sock, sock->pool, sock->flags);
+    return status;
+}
+
+// Data calls run between udp_enter and udp_leave so a concurrent udp_free can't close the fd under them
+static void udp_leave(struct UDPSocket *sock)
+{
+    if (sockLeave(&sock->refs))
+        udp_destroy(sock);
+}
+
+static int udp_enter(struct UDPSocket *sock)
+{
+    if (sockEnter(&sock->refs))
+        return 1;
+    udp_leave(sock);
+    return 0;
+}
+
+int udp_send(struct UDPSocket *sock,
+                struct AddrInfo *destInfo,
+                void *msgbuf,
+                size_t msglen,
+                size_t flags)
+{
+    struct sockaddr_in6 tmp;
+    socklen_t len = 0;
+    // a sock_pair_dgram end has its peer already, it takes no destination
+    struct sockaddr *name = destInfo ? sockName(sock->flags, &destInfo->addr, &tmp, &len) : NULL;
+    ssize_t sent;
+    int rc;
+
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    sent = sendto(sock->fd, msgbuf, msglen, udp_send_flags(sock, flags), name, len);
+    rc = sent < 0 ? sockErr() : (int)sent;
+    SOCK_STAT_SEND(sock, 0, rc);
+    udp_leave(sock);
+    return rc;
+}
+
+static int udp_send_batch_held(struct UDPSocket *sock,
+                               struct UDPMsg *msgs,
+                               size_t n,
+                               size_t flags)
+{
+    struct mmsghdr hdrs[UDP_BATCH_MAX];
+    struct iovec iovs[UDP_BATCH_MAX];
+    struct sockaddr_in6 names[UDP_BATCH_MAX];
+    int sysflags = udp_send_flags(sock, flags);
+    size_t done = 0;
+
+    while (done < n) {
+        size_t chunk = n - done < UDP_BATCH_MAX ? n - done : UDP_BATCH_MAX;
+        size_t i;
+        int sent;
+
+        memset(hdrs, 0, chunk * sizeof(hdrs[0]));
+        for (i = 0; i < chunk; ++i) {
+            struct UDPMsg *m = &msgs[done + i];
+            iovs[i].iov_base = m->msgbuf;
+            iovs[i].iov_len = m->buflen;
+            hdrs[i].msg_hdr.msg_iov = &iovs[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+            if (m->addr)
+                hdrs[i].msg_hdr.msg_name = sockName(sock->flags, &m->addr->addr, &names[i],
+                                                    &hdrs[i].msg_hdr.msg_namelen);
+        }
+
+        // sendmmsg stops short at a failing datagram and only reports the error on the next call,
+        // so a short count is followed by another round that either progresses or yields the error
+        sent = sendmmsg(sock->fd, hdrs, chunk, sysflags);
+        if (sent < 0) {
+            msgs[done].result = sockErr();
+            return done > 0 ? (int)done : msgs[done].result;
+        }
+
+        for (i = 0; i < (size_t)sent; ++i)
+            msgs[done + i].result = (int)hdrs[i].msg_len;
+        done += sent;
+    }
+
+    return (int)done;
+}
+
+int udp_send_batch(struct UDPSocket *sock,
+                   struct UDPMsg *msgs,
+                   size_t n,
+                   size_t flags)
+{
+    int rc;
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = udp_send_batch_held(sock, msgs, n, flags);
+    SOCK_STAT_BATCH(sock, 0, msgs, rc);
+    udp_leave(sock);
+    return rc;
+}
+
+int udp_sendv(struct UDPSocket *sock,
+              struct AddrInfo *destInfo,
+              struct SockBuf *bufs,
+              size_t nbufs,
+              size_t flags)
+{
+    struct iovec iovs[SOCK_IOV_MAX];
+    struct sockaddr_in6 tmp;
+    struct msghdr msg;
+    ssize_t sent;
+    int rc;
+
+    // a datagram can't be split across calls, so refuse rather than truncate it
+    if (nbufs > SOCK_IOV_MAX)
+        return -EINVAL;
+
+    memset(&msg, 0, sizeof(msg));
+    if (destInfo)
+        msg.msg_name = sockName(sock->flags, &destInfo->addr, &tmp, &msg.msg_namelen);
+    msg.msg_iov = iovs;
+    msg.msg_iovlen = sock_iovecs(iovs, bufs, nbufs);
+
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    sent = sendmsg(sock->fd, &msg, udp_send_flags(sock, flags));
+    rc = sent < 0 ? sockErr() : (int)sent;
+    SOCK_STAT_SEND(sock, 0, rc);
+    udp_leave(sock);
+    return rc;
+}
+
+int udp_bind(struct UDPSocket *sock,
+             struct AddrInfo *hostInfo)
+{
+    struct sockaddr_in6 tmp;
+    socklen_t len;
+    struct sockaddr *name;
+    int rc = sockFamily(&sock->fd, SOCK_DGRAM, &sock->flags, &hostInfo->addr);
+
+    if (rc != 0)
+        return rc;
+    name = sockName(sock->flags, &hostInfo->addr, &tmp, &len);
+    if (bind(sock->fd, name, len) < 0)
+        return sockErr();
+    return 0;
+}
+
+int udp_recv(struct UDPSocket *sock,
+             void *msgbuf,
+             size_t buflen,
+             size_t flags,
+             struct AddrInfo *out)
+{
+    socklen_t addrlen = sizeof(out->addr);
+    ssize_t got;
+    int rc;
+
+    if (out)
+        sockNameClear(&out->addr);
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    got = recvfrom(sock->fd, msgbuf, buflen, udp_recv_flags(flags),
+                   out ? (struct sockaddr*)&out->addr : NULL, out ? &addrlen : NULL);
+    rc = got < 0 ? sockErr() : (int)got;
+    SOCK_STAT_RECV(sock, 0, rc);
+    udp_leave(sock);
+
+    if (rc >= 0 && out)
+        sockUnmap(&out->addr);
+    return rc;
+}
+
+int udp_recv_ts(struct UDPSocket *sock,
+                void *msgbuf,
+                size_t buflen,
+                size_t flags,
+                struct AddrInfo *out,
+                struct SockTimestamp *stamp)
+{
+    char control[TSTAMP_CONTROL];
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t got;
+    int rc;
+
+    if (!stamp)
+        return -EINVAL;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = msgbuf;
+    iov.iov_len = buflen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_name = out ? &out->addr : NULL;
+    msg.msg_namelen = out ? sizeof(out->addr) : 0;
+    if (out)
+        sockNameClear(&out->addr);
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    got = recvmsg(sock->fd, &msg, udp_recv_flags(flags));
+    rc = got < 0 ? sockErr() : (int)got;
+    SOCK_STAT_RECV(sock, 0, rc);
+    udp_leave(sock);
+    if (rc < 0)
+        return rc;
+
+    tstamp_parse(&msg, stamp);
+    if (out)
+        sockUnmap(&out->addr);
+    return rc;
+}
+
+static int udp_recv_batch_held(struct UDPSocket *sock,
+                               struct UDPMsg *msgs,
+                               size_t n,
+                               size_t flags)
+{
+    struct mmsghdr hdrs[UDP_BATCH_MAX];
+    struct iovec iovs[UDP_BATCH_MAX];
+    char control[UDP_BATCH_MAX][TSTAMP_CONTROL];
+    // MSG_WAITFORONE blocks for the first datagram only, later chunks just drain the queue
+    int sysflags = udp_recv_flags(flags) | MSG_WAITFORONE;
+    size_t done = 0;
+
+    while (done < n) {
+        size_t chunk = n - done < UDP_BATCH_MAX ? n - done : UDP_BATCH_MAX;
+        size_t i;
+        int got;
+
+        memset(hdrs, 0, chunk * sizeof(hdrs[0]));
+        for (i = 0; i < chunk; ++i) {
+            struct UDPMsg *m = &msgs[done + i];
+            iovs[i].iov_base = m->msgbuf;
+            iovs[i].iov_len = m->buflen;
+            hdrs[i].msg_hdr.msg_iov = &iovs[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+            if (m->addr) {
+                hdrs[i].msg_hdr.msg_name = &m->addr->addr;
+                hdrs[i].msg_hdr.msg_namelen = sizeof(m->addr->addr);
+                sockNameClear(&m->addr->addr);
+            }
+            if (m->stamp) {
+                hdrs[i].msg_hdr.msg_control = control[i];
+                hdrs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+            }
+        }
+
+        got = recvmmsg(sock->fd, hdrs, chunk, sysflags, NULL);
+        if (got < 0) {
+            // a drained queue after the first chunk is not an error, anything else resurfaces on the next call
+            if (done > 0)
+                break;
+            return sockErr();
+        }
+
+        for (i = 0; i < (size_t)got; ++i) {
+            msgs[done + i].result = (int)hdrs[i].msg_len;
+            if (msgs[done + i].addr)
+                sockUnmap(&msgs[done + i].addr->addr);
+            if (msgs[done + i].stamp)
+                tstamp_parse(&hdrs[i].msg_hdr, msgs[done + i].stamp);
+        }
+        done += got;
+
+        if ((size_t)got < chunk)
+            break;
+        sysflags |= MSG_DONTWAIT;
+    }
+
+    return (int)done;
+}
+
+int udp_recv_batch(struct UDPSocket *sock,
+                   struct UDPMsg *msgs,
+                   size_t n,
+                   size_t flags)
+{
+    int rc;
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = udp_recv_batch_held(sock, msgs, n, flags);
+    SOCK_STAT_BATCH(sock, 1, msgs, rc);
+    udp_leave(sock);
+    return rc;
+}
+
+// Without segmentation offload every datagram is its own send
+static int udp_send_each(struct UDPSocket *sock, struct AddrInfo *destInfo, char *msgbuf, size_t msglen,
+                         size_t segsize, size_t flags)
+{
+    size_t done = 0;
+
+    while (done < msglen) {
+        size_t len = msglen - done < segsize ? msglen - done : segsize;
+        int sent = udp_send(sock, destInfo, msgbuf + done, len, flags);
+        if (sent < 0)
+            return done > 0 ? (int)done : sent;
+        done += len;
+    }
+    return (int)done;
+}
+
+int udp_send_segmented(struct UDPSocket *sock,
+                       struct AddrInfo *destInfo,
+                       void *msgbuf,
+                       size_t msglen,
+                       size_t segsize,
+                       size_t flags)
+{
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct sockaddr_in6 tmp;
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t sent;
+    uint16_t gso;
+    int rc;
+
+    if (!sock || !destInfo || segsize == 0 || segsize > 0xffff || msglen > sockUdpPayloadMax(&destInfo->addr) ||
+        (msglen + segsize - 1) / segsize > SOCK_GSO_SEGMENTS_MAX)
+        return -EINVAL;
+    if (msglen <= segsize)
+        return udp_send(sock, destInfo, msgbuf, msglen, flags);
+    if (!sock_supports(SOCK_FEATURE_UDP_GSO))
+        return udp_send_each(sock, destInfo, msgbuf, msglen, segsize, flags);
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    iov.iov_base = msgbuf;
+    iov.iov_len = msglen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_name = sockName(sock->flags, &destInfo->addr, &tmp, &msg.msg_namelen);
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    // the segment size rides along as a control message, so the socket itself is left unchanged
+    gso = (uint16_t)segsize;
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(gso));
+    memcpy(CMSG_DATA(cm), &gso, sizeof(gso));
+
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    sent = sendmsg(sock->fd, &msg, udp_send_flags(sock, flags));
+    rc = sent < 0 ? sockErr() : (int)sent;
+    SOCK_STAT_SEND(sock, 0, rc);
+    udp_leave(sock);
+    return rc;
+}
+
+int udp_recv_segmented(struct UDPSocket *sock,
+                       void *msgbuf,
+                       size_t buflen,
+                       size_t flags,
+                       struct AddrInfo *out,
+                       size_t *segsize)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t got;
+    int rc;
+
+    if (!sock || !segsize)
+        return -EINVAL;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = msgbuf;
+    iov.iov_len = buflen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_name = out ? &out->addr : NULL;
+    msg.msg_namelen = out ? sizeof(out->addr) : 0;
+    if (out)
+        sockNameClear(&out->addr);
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    got = recvmsg(sock->fd, &msg, udp_recv_flags(flags));
+    rc = got < 0 ? sockErr() : (int)got;
+    SOCK_STAT_RECV(sock, 0, rc);
+    udp_leave(sock);
+    if (rc < 0)
+        return rc;
+
+    // no UDP_GRO control message means a single datagram
+    *segsize = (size_t)rc;
+    for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int gro;
+            memcpy(&gro, CMSG_DATA(cm), sizeof(gro));
+            *segsize = (size_t)gro;
+        }
+    }
+    if (out)
+        sockUnmap(&out->addr);
+    return rc;
+}
+
+int udp_zerocopy_reap(struct UDPSocket *sock, struct SockZeroCopy *done, size_t n)
+{
+    int rc;
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = zerocopy_reap(sock->fd, done, n);
+    udp_leave(sock);
+    return rc;
+}
+
+int udp_free(struct UDPSocket* sock)
+{
+    if (!sock)
+        return -EINVAL;
+    if (!sockClosing(&sock->refs))
+        return SOCK_ERR_CLOSED;
+
+    // calls still running in other threads are woken up and the last one out closes the socket
+    if (sock->refs != (SOCK_REF_ONE | SOCK_REF_CLOSING))
+        shutdown(sock->fd, SHUT_RDWR);
+    return sockLeave(&sock->refs) ? udp_destroy(sock) : 0;
+}
+
+int udp_mod_sock(struct UDPSocket *sock, int mod, int mod_value)
+{
+    int rc;
+
+    switch (mod) {
+    case UDP_MOD_BROADCAST:
+        if (setsockopt(sock->fd, SOL_SOCKET, SO_BROADCAST, &mod_value, sizeof(mod_value)) < 0)
+            return sockErr();
+        return 0;
+    case UDP_MOD_REUSEADDR:
+        rc = setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, &mod_value, sizeof(mod_value));
+        return rc < 0 ? sockErr() : 0;
+    case UDP_MOD_REUSEPORT:
+        rc = setsockopt(sock->fd, SOL_SOCKET, SO_REUSEPORT, &mod_value, sizeof(mod_value));
+        return rc < 0 ? sockErr() : 0;
+    case UDP_MOD_ZEROCOPY:
+        return zerocopy_mod(sock->fd, &sock->flags, mod_value);
+    case UDP_MOD_V6ONLY:
+        if (!(sock->flags & SOCK_F_INET6))
+            return SOCK_ERR_UNSUPPORTED;
+        rc = setsockopt(sock->fd, IPPROTO_IPV6, IPV6_V6ONLY, &mod_value, sizeof(mod_value));
+        return rc < 0 ? sockErr() : 0;
+    case UDP_MOD_NONBLOCK:
+        if ((rc = sockNonblock(sock->fd, mod_value)) == 0)
+            sock->flags = mod_value ? (sock->flags | SOCK_F_NONBLOCK) : (sock->flags & ~SOCK_F_NONBLOCK);
+        return rc;
+    case UDP_MOD_RCVTIMEO:     return opt_set_timeo(sock->fd, SO_RCVTIMEO, mod_value);
+    case UDP_MOD_SNDTIMEO:     return opt_set_timeo(sock->fd, SO_SNDTIMEO, mod_value);
+    case UDP_MOD_SNDBUF:       return opt_set(sock->fd, SOL_SOCKET, SO_SNDBUF, mod_value);
+    case UDP_MOD_RCVBUF:       return opt_set(sock->fd, SOL_SOCKET, SO_RCVBUF, mod_value);
+    case UDP_MOD_BUSY_POLL:    return opt_set(sock->fd, SOL_SOCKET, SO_BUSY_POLL, mod_value);
+    case UDP_MOD_TOS:          return opt_set_dual(sock->fd, sock->flags, IPV6_TCLASS, IP_TOS, mod_value);
+    case UDP_MOD_PRIORITY:     return opt_set(sock->fd, SOL_SOCKET, SO_PRIORITY, mod_value);
+    case UDP_MOD_INCOMING_CPU: return opt_set(sock->fd, SOL_SOCKET, SO_INCOMING_CPU, mod_value);
+    case UDP_MOD_GRO:          return opt_set(sock->fd, SOL_UDP, UDP_GRO, mod_value);
+    case UDP_MOD_TIMESTAMP:    return tstamp_mod(sock->fd, mod_value);
+    case UDP_MOD_MULTICAST_LOOP:
+        return opt_set_dual(sock->fd, sock->flags, IPV6_MULTICAST_LOOP, IP_MULTICAST_LOOP, mod_value != 0);
+    case UDP_MOD_MULTICAST_TTL:
+        return opt_set_dual(sock->fd, sock->flags, IPV6_MULTICAST_HOPS, IP_MULTICAST_TTL, mod_value);
+    case UDP_MOD_MULTICAST_IF:
+        return opt_set_mcast_if(sock->fd, sock->flags, mod_value);
+    default:
+        return -EINVAL;
+    }
+}
+
+int udp_get_sock(struct UDPSocket *sock, int mod, int *mod_value)
+{
+    if (!sock || !mod_value)
+        return -EINVAL;
+
+    switch (mod) {
+    case UDP_MOD_BROADCAST:    return opt_get_bool(sock->fd, SOL_SOCKET, SO_BROADCAST, mod_value);
+    case UDP_MOD_REUSEADDR:    return opt_get_bool(sock->fd, SOL_SOCKET, SO_REUSEADDR, mod_value);
+    case UDP_MOD_REUSEPORT:    return opt_get_bool(sock->fd, SOL_SOCKET, SO_REUSEPORT, mod_value);
+    case UDP_MOD_V6ONLY:
+        if (!(sock->flags & SOCK_F_INET6))
+            return SOCK_ERR_UNSUPPORTED;
+        return opt_get_bool(sock->fd, IPPROTO_IPV6, IPV6_V6ONLY, mod_value);
+    case UDP_MOD_NONBLOCK:
+        *mod_value = (sock->flags & SOCK_F_NONBLOCK) != 0;
+        return 0;
+    case UDP_MOD_ZEROCOPY:
+        *mod_value = (sock->flags & SOCK_F_ZEROCOPY) != 0;
+        return 0;
+    case UDP_MOD_RCVTIMEO:     return opt_get_timeo(sock->fd, SO_RCVTIMEO, mod_value);
+    case UDP_MOD_SNDTIMEO:     return opt_get_timeo(sock->fd, SO_SNDTIMEO, mod_value);
+    case UDP_MOD_SNDBUF:       return opt_get(sock->fd, SOL_SOCKET, SO_SNDBUF, mod_value);
+    case UDP_MOD_RCVBUF:       return opt_get(sock->fd, SOL_SOCKET, SO_RCVBUF, mod_value);
+    case UDP_MOD_BUSY_POLL:    return opt_get(sock->fd, SOL_SOCKET, SO_BUSY_POLL, mod_value);
+    case UDP_MOD_TOS:          return opt_get_dual(sock->fd, sock->flags, IPV6_TCLASS, IP_TOS, mod_value);
+    case UDP_MOD_PRIORITY:     return opt_get(sock->fd, SOL_SOCKET, SO_PRIORITY, mod_value);
+    case UDP_MOD_INCOMING_CPU: return opt_get(sock->fd, SOL_SOCKET, SO_INCOMING_CPU, mod_value);
+    case UDP_MOD_GRO:          return opt_get_bool(sock->fd, SOL_UDP, UDP_GRO, mod_value);
+    case UDP_MOD_TIMESTAMP:    return tstamp_get(sock->fd, mod_value);
+    case UDP_MOD_MULTICAST_LOOP:
+        return opt_get_dual(sock->fd, sock->flags, IPV6_MULTICAST_LOOP, IP_MULTICAST_LOOP, mod_value);
+    case UDP_MOD_MULTICAST_TTL:
+        return opt_get_dual(sock->fd, sock->flags, IPV6_MULTICAST_HOPS, IP_MULTICAST_TTL, mod_value);
+    case UDP_MOD_MULTICAST_IF:
+        // IP_MULTICAST_IF reads back an address rather than the index
+        if (!(sock->flags & SOCK_F_INET6))
+            return SOCK_ERR_UNSUPPORTED;
+        return opt_get(sock->fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, mod_value);
+    default:
+        return -EINVAL;
+    }
+}
+
+// Joins or leaves with the protocol independent requests (RFC 3678), which take either family. An ipv4 group
+// on a dual stack socket is joined at the IPPROTO_IP level, like on an ipv4 socket
+static int udp_membership(struct UDPSocket *sock, struct AddrInfo *group, struct AddrInfo *source,
+                          unsigned ifindex, int join)
+{
+    int level, rc;
+
+    if (!sock || !group || (source && source->addr.ss_family != group->addr.ss_family))
+        return -EINVAL;
+    level = group->addr.ss_family == AF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP;
+
+    if (source) {
+        struct group_source_req req;
+        memset(&req, 0, sizeof(req));
+        req.gsr_interface = ifindex;
+        memcpy(&req.gsr_group, &group->addr, sizeof(req.gsr_group));
+        memcpy(&req.gsr_source, &source->addr, sizeof(req.gsr_source));
+        rc = setsockopt(sock->fd, level, join ? MCAST_JOIN_SOURCE_GROUP : MCAST_LEAVE_SOURCE_GROUP, &req, sizeof(req));
+    } else {
+        struct group_req req;
+        memset(&req, 0, sizeof(req));
+        req.gr_interface = ifindex;
+        memcpy(&req.gr_group, &group->addr, sizeof(req.gr_group));
+        rc = setsockopt(sock->fd, level, join ? MCAST_JOIN_GROUP : MCAST_LEAVE_GROUP, &req, sizeof(req));
+    }
+    return rc < 0 ? sockErr() : 0;
+}
+
+int udp_join_group(struct UDPSocket *sock,
+                   struct AddrInfo *group,
+                   struct AddrInfo *source,
+                   unsigned ifindex)
+{
+    return udp_membership(sock, group, source, ifindex, 1);
+}
+
+int udp_leave_group(struct UDPSocket *sock,
+                    struct AddrInfo *group,
+                    struct AddrInfo *source,
+                    unsigned ifindex)
+{
+    return udp_membership(sock, group, source, ifindex, 0);
+}
+
+
+// -----------------
+// ---- TCP API ----
+// -----------------
+
+// MSG_NOSIGNAL turns a send on a reset connection into EPIPE instead of killing the process with SIGPIPE
+static int tcp_send_flags(struct TCPSocket *sock, size_t flags)
+{
+    int sysflags = MSG_NOSIGNAL;
+    if (flags & TCP_SEND_DONTROUTE)    sysflags |= MSG_DONTROUTE;
+    if (flags & TCP_SEND_OOB)          sysflags |= MSG_OOB;
+    if (sock->flags & SOCK_F_ZEROCOPY) sysflags |= MSG_ZEROCOPY;
+    return sysflags;
+}
+
+static int tcp_recv_flags(size_t flags)
+{
+    int sysflags = 0;
+    if (flags & TCP_RECV_PEEK)    sysflags |= MSG_PEEK;
+    if (flags & TCP_RECV_OOB)     sysflags |= MSG_OOB;
+    if (flags & TCP_RECV_WAITALL) sysflags |= MSG_WAITALL;
+    return sysflags;
+}
+
+// Builds a handle in place, around a fresh socket if open is set
+static struct TCPSocket* tcp_setup(struct TCPSocket *sock, unsigned flags, int open)
+{
+    sock->flags = flags;
+    sock->refs = SOCK_REF_ONE;
+    sock->pool = NULL;
+    SOCK_STATS_INIT(sock);
+    sock->fd = open ? sockOpen(SOCK_STREAM, &sock->flags) : SOCK_INVALID;
+    return open && sock->fd == SOCK_INVALID ? NULL : sock;
+}
+
+struct TCPSocket* tcp_mksocket()
+{
+    struct TCPSocket *sock = malloc(sizeof(*sock));
+    if (!sock)
+        return NULL;
+
+    if (!tcp_setup(sock, 0, 1)) {
+        free(sock);
+        return NULL;
+    }
+    return sock;
+}
+
+struct TCPSocket* tcp_mksocket_in(void *storage)
+{
+    return storage ? tcp_setup(storage, SOCK_F_EXTERNAL, 1) : NULL;
+}
+
+struct TCPSocket* tcp_mkhandle_in(void *storage)
+{
+    return storage ? tcp_setup(storage, SOCK_F_EXTERNAL, 0) : NULL;
+}
+
+// Closes the socket and releases the handle once its last reference is gone
+static int tcp_destroy(struct TCPSocket *sock)
+{
+    // handles from tcp_mkhandle_in may never have been given a connection
+    int status = sock->fd != SOCK_INVALID && sockClose(sock->fd) < 0 ? sockErr() : 0;
+    sockRelease(sock, sock->pool, sock->flags);
+    return status;
+}
+
+// Data calls run between tcp_enter and tcp_leave so a concurrent tcp_free can't close the fd under them
+static void tcp_leave(struct TCPSocket *sock)
+{
+    if (sockLeave(&sock->refs))
+        tcp_destroy(sock);
+}
+
+static int tcp_enter(struct TCPSocket *sock)
+{
+    if (sockEnter(&sock->refs))
+        return 1;
+    tcp_leave(sock);
+    return 0;
+}
+
+int tcp_bind(struct TCPSocket *sock,
+                struct AddrInfo *hostInfo)
+{
+    struct sockaddr_in6 tmp;
+    socklen_t len;
+    struct sockaddr *name;
+    int rc = sockFamily(&sock->fd, SOCK_STREAM, &sock->flags, &hostInfo->addr);
+
+    if (rc != 0)
+        return rc;
+    name = sockName(sock->flags, &hostInfo->addr, &tmp, &len);
+    if (bind(sock->fd, name, len) < 0)
+        return sockErr();
+    return 0;
+}
+
+int tcp_listen(struct TCPSocket *sock,
+               int backlog)
+{
+    if (listen(sock->fd, backlog) < 0)
+        return sockErr();
+    return 0;
+}
+
+// Hands a connected descriptor to a handle, dropping whatever descriptor it held
+static void tcp_adopt(struct TCPSocket *sock, sock_t fd, unsigned flags)
+{
+    if (sock->fd != SOCK_INVALID)
+        sockClose(sock->fd);
+    sock->fd = fd;
+    SOCK_STATS_INIT(sock);
+    sock->flags = flags | (sock->flags & SOCK_F_EXTERNAL);
+}
+
+static int tcp_accept_held(struct TCPSocket *sock,
+                           struct TCPSocket *client,
+                           struct AddrInfo *clientInfo,
+                           size_t flags)
+{
+    socklen_t addrlen = sizeof(clientInfo->addr);
+    int sysflags = SOCK_CLOEXEC;
+    sock_t fd;
+
+    // accept4 sets the new socket's mode in the same call, no fcntl round trips per connection
+    if (flags & TCP_ACCEPT_NONBLOCK)
+        sysflags |= SOCK_NONBLOCK;
+
+    if (clientInfo)
+        sockNameClear(&clientInfo->addr);
+    fd = accept4(sock->fd, clientInfo ? (struct sockaddr*)&clientInfo->addr : NULL, clientInfo ? &addrlen : NULL, sysflags);
+    if (fd == SOCK_INVALID)
+        return sockErr();
+    if (clientInfo)
+        sockUnmap(&clientInfo->addr);
+
+    // the client handle takes over the accepted connection
+    tcp_adopt(client, fd, ((flags & TCP_ACCEPT_NONBLOCK) ? SOCK_F_NONBLOCK : 0) | (sock->flags & (SOCK_F_INET6 | SOCK_F_UNIX)));
+    return 0;
+}
+
+int tcp_accept(struct TCPSocket *sock,
+               struct TCPSocket *client,
+               struct AddrInfo *clientInfo,
+               size_t flags)
+{
+    int rc;
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = tcp_accept_held(sock, client, clientInfo, flags);
+    tcp_leave(sock);
+    return rc;
+}
+
+static int tcp_accept_batch_held(struct TCPSocket *sock,
+                                 struct TCPSocket **clients,
+                                 struct AddrInfo **clientInfo,
+                                 size_t n,
+                                 size_t flags)
+{
+    size_t done;
+
+    for (done = 0; done < n; ++done) {
+        int rc;
+
+        // a blocking listener would wait for the next connection, so only keep going while one is queued
+        if (done > 0 && !(sock->flags & SOCK_F_NONBLOCK)) {
+            struct pollfd pfd;
+            pfd.fd = sock->fd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, 0) <= 0)
+                break;
+        }
+
+        rc = tcp_accept_held(sock, clients[done], clientInfo ? clientInfo[done] : NULL, flags);
+        if (rc < 0)
+            return done > 0 ? (int)done : rc;
+    }
+
+    return (int)done;
+}
+
+int tcp_accept_batch(struct TCPSocket *sock,
+                     struct TCPSocket **clients,
+                     struct AddrInfo **clientInfo,
+                     size_t n,
+                     size_t flags)
+{
+    int rc;
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = tcp_accept_batch_held(sock, clients, clientInfo, n, flags);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_connect(struct TCPSocket *sock,
+                struct AddrInfo *dest)
+{
+    struct sockaddr_in6 tmp;
+    socklen_t len;
+    struct sockaddr *name;
+    int rc;
+
+    if ((rc = sockFamily(&sock->fd, SOCK_STREAM, &sock->flags, &dest->addr)) != 0)
+        return rc;
+    name = sockName(sock->flags, &dest->addr, &tmp, &len);
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    if (connect(sock->fd, name, len) < 0)
+        rc = errno == EINPROGRESS ? SOCK_ERR_INPROGRESS : sockErr();
+    tcp_leave(sock);
+    return rc;
+}
+
+static int tcp_connect_finish_held(struct TCPSocket *sock)
+{
+    struct sockaddr_storage peer;
+    socklen_t len = sizeof(int);
+    int err = 0;
+
+    if (getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        return sockErr();
+    if (err != 0)
+        return -err;
+
+    // no pending error but no peer either means the handshake hasn't finished
+    len = sizeof(peer);
+    if (getpeername(sock->fd, (struct sockaddr*)&peer, &len) < 0)
+        return errno == ENOTCONN ? SOCK_ERR_INPROGRESS : sockErr();
+    return 0;
+}
+
+int tcp_connect_finish(struct TCPSocket *sock)
+{
+    int rc;
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = tcp_connect_finish_held(sock);
+    tcp_leave(sock);
+    return rc;
+}
+
+// Starts a non-blocking connect on fd, returning 1 if it completed at once, 0 if in progress
+static int connect_start(int fd, unsigned sockflags, struct sockaddr_storage *addr)
+{
+    struct sockaddr_in6 tmp;
+    socklen_t len;
+    struct sockaddr *name = sockName(sockflags, addr, &tmp, &len);
+
+    if (sockNonblock(fd, 1) != 0)
+        return sockErr();
+    if (connect(fd, name, len) == 0)
+        return 1;
+    return errno == EINPROGRESS ? 0 : sockErr();
+}
+
+int tcp_connect_fastest(struct TCPSocket *sock,
+                        struct AddrInfo *dest,
+                        int stagger_ms,
+                        int timeout_ms)
+{
+    struct pollfd fds[SOCK_ADDR_MAX];
+    int slot[SOCK_ADDR_MAX]; // candidate index of each pollfd
+    struct sockaddr_storage *cands = dest->count ? dest->list : &dest->addr;
+    unsigned ncand = dest->count ? dest->count : 1;
+    unsigned long long now = sockNowMs(), next = now;
+    unsigned long long deadline = timeout_ms < 0 ? ~0ULL : now + timeout_ms;
+    unsigned started = 0;
+    int npending = 0, winner = -1, err = -ETIMEDOUT, i;
+
+    if (stagger_ms < 0)
+        stagger_ms = 0;
+    if ((err = sockFamily(&sock->fd, SOCK_STREAM, &sock->flags, &cands[0])) != 0)
+        return err;
+    err = -ETIMEDOUT;
+
+    while (winner < 0) {
+        int wait, rc;
+
+        // Start the next candidate once its turn comes, or straight away if nothing is pending
+        if (started < ncand && (now >= next || npending == 0)) {
+            unsigned fdflags = sock->flags;
+            int fd = started == 0 ? sock->fd : sockOpen(SOCK_STREAM | SOCK_CLOEXEC, &fdflags);
+            rc = fd < 0 ? sockErr() : connect_start(fd, fdflags, &cands[started]);
+            if (rc == 1) {
+                winner = npending;
+                fds[npending].fd = fd;
+                slot[npending++] = started++;
+                break;
+            }
+            ++started;
+            if (rc == 0) {
+                fds[npending].fd = fd;
+                fds[npending].events = POLLOUT;
+                slot[npending++] = started - 1;
+                next = now + stagger_ms;
+            } else {
+                // a candidate that fails at once hands its turn straight to the next one
+                err = rc;
+                if (fd >= 0 && fd != sock->fd)
+                    close(fd);
+                next = now;
+            }
+            continue;
+        }
+
+        if (npending == 0)
+            break;
+        if (now >= deadline) {
+            err = -ETIMEDOUT;
+            break;
+        }
+
+        // Sleep until a handshake finishes, the next start is due, or we run out of time
+        {
+            unsigned long long until = deadline;
+            if (started < ncand && next < until)
+                until = next;
+            wait = until - now > 1000000 ? 1000000 : (int)(until - now);
+        }
+        rc = poll(fds, npending, wait);
+        if (rc < 0 && errno != EINTR) {
+            err = sockErr();
+            break;
+        }
+        for (i = 0; rc > 0 && i < npending; ++i) {
+            int soerr = 0;
+            socklen_t len = sizeof(soerr);
+            if (!fds[i].revents)
+                continue;
+            if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &soerr, &len) < 0)
+                soerr = errno;
+            if (soerr == 0) {
+                winner = i;
+                break;
+            }
+            // Failed attempts drop out of the set and the next candidate starts without waiting its stagger
+            err = -soerr;
+            next = now;
+            if (fds[i].fd != sock->fd)
+                close(fds[i].fd);
+            fds[i] = fds[--npending];
+            slot[i] = slot[npending];
+            --i;
+        }
+        now = sockNowMs();
+    }
+
+    for (i = 0; i < npending; ++i)
+        if (i != winner && fds[i].fd != sock->fd)
+            close(fds[i].fd);
+    if (winner < 0) {
+        sockNonblock(sock->fd, sock->flags & SOCK_F_NONBLOCK);
+        return err;
+    }
+
+    if (fds[winner].fd != sock->fd) {
+        close(sock->fd);
+        sock->fd = fds[winner].fd;
+    }
+    addrinfo_select(dest, slot[winner]);
+    return sockNonblock(sock->fd, sock->flags & SOCK_F_NONBLOCK);
+}
+
+int tcp_send(struct TCPSocket *sock,
+                void *msgbuf,
+                size_t buflen,
+                size_t flags)
+{
+    ssize_t sent;
+    int rc;
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    sent = send(sock->fd, msgbuf, buflen, tcp_send_flags(sock, flags));
+    rc = sent < 0 ? sockErr() : (int)sent;
+    SOCK_STAT_SEND(sock, buflen, rc);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_sendv(struct TCPSocket *sock,
+              struct SockBuf *bufs,
+              size_t nbufs,
+              size_t flags)
+{
+    struct iovec iovs[SOCK_IOV_MAX];
+    struct msghdr msg;
+    ssize_t sent;
+    int rc;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iovs;
+    msg.msg_iovlen = sock_iovecs(iovs, bufs, nbufs);
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    sent = sendmsg(sock->fd, &msg, tcp_send_flags(sock, flags));
+    rc = sent < 0 ? sockErr() : (int)sent;
+    SOCK_STAT_SEND(sock, sockBufsLen(bufs, nbufs), rc);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_recv(struct TCPSocket *sock,
+                void *msgbuf,
+                size_t buflen,
+                size_t flags)
+{
+    ssize_t got;
+    int rc;
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    got = recv(sock->fd, msgbuf, buflen, tcp_recv_flags(flags));
+    rc = got < 0 ? sockErr() : (int)got;
+    SOCK_STAT_RECV(sock, buflen, rc);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_recvv(struct TCPSocket *sock,
+              struct SockBuf *bufs,
+              size_t nbufs,
+              size_t flags)
+{
+    struct iovec iovs[SOCK_IOV_MAX];
+    struct msghdr msg;
+    ssize_t got;
+    int rc;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iovs;
+    msg.msg_iovlen = sock_iovecs(iovs, bufs, nbufs);
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    got = recvmsg(sock->fd, &msg, tcp_recv_flags(flags));
+    rc = got < 0 ? sockErr() : (int)got;
+    SOCK_STAT_RECV(sock, sockBufsLen(bufs, nbufs), rc);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_recv_ts(struct TCPSocket *sock,
+                void *msgbuf,
+                size_t buflen,
+                size_t flags,
+                struct SockTimestamp *stamp)
+{
+    char control[TSTAMP_CONTROL];
+    struct msghdr msg;
+    struct iovec iov;
+    ssize_t got;
+    int rc;
+
+    if (!stamp)
+        return -EINVAL;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = msgbuf;
+    iov.iov_len = buflen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    got = recvmsg(sock->fd, &msg, tcp_recv_flags(flags));
+    rc = got < 0 ? sockErr() : (int)got;
+    SOCK_STAT_RECV(sock, buflen, rc);
+    tcp_leave(sock);
+
+    if (rc >= 0)
+        tstamp_parse(&msg, stamp);
+    return rc;
+}
+
+// pipes can't be sendfile'd from, but splice moves their pages to the socket just the same
+static long long sendfile_splice(struct TCPSocket *sock, int file, size_t count)
+{
+    unsigned int flags = SPLICE_F_MOVE | ((sock->flags & SOCK_F_NONBLOCK) ? SPLICE_F_NONBLOCK : 0);
+    long long total = 0;
+
+    while ((size_t)total < count) {
+        ssize_t sent = splice(file, NULL, sock->fd, NULL, count - total, flags);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return total > 0 ? total : sockErr();
+        }
+        if (sent == 0)
+            break;
+        total += sent;
+    }
+    return total;
+}
+
+// pread keeps the fallback stateless: whatever a short send leaves behind is simply re-read next call
+static long long sendfile_copy(struct TCPSocket *sock, int file, long long offset, size_t count)
+{
+    char buf[16384];
+    long long total = 0;
+
+    while ((size_t)total < count) {
+        size_t want = count - total < sizeof(buf) ? count - total : sizeof(buf);
+        ssize_t got = pread(file, buf, want, offset + total);
+        ssize_t sent;
+
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return total > 0 ? total : -errno;
+        }
+        if (got == 0)
+            break;
+
+        sent = send(sock->fd, buf, got, MSG_NOSIGNAL);
+        if (sent < 0)
+            return total > 0 ? total : sockErr();
+        total += sent;
+        if (sent < got)
+            break;
+    }
+    return total;
+}
+
+static long long tcp_sendfile_held(struct TCPSocket *sock,
+                                   sock_file_t file,
+                                   long long offset,
+                                   size_t count)
+{
+    off_t off = offset;
+    long long total = 0;
+
+    while ((size_t)total < count) {
+        ssize_t sent = sendfile(sock->fd, file, &off, count - total);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (total == 0 && (errno == EINVAL || errno == ENOSYS || errno == ESPIPE)) {
+                struct stat st;
+                if (fstat(file, &st) == 0 && S_ISFIFO(st.st_mode))
+                    return sendfile_splice(sock, file, count);
+                return sendfile_copy(sock, file, offset, count);
+            }
+            // a partial transfer is reported as such, the error resurfaces on the next call
+            return total > 0 ? total : sockErr();
+        }
+        if (sent == 0)
+            break;
+        total += sent;
+    }
+    return total;
+}
+
+long long tcp_sendfile(struct TCPSocket *sock,
+                       sock_file_t file,
+                       long long offset,
+                       size_t count)
+{
+    long long rc;
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = tcp_sendfile_held(sock, file, offset, count);
+    SOCK_STAT_SEND(sock, count, rc);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_zerocopy_reap(struct TCPSocket *sock, struct SockZeroCopy *done, size_t n)
+{
+    int rc;
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = zerocopy_reap(sock->fd, done, n);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_free(struct TCPSocket* sock)
+{
+    if (!sock)
+        return -EINVAL;
+    if (!sockClosing(&sock->refs))
+        return SOCK_ERR_CLOSED;
+
+    // calls still running in other threads are woken up and the last one out closes the socket
+    if (sock->refs != (SOCK_REF_ONE | SOCK_REF_CLOSING) && sock->fd != SOCK_INVALID)
+        shutdown(sock->fd, SHUT_RDWR);
+    return sockLeave(&sock->refs) ? tcp_destroy(sock) : 0;
+}
+
+int tcp_mod_sock(struct TCPSocket *sock, int mod, int mod_value)
+{
+    int rc;
+
+    switch (mod) {
+    case TCP_MOD_KEEPALIVE:
+        rc = setsockopt(sock->fd, SOL_SOCKET, SO_KEEPALIVE, &mod_value, sizeof(mod_value));
+        break;
+    case TCP_MOD_DONTROUTE:
+        rc = setsockopt(sock->fd, SOL_SOCKET, SO_DONTROUTE, &mod_value, sizeof(mod_value));
+        break;
+    case TCP_MOD_RCVTIMEO:
+        return opt_set_timeo(sock->fd, SO_RCVTIMEO, mod_value);
+    case TCP_MOD_REUSEADDR:
+        rc = setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, &mod_value, sizeof(mod_value));
+        break;
+    case TCP_MOD_REUSEPORT:
+        rc = setsockopt(sock->fd, SOL_SOCKET, SO_REUSEPORT, &mod_value, sizeof(mod_value));
+        break;
+    case TCP_MOD_V6ONLY:
+        if (!(sock->flags & SOCK_F_INET6))
+            return SOCK_ERR_UNSUPPORTED;
+        rc = setsockopt(sock->fd, IPPROTO_IPV6, IPV6_V6ONLY, &mod_value, sizeof(mod_value));
+        break;
+    case TCP_MOD_NODELAY:
+        rc = setsockopt(sock->fd, IPPROTO_TCP, TCP_NODELAY, &mod_value, sizeof(mod_value));
+        break;
+    case TCP_MOD_CORK:
+        rc = setsockopt(sock->fd, IPPROTO_TCP, TCP_CORK, &mod_value, sizeof(mod_value));
+        break;
+    case TCP_MOD_ZEROCOPY:
+        return zerocopy_mod(sock->fd, &sock->flags, mod_value);
+    case TCP_MOD_NONBLOCK:
+        if ((rc = sockNonblock(sock->fd, mod_value)) == 0)
+            sock->flags = mod_value ? (sock->flags | SOCK_F_NONBLOCK) : (sock->flags & ~SOCK_F_NONBLOCK);
+        return rc;
+    case TCP_MOD_SNDTIMEO:         return opt_set_timeo(sock->fd, SO_SNDTIMEO, mod_value);
+    case TCP_MOD_SNDBUF:           return opt_set(sock->fd, SOL_SOCKET, SO_SNDBUF, mod_value);
+    case TCP_MOD_RCVBUF:           return opt_set(sock->fd, SOL_SOCKET, SO_RCVBUF, mod_value);
+    case TCP_MOD_QUICKACK:         return opt_set(sock->fd, IPPROTO_TCP, TCP_QUICKACK, mod_value);
+    case TCP_MOD_BUSY_POLL:        return opt_set(sock->fd, SOL_SOCKET, SO_BUSY_POLL, mod_value);
+    case TCP_MOD_FASTOPEN:         return opt_set(sock->fd, IPPROTO_TCP, TCP_FASTOPEN, mod_value);
+    case TCP_MOD_FASTOPEN_CONNECT: return opt_set(sock->fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, mod_value);
+    case TCP_MOD_TOS:              return opt_set_dual(sock->fd, sock->flags, IPV6_TCLASS, IP_TOS, mod_value);
+    case TCP_MOD_PRIORITY:         return opt_set(sock->fd, SOL_SOCKET, SO_PRIORITY, mod_value);
+    case TCP_MOD_INCOMING_CPU:     return opt_set(sock->fd, SOL_SOCKET, SO_INCOMING_CPU, mod_value);
+    case TCP_MOD_TIMESTAMP:        return tstamp_mod(sock->fd, mod_value);
+    default:
+        return -EINVAL;
+    }
+
+    return rc < 0 ? sockErr() : 0;
+}
+
+int tcp_get_sock(struct TCPSocket *sock, int mod, int *mod_value)
+{
+    if (!sock || !mod_value)
+        return -EINVAL;
+
+    switch (mod) {
+    case TCP_MOD_KEEPALIVE:        return opt_get_bool(sock->fd, SOL_SOCKET, SO_KEEPALIVE, mod_value);
+    case TCP_MOD_DONTROUTE:        return opt_get_bool(sock->fd, SOL_SOCKET, SO_DONTROUTE, mod_value);
+    case TCP_MOD_RCVTIMEO:         return opt_get_timeo(sock->fd, SO_RCVTIMEO, mod_value);
+    case TCP_MOD_REUSEADDR:        return opt_get_bool(sock->fd, SOL_SOCKET, SO_REUSEADDR, mod_value);
+    case TCP_MOD_REUSEPORT:        return opt_get_bool(sock->fd, SOL_SOCKET, SO_REUSEPORT, mod_value);
+    case TCP_MOD_V6ONLY:
+        if (!(sock->flags & SOCK_F_INET6))
+            return SOCK_ERR_UNSUPPORTED;
+        return opt_get_bool(sock->fd, IPPROTO_IPV6, IPV6_V6ONLY, mod_value);
+    case TCP_MOD_NONBLOCK:
+        *mod_value = (sock->flags & SOCK_F_NONBLOCK) != 0;
+        return 0;
+    case TCP_MOD_ZEROCOPY:
+        *mod_value = (sock->flags & SOCK_F_ZEROCOPY) != 0;
+        return 0;
+    case TCP_MOD_NODELAY:          return opt_get_bool(sock->fd, IPPROTO_TCP, TCP_NODELAY, mod_value);
+    case TCP_MOD_CORK:             return opt_get_bool(sock->fd, IPPROTO_TCP, TCP_CORK, mod_value);
+    case TCP_MOD_SNDTIMEO:         return opt_get_timeo(sock->fd, SO_SNDTIMEO, mod_value);
+    case TCP_MOD_SNDBUF:           return opt_get(sock->fd, SOL_SOCKET, SO_SNDBUF, mod_value);
+    case TCP_MOD_RCVBUF:           return opt_get(sock->fd, SOL_SOCKET, SO_RCVBUF, mod_value);
+    case TCP_MOD_QUICKACK:         return opt_get_bool(sock->fd, IPPROTO_TCP, TCP_QUICKACK, mod_value);
+    case TCP_MOD_BUSY_POLL:        return opt_get(sock->fd, SOL_SOCKET, SO_BUSY_POLL, mod_value);
+    case TCP_MOD_FASTOPEN:         return opt_get(sock->fd, IPPROTO_TCP, TCP_FASTOPEN, mod_value);
+    case TCP_MOD_FASTOPEN_CONNECT: return opt_get_bool(sock->fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, mod_value);
+    case TCP_MOD_TOS:              return opt_get_dual(sock->fd, sock->flags, IPV6_TCLASS, IP_TOS, mod_value);
+    case TCP_MOD_PRIORITY:         return opt_get(sock->fd, SOL_SOCKET, SO_PRIORITY, mod_value);
+    case TCP_MOD_INCOMING_CPU:     return opt_get(sock->fd, SOL_SOCKET, SO_INCOMING_CPU, mod_value);
+    case TCP_MOD_TIMESTAMP:        return tstamp_get(sock->fd, mod_value);
+    default:
+        return -EINVAL;
+    }
+}
+
+int tcp_get_info(struct TCPSocket *sock, struct SockTcpInfo *out)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    if (!sock || !out)
+        return -EINVAL;
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(sock->fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+        return sockErr();
+
+    out->rtt_us = info.tcpi_rtt;
+    out->rtt_var_us = info.tcpi_rttvar;
+    out->cwnd = info.tcpi_snd_cwnd * info.tcpi_snd_mss;
+    out->mss = info.tcpi_snd_mss;
+    out->retransmits = info.tcpi_total_retrans;
+    out->lost = info.tcpi_lost;
+    return 0;
+}
+
+
+// -------------------------
+// ---- TLS Offload API ----
+// -------------------------
+
+// Whichever crypto_info the cipher takes, all of them start with the same header
+union tls_keys {
+    struct tls_crypto_info info;
+    struct tls12_crypto_info_aes_gcm_128 aes128;
+    struct tls12_crypto_info_aes_gcm_256 aes256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    struct tls12_crypto_info_chacha20_poly1305 chacha;
+#endif
 };
+
+// Lays the keys out the way the kernel expects them for the cipher, returns the size to pass or zero
+static socklen_t tls_crypto_fill(union tls_keys *ci, struct SockTlsKeys *keys)
+{
+    memset(ci, 0, sizeof(*ci));
+    ci->info.version = (unsigned short)keys->version;
+
+    switch (keys->cipher) {
+    case SOCK_TLS_AES_128_GCM:
+        ci->info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        memcpy(ci->aes128.key, keys->key, sizeof(ci->aes128.key));
+        memcpy(ci->aes128.salt, keys->iv, sizeof(ci->aes128.salt));
+        memcpy(ci->aes128.iv, keys->iv + sizeof(ci->aes128.salt), sizeof(ci->aes128.iv));
+        memcpy(ci->aes128.rec_seq, keys->rec_seq, sizeof(ci->aes128.rec_seq));
+        return sizeof(ci->aes128);
+    case SOCK_TLS_AES_256_GCM:
+        ci->info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        memcpy(ci->aes256.key, keys->key, sizeof(ci->aes256.key));
+        memcpy(ci->aes256.salt, keys->iv, sizeof(ci->aes256.salt));
+        memcpy(ci->aes256.iv, keys->iv + sizeof(ci->aes256.salt), sizeof(ci->aes256.iv));
+        memcpy(ci->aes256.rec_seq, keys->rec_seq, sizeof(ci->aes256.rec_seq));
+        return sizeof(ci->aes256);
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case SOCK_TLS_CHACHA20_POLY1305:
+        ci->info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+        memcpy(ci->chacha.key, keys->key, sizeof(ci->chacha.key));
+        memcpy(ci->chacha.iv, keys->iv, sizeof(ci->chacha.iv));
+        memcpy(ci->chacha.rec_seq, keys->rec_seq, sizeof(ci->chacha.rec_seq));
+        return sizeof(ci->chacha);
+#endif
+    default:
+        return 0;
+    }
+}
+
+static int tls_install_held(struct TCPSocket *sock, struct SockTlsKeys *keys, size_t flags)
+{
+    union tls_keys ci;
+    socklen_t len;
+    int one = 1, rc = 0;
+
+    // a second direction finds the ulp already attached
+    if (setsockopt(sock->fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0 && errno != EEXIST)
+        return errno == ENOENT ? SOCK_ERR_UNSUPPORTED : sockErr();
+    if ((flags & SOCK_TLS_ZEROCOPY_SENDFILE)
+            && setsockopt(sock->fd, SOL_TLS, TLS_TX_ZEROCOPY_RO, &one, sizeof(one)) < 0)
+        return errno == ENOPROTOOPT ? SOCK_ERR_UNSUPPORTED : sockErr();
+
+    if (!(len = tls_crypto_fill(&ci, keys)))
+        return SOCK_ERR_UNSUPPORTED;
+    if (setsockopt(sock->fd, SOL_TLS, flags & SOCK_TLS_TX ? TLS_TX : TLS_RX, &ci, len) < 0)
+        rc = errno == ENOPROTOOPT ? SOCK_ERR_UNSUPPORTED : sockErr();
+    explicit_bzero(&ci, sizeof(ci));
+    return rc;
+}
+
+int tcp_tls_install(struct TCPSocket *sock, struct SockTlsKeys *keys, size_t flags)
+{
+    size_t dir = flags & (SOCK_TLS_TX | SOCK_TLS_RX);
+    int rc;
+
+    if (!sock || !keys || (dir != SOCK_TLS_TX && dir != SOCK_TLS_RX))
+        return -EINVAL;
+    if (keys->version != SOCK_TLS_1_2 && keys->version != SOCK_TLS_1_3)
+        return -EINVAL;
+    // MSG_ZEROCOPY sends fail on an offloaded socket, better to say so before the keys are spent
+    if (dir == SOCK_TLS_TX && (sock->flags & SOCK_F_ZEROCOPY))
+        return -EINVAL;
+    if ((flags & SOCK_TLS_ZEROCOPY_SENDFILE) && dir != SOCK_TLS_TX)
+        return -EINVAL;
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = tls_install_held(sock, keys, flags);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_tls_recv_record(struct TCPSocket *sock, void *msgbuf, size_t buflen, size_t flags, int *type)
+{
+    char control[CMSG_SPACE(sizeof(unsigned char))];
+    struct iovec iov = { msgbuf, buflen };
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    ssize_t got;
+    int rc;
+
+    if (!type)
+        return -EINVAL;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    got = recvmsg(sock->fd, &msg, tcp_recv_flags(flags));
+    rc = got < 0 ? sockErr() : (int)got;
+    SOCK_STAT_RECV(sock, buflen, rc);
+    tcp_leave(sock);
+
+    // the kernel leaves the type out for eof only
+    *type = SOCK_TLS_RECORD_DATA;
+    for (cm = CMSG_FIRSTHDR(&msg); rc > 0 && cm; cm = CMSG_NXTHDR(&msg, cm))
+        if (cm->cmsg_level == SOL_TLS && cm->cmsg_type == TLS_GET_RECORD_TYPE)
+            *type = *(unsigned char*)CMSG_DATA(cm);
+    return rc;
+}
+
+int tcp_tls_send_record(struct TCPSocket *sock, int type, void *msgbuf, size_t buflen)
+{
+    char control[CMSG_SPACE(sizeof(unsigned char))];
+    struct iovec iov = { msgbuf, buflen };
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    ssize_t sent;
+    int rc;
+
+    if (type < 0 || type > 255)
+        return -EINVAL;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_TLS;
+    cm->cmsg_type = TLS_SET_RECORD_TYPE;
+    cm->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+    *(unsigned char*)CMSG_DATA(cm) = (unsigned char)type;
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    // never MSG_ZEROCOPY here, tcp_tls_install keeps it off offloaded sockets
+    sent = sendmsg(sock->fd, &msg, MSG_NOSIGNAL);
+    rc = sent < 0 ? sockErr() : (int)sent;
+    SOCK_STAT_SEND(sock, buflen, rc);
+    tcp_leave(sock);
+    return rc;
+}
+
+
+// -------------------------
+// ---- Unix Socket API ----
+// -------------------------
+
+// Control buffer for one passed descriptor, aligned for the cmsghdr laid over it
+union fd_control {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+};
+
+int sock_pair(struct TCPSocket *a, struct TCPSocket *b)
+{
+    int fds[2];
+
+    if (!a || !b || a == b)
+        return -EINVAL;
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+        return sockErr();
+    tcp_adopt(a, fds[0], SOCK_F_UNIX);
+    tcp_adopt(b, fds[1], SOCK_F_UNIX);
+    return 0;
+}
+
+int sock_pair_dgram(struct UDPSocket *a, struct UDPSocket *b)
+{
+    int fds[2];
+
+    if (!a || !b || a == b)
+        return -EINVAL;
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds) < 0)
+        return sockErr();
+    sockClose(a->fd);
+    sockClose(b->fd);
+    a->fd = fds[0];
+    b->fd = fds[1];
+    a->flags = SOCK_F_UNIX | (a->flags & SOCK_F_EXTERNAL);
+    b->flags = SOCK_F_UNIX | (b->flags & SOCK_F_EXTERNAL);
+    return 0;
+}
+
+int tcp_send_fd(struct TCPSocket *sock,
+                sock_file_t file,
+                void *msgbuf,
+                size_t buflen)
+{
+    union fd_control control;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    ssize_t sent;
+    int rc;
+
+    // rights travel with data, a stream socket has no empty message to carry them
+    if (!sock || !msgbuf || buflen == 0 || file < 0)
+        return -EINVAL;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = msgbuf;
+    iov.iov_len = buflen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &file, sizeof(int));
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    sent = sendmsg(sock->fd, &msg, MSG_NOSIGNAL);
+    rc = sent < 0 ? sockErr() : (int)sent;
+    SOCK_STAT_SEND(sock, buflen, rc);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_recv_fd(struct TCPSocket *sock,
+                void *msgbuf,
+                size_t buflen,
+                size_t flags,
+                sock_file_t *file)
+{
+    union fd_control control;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    ssize_t got;
+    int rc;
+
+    if (!sock || !file)
+        return -EINVAL;
+    *file = -1;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = msgbuf;
+    iov.iov_len = buflen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    got = recvmsg(sock->fd, &msg, tcp_recv_flags(flags) | MSG_CMSG_CLOEXEC);
+    rc = got < 0 ? sockErr() : (int)got;
+    SOCK_STAT_RECV(sock, buflen, rc);
+    tcp_leave(sock);
+
+    // descriptors beyond the one the buffer has room for are closed by the kernel
+    for (cm = CMSG_FIRSTHDR(&msg); rc >= 0 && cm; cm = CMSG_NXTHDR(&msg, cm))
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS && cm->cmsg_len >= CMSG_LEN(sizeof(int)))
+            memcpy(file, CMSG_DATA(cm), sizeof(int));
+    return rc;
+}
+
+int tcp_send_sock(struct TCPSocket *sock,
+                  struct TCPSocket *pass,
+                  void *msgbuf,
+                  size_t buflen)
+{
+    int rc;
+
+    if (!pass)
+        return -EINVAL;
+    if (!tcp_enter(pass))
+        return SOCK_ERR_CLOSED;
+    rc = tcp_send_fd(sock, pass->fd, msgbuf, buflen);
+    // the connection is the receiver's now, the shutdown in tcp_free would end it on their side too
+    if (rc > 0) {
+        close(pass->fd);
+        pass->fd = SOCK_INVALID;
+    }
+    tcp_leave(pass);
+    return rc;
+}
+
+int tcp_recv_sock(struct TCPSocket *sock,
+                  struct TCPSocket *into,
+                  void *msgbuf,
+                  size_t buflen,
+                  size_t flags,
+                  int *passed)
+{
+    struct sockaddr_storage name;
+    socklen_t len = sizeof(name);
+    int fd, type = 0, fl, rc;
+    unsigned sockflags = 0;
+
+    if (!into || !passed)
+        return -EINVAL;
+    *passed = 0;
+    if ((rc = tcp_recv_fd(sock, msgbuf, buflen, flags, &fd)) < 0 || fd < 0)
+        return rc;
+
+    // the handle is for stream sockets, its family and mode come from the passed descriptor itself
+    if (opt_get(fd, SOL_SOCKET, SO_TYPE, &type) != 0 || type != SOCK_STREAM ||
+            getsockname(fd, (struct sockaddr*)&name, &len) < 0 || (fl = fcntl(fd, F_GETFL)) < 0) {
+        close(fd);
+        return -ENOTSOCK;
+    }
+    if (name.ss_family == AF_INET6)
+        sockflags |= SOCK_F_INET6;
+    else if (name.ss_family == AF_UNIX)
+        sockflags |= SOCK_F_UNIX;
+    if (fl & O_NONBLOCK)
+        sockflags |= SOCK_F_NONBLOCK;
+
+    tcp_adopt(into, fd, sockflags);
+    *passed = 1;
+    return rc;
+}
+
+
+// ----------------------
+// ---- Sharding API ----
+// ----------------------
+
+// Attaches a reuseport program returning cpu % n, the index of the group member that gets the packet.
+// Group members are indexed in the order they joined, which is creation order for the shards below.
+static int shard_steer_cpu(sock_t fd, size_t n)
+{
+    struct sock_filter code[] = {
+        { BPF_LD  | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (unsigned)n },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog;
+
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+        return sockErr();
+    return 0;
+}
+
+int sock_ncpu()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+// Reads a sysfs cpu list like "0-3,8-11" into a set, or a node list, which has the same format
+static int cpu_list_read(const char *path, cpu_set_t *set)
+{
+    char buf[1024], *p = buf;
+    FILE *f = fopen(path, "r");
+    size_t len;
+
+    if (!f)
+        return -1;
+    len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+
+    CPU_ZERO(set);
+    while (*p >= '0' && *p <= '9') {
+        long lo = strtol(p, &p, 10), hi = lo;
+        if (*p == '-')
+            hi = strtol(p + 1, &p, 10);
+        for (; lo <= hi && lo < CPU_SETSIZE; ++lo)
+            CPU_SET(lo, set);
+        if (*p == ',')
+            ++p;
+    }
+    return 0;
+}
+
+SOCK_INTERNAL int sock_cpu_for(int worker, int numa)
+{
+    cpu_set_t allowed, node;
+    int order[CPU_SETSIZE], n = 0, cpu, id;
+
+    // cpus outside the process affinity (taskset, cgroup cpusets) would fail to pin
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return worker % sock_ncpu();
+
+    if (numa) {
+        cpu_set_t nodes[64], online;
+        int nnodes = 0, round, placed = 1;
+        char path[64];
+
+        // node ids can have gaps (offline or memory-less nodes), so go by the online list, or failing
+        // that probe every id rather than stopping at the first one missing
+        if (cpu_list_read("/sys/devices/system/node/online", &online) != 0) {
+            CPU_ZERO(&online);
+            for (id = 0; id < 64; ++id)
+                CPU_SET(id, &online);
+        }
+        for (id = 0; id < 64; ++id) {
+            if (!CPU_ISSET(id, &online))
+                continue;
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+            if (cpu_list_read(path, &node) != 0)
+                continue;
+            CPU_AND(&nodes[nnodes], &node, &allowed);
+            if (CPU_COUNT(&nodes[nnodes]) > 0)
+                nnodes++;
+        }
+        // the r-th allowed cpu of every node, then the r+1-th, ...
+        for (round = 0; nnodes > 1 && placed; ++round) {
+            placed = 0;
+            for (id = 0; id < nnodes; ++id) {
+                int seen = 0;
+                for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                    if (CPU_ISSET(cpu, &nodes[id]) && seen++ == round) {
+                        order[n++] = cpu;
+                        placed = 1;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    if (n == 0) {
+        for (cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &allowed))
+                order[n++] = cpu;
+    }
+    return n > 0 ? order[worker % n] : 0;
+}
+
+SOCK_INTERNAL int sock_cpu_pin(int cpu)
+{
+    cpu_set_t set;
+    int rc;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    return rc != 0 ? -rc : 0;
+}
+
+int tcp_mkshards(struct TCPSocket **socks,
+                 size_t n,
+                 struct AddrInfo *hostInfo,
+                 int backlog,
+                 size_t flags)
+{
+    size_t i;
+    int rc = 0;
+
+    for (i = 0; i < n; ++i) {
+        socks[i] = tcp_mksocket();
+        if (!socks[i]) {
+            rc = -ENOMEM;
+            break;
+        }
+        if ((rc = tcp_mod_sock(socks[i], TCP_MOD_REUSEPORT, 1)) < 0 ||
+            (rc = tcp_bind(socks[i], hostInfo)) < 0 ||
+            (rc = tcp_listen(socks[i], backlog)) < 0) {
+            ++i;
+            break;
+        }
+    }
+
+    if (rc == 0 && n > 0 && (flags & SOCK_SHARD_CPU))
+        rc = shard_steer_cpu(socks[0]->fd, n);
+
+    if (rc < 0) {
+        while (i-- > 0) {
+            tcp_free(socks[i]);
+            socks[i] = NULL;
+        }
+    }
+    return rc;
+}
+
+int udp_mkshards(struct UDPSocket **socks,
+                 size_t n,
+                 struct AddrInfo *hostInfo,
+                 size_t flags)
+{
+    size_t i;
+    int rc = 0;
+
+    for (i = 0; i < n; ++i) {
+        socks[i] = udp_mksocket();
+        if (!socks[i]) {
+            rc = -ENOMEM;
+            break;
+        }
+        if ((rc = udp_mod_sock(socks[i], UDP_MOD_REUSEPORT, 1)) < 0 ||
+            (rc = udp_bind(socks[i], hostInfo)) < 0) {
+            ++i;
+            break;
+        }
+    }
+
+    if (rc == 0 && n > 0 && (flags & SOCK_SHARD_CPU))
+        rc = shard_steer_cpu(socks[0]->fd, n);
+
+    if (rc < 0) {
+        while (i-- > 0) {
+            udp_free(socks[i]);
+            socks[i] = NULL;
+        }
+    }
+    return rc;
+}
+
+
+// ------------------------
+// ---- Event Loop API ----
+// ------------------------
+
+struct SockLoop {
+    int epfd;
+    int wakefd;             // eventfd in the epoll set, its address is the event's udata
+    volatile long woken;    // a wake is pending, later ones skip the write
+    struct SockWheel wheel;
+};
+
+static int loop_ctl(struct SockLoop *loop, int op, sock_t fd, int events, void *udata)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    if (events & SOCK_EV_READ)  ev.events |= EPOLLIN;
+    if (events & SOCK_EV_WRITE) ev.events |= EPOLLOUT;
+    ev.data.ptr = udata;
+
+    if (epoll_ctl(loop->epfd, op, fd, &ev) < 0)
+        return sockErr();
+    return 0;
+}
+
+struct SockLoop* loop_create()
+{
+    struct SockLoop *loop = malloc(sizeof(*loop));
+    if (!loop)
+        return NULL;
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        free(loop);
+        return NULL;
+    }
+    loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wakefd < 0 || loop_ctl(loop, EPOLL_CTL_ADD, loop->wakefd, SOCK_EV_READ, &loop->wakefd) != 0) {
+        if (loop->wakefd >= 0)
+            close(loop->wakefd);
+        close(loop->epfd);
+        free(loop);
+        return NULL;
+    }
+    loop->woken = 0;
+    sock_wheel_init(&loop->wheel);
+    return loop;
+}
+
+int loop_add_tcp(struct SockLoop *loop, struct TCPSocket *sock, int events, void *udata)
+{
+    return loop_ctl(loop, EPOLL_CTL_ADD, sock->fd, events, udata);
+}
+
+int loop_add_udp(struct SockLoop *loop, struct UDPSocket *sock, int events, void *udata)
+{
+    return loop_ctl(loop, EPOLL_CTL_ADD, sock->fd, events, udata);
+}
+
+int loop_mod_tcp(struct SockLoop *loop, struct TCPSocket *sock, int events, void *udata)
+{
+    return loop_ctl(loop, EPOLL_CTL_MOD, sock->fd, events, udata);
+}
+
+int loop_mod_udp(struct SockLoop *loop, struct UDPSocket *sock, int events, void *udata)
+{
+    return loop_ctl(loop, EPOLL_CTL_MOD, sock->fd, events, udata);
+}
+
+int loop_del_tcp(struct SockLoop *loop, struct TCPSocket *sock)
+{
+    return loop_ctl(loop, EPOLL_CTL_DEL, sock->fd, 0, NULL);
+}
+
+int loop_del_udp(struct SockLoop *loop, struct UDPSocket *sock)
+{
+    return loop_ctl(loop, EPOLL_CTL_DEL, sock->fd, 0, NULL);
+}
+
+int loop_timer_add(struct SockLoop *loop, struct SockTimer *timer, unsigned timeout_ms, void *udata)
+{
+    if (!loop || !timer)
+        return -EINVAL;
+    sock_wheel_add(&loop->wheel, timer, timeout_ms, udata);
+    return 0;
+}
+
+int loop_timer_del(struct SockLoop *loop, struct SockTimer *timer)
+{
+    if (!loop || !timer)
+        return -EINVAL;
+    sock_wheel_del(&loop->wheel, timer);
+    return 0;
+}
+
+int loop_wait(struct SockLoop *loop, struct SockEvent *events, size_t maxevents, int timeout_ms)
+{
+    struct epoll_event evs[LOOP_EVENTS_MAX];
+    int n, i, found;
+
+    timeout_ms = sock_wheel_timeout(&loop->wheel, timeout_ms);
+    n = epoll_wait(loop->epfd, evs, maxevents > LOOP_EVENTS_MAX ? LOOP_EVENTS_MAX : (int)maxevents,
+                   timeout_ms < 0 ? -1 : timeout_ms);
+    if (n < 0 && errno != EINTR)
+        return sockErr();
+    if (n < 0)
+        n = 0;
+
+    for (i = 0, found = 0; i < n; ++i) {
+        int ready = 0;
+        if (evs[i].data.ptr == &loop->wakefd) {
+            uint64_t count;
+            // cleared after draining: a wake landing before the clear skipped its write, but this call
+            // returns anyway, and one after it writes again, so a pending wake always has its count
+            ssize_t got = read(loop->wakefd, &count, sizeof(count));
+            sockAtomicCas(&loop->woken, 1, 0);
+            if (got < 0 && errno != EAGAIN)
+                return sockErr();
+            continue;
+        }
+        if (evs[i].events & EPOLLIN)  ready |= SOCK_EV_READ;
+        if (evs[i].events & EPOLLOUT) ready |= SOCK_EV_WRITE;
+        if (evs[i].events & EPOLLERR) ready |= SOCK_EV_ERROR;
+        if (evs[i].events & EPOLLHUP) ready |= SOCK_EV_HUP;
+        events[found].udata = evs[i].data.ptr;
+        events[found].events = ready;
+        found++;
+    }
+    return found + (int)sock_wheel_expire(&loop->wheel, events + found, maxevents - found);
+}
+
+int loop_wake(struct SockLoop *loop)
+{
+    uint64_t one = 1;
+
+    if (!loop)
+        return -EINVAL;
+    if (!sockAtomicCas(&loop->woken, 0, 1))
+        return 0;
+    // only fails with EAGAIN once the counter is about to overflow, and then a wake is pending anyway
+    if (write(loop->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        return sockErr();
+    return 0;
+}
+
+int loop_free(struct SockLoop *loop)
+{
+    int status;
+    if (!loop)
+        return -EINVAL;
+    status = close(loop->epfd) < 0 ? sockErr() : 0;
+    close(loop->wakefd);
+    free(loop);
+    return status;
+}
+
+
+// -------------------
+// ---- Error API ----
+// -------------------
+
+char* get_error(int errnum)
+{
+    switch (errnum) {
+    case SOCK_ERR_RESOLVE:
+        return "host could not be resolved";
+    case SOCK_ERR_WOULDBLOCK:
+        return "operation would block";
+    case SOCK_ERR_INPROGRESS:
+        return "connection in progress";
+    case SOCK_ERR_UNSUPPORTED:
+        return "not supported on this platform";
+    case SOCK_ERR_CLOSED:
+        return "socket is being freed";
+    default:
+        return strerror(errnum < 0 ? -errnum : errnum);
+    }
+}
@@ -0,0 +1,294 @@
+// Handle and buffer pools for the S-Socket C API, shared by both backends, see s-socket.h for documentation
+// ------------------------------------------------------------------------------
+
+#include "s-socket.h"
+#include "networking.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+union PoolSlot {
+    struct TCPSocket tcp;
+    struct UDPSocket udp;
+    union PoolSlot *next; // free list link while the slot is unused
+};
+
+struct PoolSlab {
+    struct PoolSlab *next;
+    union PoolSlot slots[]; // count slots
+};
+
+struct SockPool {
+    union PoolSlot *free;
+    struct PoolSlab *slabs;
+    size_t count;
+    size_t live;
+    sock_mutex lock; // a deferred free hands its slot back from whichever thread finished last
+};
+
+// Adds a slab and threads its slots onto the free list in address order
+static int pool_grow(struct SockPool *pool)
+{
+    struct PoolSlab *slab = malloc(sizeof(*slab) + pool->count * sizeof(union PoolSlot));
+    size_t i;
+
+    if (!slab)
+        return SOCK_ENOMEM;
+    for (i = 0; i < pool->count; ++i)
+        slab->slots[i].next = i + 1 < pool->count ? &slab->slots[i + 1] : pool->free;
+    pool->free = &slab->slots[0];
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    return 0;
+}
+
+static union PoolSlot* pool_get(struct SockPool *pool)
+{
+    union PoolSlot *slot = NULL;
+
+    sockLock(&pool->lock);
+    if (pool->free || pool_grow(pool) == 0) {
+        slot = pool->free;
+        pool->free = slot->next;
+        pool->live++;
+    }
+    sockUnlock(&pool->lock);
+    return slot;
+}
+
+SOCK_INTERNAL void sock_pool_put(struct SockPool *pool, void *handle)
+{
+    union PoolSlot *slot = handle;
+    sockLock(&pool->lock);
+    slot->next = pool->free;
+    pool->free = slot;
+    pool->live--;
+    sockUnlock(&pool->lock);
+}
+
+struct SockPool* sock_pool_create(size_t count)
+{
+    struct SockPool *pool = calloc(1, sizeof(*pool));
+    sock_mutex unlocked = SOCK_MUTEX_INIT;
+    if (!pool)
+        return NULL;
+
+    pool->count = count > 0 ? count : 1;
+    pool->lock = unlocked;
+    if (pool_grow(pool) != 0) {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+int sock_pool_free(struct SockPool *pool)
+{
+    size_t live;
+
+    if (!pool)
+        return SOCK_EINVAL;
+    sockLock(&pool->lock);
+    live = pool->live;
+    sockUnlock(&pool->lock);
+    if (live > 0)
+        return SOCK_EINVAL;
+
+    while (pool->slabs) {
+        struct PoolSlab *next = pool->slabs->next;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+    free(pool);
+    return 0;
+}
+
+int tcp_accept_into_pool(struct TCPSocket *sock,
+                         struct SockPool *pool,
+                         struct TCPSocket **client,
+                         struct AddrInfo *clientInfo,
+                         size_t flags)
+{
+    union PoolSlot *slot;
+    struct TCPSocket *handle;
+    int rc;
+
+    if (!pool || !client)
+        return SOCK_EINVAL;
+    if (!(slot = pool_get(pool)))
+        return SOCK_ENOMEM;
+
+    handle = tcp_mkhandle_in(slot);
+    if (!handle) {
+        sock_pool_put(pool, slot);
+        return SOCK_ENOMEM;
+    }
+    handle->pool = pool;
+
+    rc = tcp_accept(sock, handle, clientInfo, flags);
+    if (rc != 0) {
+        tcp_free(handle);
+        return rc;
+    }
+    *client = handle;
+    return 0;
+}
+
+struct TCPSocket* tcp_mksocket_pool(struct SockPool *pool)
+{
+    union PoolSlot *slot = pool ? pool_get(pool) : NULL;
+    struct TCPSocket *handle;
+
+    if (!slot)
+        return NULL;
+    if (!(handle = tcp_mksocket_in(slot))) {
+        sock_pool_put(pool, slot);
+        return NULL;
+    }
+    handle->pool = pool;
+    return handle;
+}
+
+struct UDPSocket* udp_mksocket_pool(struct SockPool *pool)
+{
+    union PoolSlot *slot = pool ? pool_get(pool) : NULL;
+    struct UDPSocket *handle;
+
+    if (!slot)
+        return NULL;
+    if (!(handle = udp_mksocket_in(slot))) {
+        sock_pool_put(pool, slot);
+        return NULL;
+    }
+    handle->pool = pool;
+    return handle;
+}
+
+#define BUF_ALIGN 64 // buffers start on their own cache line
+
+struct SockBufPool* sock_bufpool_create(size_t bufsize, size_t count)
+{
+    struct SockBufPool *pool;
+    sock_mutex unlocked = SOCK_MUTEX_INIT;
+    size_t stride = (bufsize + BUF_ALIGN - 1) / BUF_ALIGN * BUF_ALIGN;
+    size_t i;
+
+    if (bufsize == 0 || count == 0 || stride < bufsize || count > SIZE_MAX / stride)
+        return NULL;
+    if (!(pool = calloc(1, sizeof(*pool))))
+        return NULL;
+
+    // a large arena is mmap'd by the allocator, so buffers that are never handed out never get pages
+    pool->arena = malloc(count * stride);
+    pool->free = malloc(count * sizeof(size_t));
+    if (!pool->arena || !pool->free) {
+        free(pool->arena);
+        free(pool->free);
+        free(pool);
+        return NULL;
+    }
+    pool->size = bufsize;
+    pool->stride = stride;
+    pool->count = count;
+    pool->lock = unlocked;
+
+    // the stack top is buffer 0, and a put buffer is the next one out again, so use stays packed low
+    for (i = 0; i < count; ++i)
+        pool->free[i] = count - 1 - i;
+    pool->nfree = count;
+    return pool;
+}
+
+int sock_bufpool_free(struct SockBufPool *pool)
+{
+    size_t nfree;
+
+    if (!pool)
+        return SOCK_EINVAL;
+    sockLock(&pool->lock);
+    nfree = pool->nfree;
+    sockUnlock(&pool->lock);
+    if (nfree != pool->count)
+        return SOCK_EINVAL;
+
+    free(pool->arena);
+    free(pool->free);
+    free(pool);
+    return 0;
+}
+
+void* sock_buf_get(struct SockBufPool *pool)
+{
+    void *buf = NULL;
+
+    if (!pool)
+        return NULL;
+    sockLock(&pool->lock);
+    if (pool->nfree > 0)
+        buf = pool->arena + pool->free[--pool->nfree] * pool->stride;
+    sockUnlock(&pool->lock);
+    return buf;
+}
+
+int sock_buf_put(struct SockBufPool *pool, void *buf)
+{
+    long index;
+    int rc = 0;
+
+    if (!pool || (index = sockBufIndex(pool, buf)) < 0)
+        return SOCK_EINVAL;
+    sockLock(&pool->lock);
+    if (pool->nfree < pool->count)
+        pool->free[pool->nfree++] = (size_t)index;
+    else
+        rc = SOCK_EINVAL;
+    sockUnlock(&pool->lock);
+    return rc;
+}
+
+int tcp_recv_pooled(struct TCPSocket *sock,
+                    struct SockBufPool *pool,
+                    struct SockBuf *out,
+                    size_t flags)
+{
+    void *buf;
+    int rc;
+
+    if (!out)
+        return SOCK_EINVAL;
+    if (!(buf = sock_buf_get(pool)))
+        return pool ? SOCK_ENOBUFS : SOCK_EINVAL;
+
+    rc = tcp_recv(sock, buf, pool->size, flags);
+    if (rc <= 0) {
+        sock_buf_put(pool, buf);
+        return rc;
+    }
+    out->buf = buf;
+    out->len = (size_t)rc;
+    return rc;
+}
+
+int udp_recv_pooled(struct UDPSocket *sock,
+                    struct SockBufPool *pool,
+                    struct SockBuf *out,
+                    size_t flags,
+                    struct AddrInfo *from)
+{
+    void *buf;
+    int rc;
+
+    if (!out)
+        return SOCK_EINVAL;
+    if (!(buf = sock_buf_get(pool)))
+        return pool ? SOCK_ENOBUFS : SOCK_EINVAL;
+
+    rc = udp_recv(sock, buf, pool->size, flags, from);
+    if (rc <= 0) {
+        sock_buf_put(pool, buf);
+        return rc;
+    }
+    out->buf = buf;
+    out->len = (size_t)rc;
+    return rc;
+}
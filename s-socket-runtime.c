@@ -0,0 +1,266 @@
+// Worker runtime for the S-Socket C API, shared by both backends, see s-socket.h for documentation
+// ------------------------------------------------------------------------------
+
+#include "s-socket.h"
+#include "networking.h"
+
+#define RUNTIME_EVENTS 128 // events one worker handles per loop_wait
+
+struct SockWorker {
+    struct SockRuntime *rt;
+    struct SockLoop *loop;
+    struct SockTask *volatile inbox;   // lock-free stack of posted tasks, newest first
+    volatile long load;                // handed off connections not yet released
+    int index;
+};
+
+struct SockRuntime {
+    struct SockWorker *workers;
+    int n;
+    int pin, numa;
+    sock_accept_fn on_accept;
+    sock_event_fn on_event;
+    volatile long stopping;
+    volatile long rover;   // where the least loaded search starts, spreading ties
+    int started;
+    int running;           // worker threads that haven't exited yet, under lock
+    sock_mutex lock;
+    sock_cond exited;
+};
+
+// A handoff's task, the one thing the runtime allocates per connection
+struct RuntimeHandoff {
+    struct SockTask task;
+    struct TCPSocket *sock;
+    void *udata;
+};
+
+// Takes everything posted so far and runs it oldest first
+static void runtime_run_tasks(struct SockWorker *w)
+{
+    struct SockTask *task = sockAtomicXchgPtr((void *volatile *)&w->inbox, NULL), *fifo = NULL;
+
+    while (task) {
+        struct SockTask *next = task->next;
+        task->next = fifo;
+        fifo = task;
+        task = next;
+    }
+    while (fifo) {
+        struct SockTask *next = fifo->next;
+        fifo->run(w, fifo);
+        fifo = next;
+    }
+}
+
+static void runtime_deliver(struct SockWorker *w, struct SockTask *task)
+{
+    struct RuntimeHandoff *h = (struct RuntimeHandoff*)task;
+    struct TCPSocket *sock = h->sock;
+    void *udata = h->udata;
+
+    free(h);
+    w->rt->on_accept(w, sock, udata);
+}
+
+static SOCK_THREAD_FN(runtime_worker_main)
+{
+    struct SockWorker *w = arg;
+    struct SockRuntime *rt = w->rt;
+    struct SockEvent events[RUNTIME_EVENTS];
+    int n, i;
+
+    if (rt->pin)
+        sock_cpu_pin(sock_cpu_for(w->index, rt->numa));
+
+    while (!rt->stopping) {
+        n = loop_wait(w->loop, events, RUNTIME_EVENTS, -1);
+        if (n < 0)
+            break;
+        // tasks first, so a connection handed off in the meantime is registered before its events matter
+        runtime_run_tasks(w);
+        for (i = 0; i < n && rt->on_event; ++i)
+            rt->on_event(w, &events[i]);
+    }
+    runtime_run_tasks(w);
+
+    sockLock(&rt->lock);
+    if (--rt->running == 0)
+        sockSignal(&rt->exited);
+    sockUnlock(&rt->lock);
+    SOCK_THREAD_RET;
+}
+
+struct SockRuntime* sock_runtime_create(int nthreads)
+{
+    sock_mutex unlocked = SOCK_MUTEX_INIT;
+    sock_cond idle = SOCK_COND_INIT;
+    struct SockRuntime *rt;
+    int i;
+
+    if (nthreads <= 0)
+        nthreads = sock_ncpu();
+    rt = calloc(1, sizeof(*rt));
+    if (!rt)
+        return NULL;
+    rt->workers = calloc(nthreads, sizeof(*rt->workers));
+    if (!rt->workers) {
+        free(rt);
+        return NULL;
+    }
+    rt->n = nthreads;
+    rt->lock = unlocked;
+    rt->exited = idle;
+
+    for (i = 0; i < nthreads; ++i) {
+        rt->workers[i].rt = rt;
+        rt->workers[i].index = i;
+        if (!(rt->workers[i].loop = loop_create())) {
+            sock_runtime_free(rt);
+            return NULL;
+        }
+    }
+    return rt;
+}
+
+int sock_runtime_mod(struct SockRuntime *rt, int mod, int mod_value)
+{
+    if (!rt || rt->started)
+        return SOCK_EINVAL;
+
+    switch (mod) {
+    case SOCK_RUNTIME_MOD_PIN:
+        rt->pin = mod_value != 0;
+        return 0;
+    case SOCK_RUNTIME_MOD_NUMA:
+        rt->numa = mod_value != 0;
+        return 0;
+    default:
+        return SOCK_EINVAL;
+    }
+}
+
+int sock_runtime_start(struct SockRuntime *rt, sock_accept_fn on_accept, sock_event_fn on_event)
+{
+    int i, rc = 0;
+
+    if (!rt || rt->started)
+        return SOCK_EINVAL;
+    rt->on_accept = on_accept;
+    rt->on_event = on_event;
+    rt->started = 1;
+
+    sockLock(&rt->lock);
+    for (i = 0; i < rt->n; ++i) {
+        if ((rc = sockThread(runtime_worker_main, &rt->workers[i])) != 0)
+            break;
+        rt->running++;
+    }
+    sockUnlock(&rt->lock);
+
+    // the workers that did start are stopped again by sock_runtime_free
+    return rc;
+}
+
+int sock_runtime_handoff(struct SockRuntime *rt, struct TCPSocket *sock, void *udata)
+{
+    struct RuntimeHandoff *h;
+    struct SockWorker *best;
+    int i, start;
+
+    if (!rt || !sock || !rt->on_accept)
+        return SOCK_EINVAL;
+    h = malloc(sizeof(*h));
+    if (!h)
+        return SOCK_ENOMEM;
+    h->task.run = runtime_deliver;
+    h->sock = sock;
+    h->udata = udata;
+
+    // loads are read without a lock, a slightly stale pick is fine
+    start = (int)((unsigned long)sockAtomicAdd(&rt->rover, 1) % (unsigned)rt->n);
+    best = &rt->workers[start];
+    for (i = 1; i < rt->n; ++i) {
+        struct SockWorker *w = &rt->workers[(start + i) % rt->n];
+        if (w->load < best->load)
+            best = w;
+    }
+    sockAtomicAdd(&best->load, 1);
+    return sock_worker_post(best, &h->task);
+}
+
+int sock_worker_post(struct SockWorker *worker, struct SockTask *task)
+{
+    struct SockTask *head;
+
+    if (!worker || !task || !task->run)
+        return SOCK_EINVAL;
+    do {
+        head = worker->inbox;
+        task->next = head;
+    } while (!sockAtomicCasPtr((void *volatile *)&worker->inbox, head, task));
+
+    // only the post that found the queue empty has to wake the worker; the rest ride along
+    if (head)
+        return 0;
+    return loop_wake(worker->loop);
+}
+
+int sock_worker_release(struct SockWorker *worker)
+{
+    if (!worker)
+        return SOCK_EINVAL;
+    sockAtomicAdd(&worker->load, -1);
+    return 0;
+}
+
+int sock_runtime_workers(struct SockRuntime *rt)
+{
+    return rt ? rt->n : 0;
+}
+
+struct SockWorker* sock_runtime_worker(struct SockRuntime *rt, int index)
+{
+    if (!rt || index < 0 || index >= rt->n)
+        return NULL;
+    return &rt->workers[index];
+}
+
+struct SockLoop* sock_worker_loop(struct SockWorker *worker)
+{
+    return worker ? worker->loop : NULL;
+}
+
+int sock_worker_index(struct SockWorker *worker)
+{
+    return worker ? worker->index : -1;
+}
+
+int sock_runtime_free(struct SockRuntime *rt)
+{
+    int i, status = 0;
+
+    if (!rt)
+        return SOCK_EINVAL;
+
+    sockAtomicOr(&rt->stopping, 1);
+    for (i = 0; i < rt->n; ++i)
+        if (rt->workers[i].loop)
+            loop_wake(rt->workers[i].loop);
+    sockLock(&rt->lock);
+    while (rt->running > 0)
+        sockWait(&rt->exited, &rt->lock);
+    sockUnlock(&rt->lock);
+
+    for (i = 0; i < rt->n; ++i) {
+        struct SockWorker *w = &rt->workers[i];
+        // a runtime that never started still owes its queued tasks their run
+        if (!rt->started && w->loop)
+            runtime_run_tasks(w);
+        if (w->loop && loop_free(w->loop) != 0)
+            status = -1;
+    }
+    free(rt->workers);
+    free(rt);
+    return status;
+}
@@ -0,0 +1,158 @@
+// Data call counters for the S-Socket C API, shared by both backends, see s-socket.h for documentation
+// ------------------------------------------------------------------------------
+
+#include "s-socket.h"
+#include "networking.h"
+
+#ifdef S_SOCKET_STATS
+
+// A thread's block of process-wide totals. Blocks outlive their threads, so nothing counted is ever lost,
+// and a block whose thread exited is handed to the next new thread instead of allocating another one
+struct StatsBlock {
+    struct SockCounters c;
+    struct StatsBlock *next;
+    int in_use;
+};
+
+static sock_mutex stats_lock = SOCK_MUTEX_INIT;
+static struct StatsBlock *stats_blocks;
+static struct SockCounters stats_fallback; // shared, and so approximate, if a block can't be allocated
+
+SOCK_INTERNAL SOCK_THREAD_LOCAL struct SockCounters *sock_thread_counters;
+
+#ifdef _WIN32
+static DWORD stats_key = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t stats_key;
+static int stats_key_made;
+#endif
+
+// Thread exit hook: the block stays on the list with its counts for the next thread to reuse
+#ifdef _WIN32
+static void WINAPI stats_retire(void *block)
+#else
+static void stats_retire(void *block)
+#endif
+{
+    if (!block)
+        return;
+    sockLock(&stats_lock);
+    ((struct StatsBlock*)block)->in_use = 0;
+    sockUnlock(&stats_lock);
+}
+
+SOCK_INTERNAL struct SockCounters* sockThreadCounters(void)
+{
+    struct StatsBlock *b;
+
+    sockLock(&stats_lock);
+#ifdef _WIN32
+    if (stats_key == FLS_OUT_OF_INDEXES)
+        stats_key = FlsAlloc(stats_retire);
+#else
+    if (!stats_key_made)
+        stats_key_made = pthread_key_create(&stats_key, stats_retire) == 0;
+#endif
+    for (b = stats_blocks; b && b->in_use; b = b->next)
+        ;
+    if (!b && (b = calloc(1, sizeof(*b)))) {
+        b->next = stats_blocks;
+        stats_blocks = b;
+    }
+    if (b)
+        b->in_use = 1;
+    sockUnlock(&stats_lock);
+
+    if (!b)
+        return &stats_fallback;
+#ifdef _WIN32
+    if (stats_key != FLS_OUT_OF_INDEXES)
+        FlsSetValue(stats_key, b);
+#else
+    if (stats_key_made)
+        pthread_setspecific(stats_key, b);
+#endif
+    sock_thread_counters = &b->c;
+    return sock_thread_counters;
+}
+
+static void stats_add(unsigned long long *totals, struct SockCounters *c)
+{
+    int i;
+    for (i = 0; i < SOCK_STAT_COUNT; ++i)
+        totals[i] += (unsigned long long)sockStatLoad(&c->v[i]);
+}
+
+static void stats_out(struct SockStats *out, unsigned long long *totals)
+{
+    out->bytes_sent = totals[SOCK_STAT_BYTES_SENT];
+    out->bytes_received = totals[SOCK_STAT_BYTES_RECEIVED];
+    out->sends = totals[SOCK_STAT_SENDS];
+    out->receives = totals[SOCK_STAT_RECEIVES];
+    out->short_sends = totals[SOCK_STAT_SHORT_SENDS];
+    out->short_receives = totals[SOCK_STAT_SHORT_RECEIVES];
+    out->wouldblock = totals[SOCK_STAT_WOULDBLOCK];
+    out->errors = totals[SOCK_STAT_ERRORS];
+}
+
+int sock_stats(struct SockStats *out)
+{
+    unsigned long long totals[SOCK_STAT_COUNT] = {0};
+    struct StatsBlock *b;
+
+    if (!out)
+        return SOCK_EINVAL;
+    sockLock(&stats_lock);
+    for (b = stats_blocks; b; b = b->next)
+        stats_add(totals, &b->c);
+    sockUnlock(&stats_lock);
+    stats_add(totals, &stats_fallback);
+    stats_out(out, totals);
+    return 0;
+}
+
+int tcp_stats(struct TCPSocket *sock, struct SockStats *out)
+{
+    unsigned long long totals[SOCK_STAT_COUNT] = {0};
+
+    if (!sock || !out)
+        return SOCK_EINVAL;
+    stats_add(totals, &sock->stats);
+    stats_out(out, totals);
+    return 0;
+}
+
+int udp_stats(struct UDPSocket *sock, struct SockStats *out)
+{
+    unsigned long long totals[SOCK_STAT_COUNT] = {0};
+
+    if (!sock || !out)
+        return SOCK_EINVAL;
+    stats_add(totals, &sock->stats);
+    stats_out(out, totals);
+    return 0;
+}
+
+#else
+
+int sock_stats(struct SockStats *out)
+{
+    (void)out;
+    return SOCK_ERR_UNSUPPORTED;
+}
+
+int tcp_stats(struct TCPSocket *sock, struct SockStats *out)
+{
+    (void)sock;
+    (void)out;
+    return SOCK_ERR_UNSUPPORTED;
+}
+
+int udp_stats(struct UDPSocket *sock, struct SockStats *out)
+{
+    (void)sock;
+    (void)out;
+    return SOCK_ERR_UNSUPPORTED;
+}
+
+#endif // S_SOCKET_STATS
@@ -0,0 +1,560 @@
+// Buffered TCP streams for the S-Socket C API, shared by both backends, see s-socket.h for documentation
+// ------------------------------------------------------------------------------
+
+#include "s-socket.h"
+#include "networking.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct TCPStream {
+    struct TCPSocket *sock;
+
+    char *rbuf;                 // unread input is rbuf[rhead, rtail)
+    size_t rcap, rhead, rtail;
+    size_t scanned;             // bytes from rhead that stream_read_until already searched
+
+    char *wbuf;                 // pending output is wbuf[whead, wtail)
+    size_t wcap, whead, wtail;
+    size_t flush_bytes;
+    unsigned flush_ms;
+    unsigned long long wsince;  // sockNowMs() when the oldest pending byte was written
+};
+
+
+// ---------------
+// ---- Write ----
+// ---------------
+
+// Sends pending output until none is left or the socket refuses more
+static int stream_drain(struct TCPStream *s)
+{
+    while (s->whead < s->wtail) {
+        int sent = tcp_send(s->sock, s->wbuf + s->whead, s->wtail - s->whead, 0);
+        if (sent < 0)
+            return sent;
+        s->whead += sent;
+    }
+    s->whead = s->wtail = 0;
+    return 0;
+}
+
+// Moves unsent output to the front of the buffer, so all the free space is at its end
+static void stream_compact(struct TCPStream *s)
+{
+    if (s->whead > 0) {
+        memmove(s->wbuf, s->wbuf + s->whead, s->wtail - s->whead);
+        s->wtail -= s->whead;
+        s->whead = 0;
+    }
+}
+
+// Sends the buffer once it holds flush_bytes or its oldest byte has waited flush_ms
+static int stream_flush_due_now(struct TCPStream *s)
+{
+    if (s->wtail - s->whead >= s->flush_bytes || (s->flush_ms && sockNowMs() - s->wsince >= s->flush_ms)) {
+        int rc = stream_drain(s);
+        if (rc < 0 && rc != SOCK_ERR_WOULDBLOCK)
+            return rc;
+    }
+    return 0;
+}
+
+// Sends pending output followed by data with vectored sends, returning how much of data went out; err, if
+// given, gets the error that cut the sends short
+static int stream_write_through(struct TCPStream *s, char *data, size_t len, int *err)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        struct SockBuf bufs[2];
+        size_t pending = s->wtail - s->whead;
+        size_t n = 0;
+        int sent;
+
+        if (pending > 0) {
+            bufs[n].buf = s->wbuf + s->whead;
+            bufs[n++].len = pending;
+        }
+        bufs[n].buf = data + done;
+        bufs[n++].len = len - done;
+
+        sent = tcp_sendv(s->sock, bufs, n, 0);
+        if (sent < 0) {
+            if (err)
+                *err = sent;
+            return done > 0 ? (int)done : sent;
+        }
+        if ((size_t)sent < pending) {
+            s->whead += sent;
+            continue;
+        }
+        s->whead = s->wtail = 0;
+        done += sent - pending;
+    }
+    return (int)done;
+}
+
+int stream_write(struct TCPStream *s, void *data, size_t len)
+{
+    size_t room;
+    int rc;
+
+    if (!s || (!data && len > 0))
+        return SOCK_EINVAL;
+    if (len == 0)
+        return 0;
+    if (len > INT_MAX)
+        len = INT_MAX;
+
+    if (s->wtail + len > s->wcap) {
+        if (len >= s->wcap)
+            return stream_write_through(s, data, len, NULL);
+
+        // make room by sending what is pending, then by moving any unsent rest to the front
+        rc = stream_drain(s);
+        if (rc < 0 && rc != SOCK_ERR_WOULDBLOCK)
+            return rc;
+        stream_compact(s);
+    }
+
+    room = s->wcap - s->wtail;
+    if (len > room)
+        len = room;
+    if (len == 0)
+        return SOCK_ERR_WOULDBLOCK;
+
+    if (s->wtail == s->whead)
+        s->wsince = sockNowMs();
+    memcpy(s->wbuf + s->wtail, data, len);
+    s->wtail += len;
+
+    if ((rc = stream_flush_due_now(s)) < 0)
+        return rc;
+    return (int)len;
+}
+
+int stream_flush(struct TCPStream *s)
+{
+    return s ? stream_drain(s) : SOCK_EINVAL;
+}
+
+int stream_pending(struct TCPStream *s)
+{
+    return s ? (int)(s->wtail - s->whead) : SOCK_EINVAL;
+}
+
+int stream_flush_due(struct TCPStream *s)
+{
+    unsigned long long age;
+
+    if (!s || s->whead == s->wtail || s->flush_ms == 0)
+        return -1;
+    age = sockNowMs() - s->wsince;
+    return age >= s->flush_ms ? 0 : (int)(s->flush_ms - age);
+}
+
+int stream_set_coalesce(struct TCPStream *s, size_t max_bytes, unsigned max_delay_ms)
+{
+    if (!s)
+        return SOCK_EINVAL;
+    s->flush_bytes = max_bytes == 0 || max_bytes > s->wcap ? s->wcap : max_bytes;
+    s->flush_ms = max_delay_ms;
+    return 0;
+}
+
+
+// --------------
+// ---- Read ----
+// --------------
+
+// Reads once into the free end of the buffer, returning the bytes added, 0 at end of stream
+static int stream_fill(struct TCPStream *s)
+{
+    int got;
+
+    // a reader waiting for a response must not keep its own request buffered, write errors resurface on the next write
+    if (s->whead < s->wtail)
+        stream_drain(s);
+
+    if (s->rhead == s->rtail) {
+        s->rhead = s->rtail = 0;
+    } else if (s->rtail == s->rcap) {
+        if (s->rhead == 0)
+            return SOCK_ENOBUFS;
+        memmove(s->rbuf, s->rbuf + s->rhead, s->rtail - s->rhead);
+        s->rtail -= s->rhead;
+        s->rhead = 0;
+    }
+
+    got = tcp_recv(s->sock, s->rbuf + s->rtail, s->rcap - s->rtail, 0);
+    if (got > 0)
+        s->rtail += got;
+    return got;
+}
+
+// Makes sure want bytes are buffered contiguously, returning 1 once they are
+static int stream_want(struct TCPStream *s, size_t want)
+{
+    if (s->rhead + want > s->rcap) {
+        memmove(s->rbuf, s->rbuf + s->rhead, s->rtail - s->rhead);
+        s->rtail -= s->rhead;
+        s->rhead = 0;
+    }
+    while (s->rtail - s->rhead < want) {
+        int got = stream_fill(s);
+        if (got <= 0)
+            return got;
+    }
+    return 1;
+}
+
+static void stream_take(struct TCPStream *s, size_t n)
+{
+    s->rhead += n;
+    s->scanned = s->scanned > n ? s->scanned - n : 0;
+}
+
+int stream_read(struct TCPStream *s, void *buf, size_t len)
+{
+    size_t avail;
+    int got;
+
+    if (!s || (!buf && len > 0))
+        return SOCK_EINVAL;
+    if (len > INT_MAX)
+        len = INT_MAX;
+
+    if (s->rhead == s->rtail) {
+        // reads that would fill the whole buffer anyway go straight to the caller
+        if (len >= s->rcap) {
+            if (s->whead < s->wtail)
+                stream_drain(s);
+            return tcp_recv(s->sock, buf, len, 0);
+        }
+        if ((got = stream_fill(s)) <= 0)
+            return got;
+    }
+
+    avail = s->rtail - s->rhead;
+    if (len > avail)
+        len = avail;
+    memcpy(buf, s->rbuf + s->rhead, len);
+    stream_take(s, len);
+    return (int)len;
+}
+
+int stream_read_exact(struct TCPStream *s, void *buf, size_t len)
+{
+    size_t have, done;
+    int rc;
+
+    if (!s || (!buf && len > 0) || len > INT_MAX)
+        return SOCK_EINVAL;
+
+    if (len <= s->rcap) {
+        if ((rc = stream_want(s, len)) <= 0)
+            return rc;
+        memcpy(buf, s->rbuf + s->rhead, len);
+        stream_take(s, len);
+        return (int)len;
+    }
+
+    // more than a buffer's worth can't be held back until complete, so only blocking sockets may ask
+    if (s->sock->flags & SOCK_F_NONBLOCK)
+        return SOCK_EINVAL;
+
+    have = s->rtail - s->rhead;
+    memcpy(buf, s->rbuf + s->rhead, have);
+    stream_take(s, have);
+    if (s->whead < s->wtail)
+        stream_drain(s);
+
+    for (done = have; done < len; done += rc) {
+        rc = tcp_recv(s->sock, (char*)buf + done, len - done, TCP_RECV_WAITALL);
+        if (rc <= 0)
+            return rc;
+    }
+    return (int)len;
+}
+
+int stream_read_until(struct TCPStream *s, void *delim, size_t delimlen, void **line)
+{
+    const char *d = delim;
+
+    if (!s || !delim || delimlen == 0 || delimlen > s->rcap || !line)
+        return SOCK_EINVAL;
+
+    for (;;) {
+        char *start = s->rbuf + s->rhead;
+        size_t avail = s->rtail - s->rhead;
+        size_t at = s->scanned;
+        int got;
+
+        // memchr for the first delimiter byte, then compare the rest; a partial match at the end is searched again
+        while (at + delimlen <= avail) {
+            char *hit = memchr(start + at, d[0], avail - delimlen + 1 - at);
+            if (!hit)
+                break;
+            at = hit - start;
+            if (memcmp(hit + 1, d + 1, delimlen - 1) == 0) {
+                *line = start;
+                stream_take(s, at + delimlen);
+                s->scanned = 0;
+                return (int)(at + delimlen);
+            }
+            ++at;
+        }
+        s->scanned = avail >= delimlen ? avail - delimlen + 1 : 0;
+
+        if (avail == s->rcap)
+            return SOCK_ENOBUFS;
+        if ((got = stream_fill(s)) <= 0)
+            return got;
+    }
+}
+
+int stream_peek(struct TCPStream *s, size_t want, void **data)
+{
+    int rc;
+
+    if (!s || want > s->rcap || !data)
+        return SOCK_EINVAL;
+    if (want > 0 && (rc = stream_want(s, want)) <= 0)
+        return rc;
+    *data = s->rbuf + s->rhead;
+    return (int)(s->rtail - s->rhead);
+}
+
+int stream_consume(struct TCPStream *s, size_t n)
+{
+    if (!s || n > s->rtail - s->rhead)
+        return SOCK_EINVAL;
+    stream_take(s, n);
+    return 0;
+}
+
+int stream_buffered(struct TCPStream *s)
+{
+    return s ? (int)(s->rtail - s->rhead) : SOCK_EINVAL;
+}
+
+
+// -----------------
+// ---- Framing ----
+// -----------------
+
+// Longest length prefix, a 32 bit varint
+#define FRAME_HEADER_MAX 5
+
+static size_t frame_encode(int prefix, size_t len, unsigned char *out)
+{
+    size_t n = 0;
+
+    switch (prefix) {
+    case SOCK_FRAME_U16:
+        out[0] = (unsigned char)(len >> 8);
+        out[1] = (unsigned char)len;
+        return 2;
+    case SOCK_FRAME_U32:
+        out[0] = (unsigned char)(len >> 24);
+        out[1] = (unsigned char)(len >> 16);
+        out[2] = (unsigned char)(len >> 8);
+        out[3] = (unsigned char)len;
+        return 4;
+    default:
+        do {
+            out[n++] = (unsigned char)((len & 0x7f) | (len > 0x7f ? 0x80 : 0));
+            len >>= 7;
+        } while (len > 0);
+        return n;
+    }
+}
+
+// Parses a length prefix, returning 1 with hlen and flen set, 0 if more bytes are needed, negative if malformed
+static int frame_decode(int prefix, const unsigned char *in, size_t avail, size_t *hlen, size_t *flen)
+{
+    size_t len = 0, i;
+
+    switch (prefix) {
+    case SOCK_FRAME_U16:
+        if (avail < 2)
+            return 0;
+        *hlen = 2;
+        *flen = ((size_t)in[0] << 8) | in[1];
+        return 1;
+    case SOCK_FRAME_U32:
+        if (avail < 4)
+            return 0;
+        *hlen = 4;
+        *flen = ((size_t)in[0] << 24) | ((size_t)in[1] << 16) | ((size_t)in[2] << 8) | in[3];
+        return 1;
+    case SOCK_FRAME_VARINT:
+        for (i = 0; i < avail && i < FRAME_HEADER_MAX; ++i) {
+            len |= (size_t)(in[i] & 0x7f) << (7 * i);
+            if (!(in[i] & 0x80)) {
+                *hlen = i + 1;
+                *flen = len;
+                return 1;
+            }
+        }
+        return i == FRAME_HEADER_MAX ? SOCK_EINVAL : 0;
+    default:
+        return SOCK_EINVAL;
+    }
+}
+
+// Buffers prefix and payload together, or nothing: the space for both is made first, by sending what is
+// pending if need be, so a frame is never left half queued
+static int frame_queue(struct TCPStream *s, unsigned char *hdr, size_t hlen, void *data, size_t len)
+{
+    int rc;
+
+    if (s->wcap - (s->wtail - s->whead) < hlen + len) {
+        rc = stream_drain(s);
+        if (rc < 0 && rc != SOCK_ERR_WOULDBLOCK)
+            return rc;
+        if (s->wcap - (s->wtail - s->whead) < hlen + len)
+            return SOCK_ERR_WOULDBLOCK;
+    }
+    if (s->wtail + hlen + len > s->wcap)
+        stream_compact(s);
+
+    if (s->wtail == s->whead)
+        s->wsince = sockNowMs();
+    memcpy(s->wbuf + s->wtail, hdr, hlen);
+    if (len > 0)
+        memcpy(s->wbuf + s->wtail + hlen, data, len);
+    s->wtail += hlen + len;
+    return 0;
+}
+
+int stream_send_frame(struct TCPStream *s, int prefix, void *data, size_t len)
+{
+    unsigned char hdr[FRAME_HEADER_MAX];
+    size_t max = prefix == SOCK_FRAME_U16 ? 0xffff : 0xffffffff;
+    size_t hlen;
+    int rc, err = SOCK_ERR_WOULDBLOCK;
+
+    if (!s || (!data && len > 0) || prefix < SOCK_FRAME_VARINT || prefix > SOCK_FRAME_U32 || len > max || len > INT_MAX)
+        return SOCK_EINVAL;
+    hlen = frame_encode(prefix, len, hdr);
+
+    if (hlen + len <= s->wcap) {
+        if ((rc = frame_queue(s, hdr, hlen, data, len)) < 0 || (rc = stream_flush_due_now(s)) < 0)
+            return rc;
+        return (int)len;
+    }
+
+    // a non-blocking stream can't stop halfway through a frame, so it only takes frames that fit whole
+    if (s->sock->flags & SOCK_F_NONBLOCK)
+        return SOCK_ENOBUFS;
+
+    // the prefix is queued and goes out with the payload in one vectored send; a send cut short leaves
+    // part of the frame on the wire, which fails the call with the error that stopped it
+    if ((rc = frame_queue(s, hdr, hlen, NULL, 0)) < 0)
+        return rc;
+    rc = stream_write_through(s, data, len, &err);
+    if (rc < 0)
+        return rc;
+    return rc == (int)len ? rc : err;
+}
+
+// Takes the next complete frame out of the buffer without reading, 1 if there was one
+static int frame_next(struct TCPStream *s, int prefix, struct SockBuf *frame, size_t *need)
+{
+    unsigned char *start = (unsigned char*)s->rbuf + s->rhead;
+    size_t avail = s->rtail - s->rhead;
+    size_t hlen, flen;
+    int rc = frame_decode(prefix, start, avail, &hlen, &flen);
+
+    if (rc <= 0) {
+        *need = avail + 1;
+        return rc;
+    }
+    if (hlen + flen > s->rcap)
+        return SOCK_ENOBUFS;
+    if (avail < hlen + flen) {
+        *need = hlen + flen;
+        return 0;
+    }
+    frame->buf = start + hlen;
+    frame->len = flen;
+    stream_take(s, hlen + flen);
+    return 1;
+}
+
+int stream_recv_frame(struct TCPStream *s, int prefix, struct SockBuf *frame)
+{
+    size_t need;
+    int rc;
+
+    if (!s || !frame)
+        return SOCK_EINVAL;
+
+    // Each fill reads as much as the buffer holds, so later frames usually arrive with this one
+    while ((rc = frame_next(s, prefix, frame, &need)) == 0)
+        if ((rc = stream_want(s, need)) <= 0)
+            return rc;
+    return rc;
+}
+
+int stream_recv_frames(struct TCPStream *s, int prefix, struct SockBuf *frames, size_t n)
+{
+    size_t done, need;
+    int rc;
+
+    if (!s || !frames || n == 0)
+        return SOCK_EINVAL;
+    if (n > INT_MAX)
+        n = INT_MAX;
+
+    if ((rc = stream_recv_frame(s, prefix, &frames[0])) <= 0)
+        return rc;
+    // the rest must come from the buffer alone, another fill could move the frames already handed out
+    for (done = 1; done < n; ++done)
+        if (frame_next(s, prefix, &frames[done], &need) != 1)
+            break;
+    return (int)done;
+}
+
+
+// ------------------
+// ---- Lifetime ----
+// ------------------
+
+struct TCPStream* stream_create(struct TCPSocket *sock, size_t bufsize)
+{
+    struct TCPStream *s;
+
+    if (!sock)
+        return NULL;
+    if (bufsize == 0)
+        bufsize = SOCK_STREAM_BUF_DEFAULT;
+    if (bufsize > INT_MAX)
+        bufsize = INT_MAX;
+
+    // both buffers live in the same allocation as the stream
+    s = calloc(1, sizeof(*s) + 2 * bufsize);
+    if (!s)
+        return NULL;
+    s->sock = sock;
+    s->rbuf = (char*)(s + 1);
+    s->rcap = bufsize;
+    s->wbuf = s->rbuf + bufsize;
+    s->wcap = bufsize;
+    s->flush_bytes = bufsize;
+    return s;
+}
+
+int stream_free(struct TCPStream *s)
+{
+    int rc;
+
+    if (!s)
+        return SOCK_EINVAL;
+    rc = stream_drain(s);
+    free(s);
+    return rc;
+}
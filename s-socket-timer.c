@@ -0,0 +1,213 @@
+// Timing wheel behind the event loop timers, shared by both backends, see s-socket.h for documentation
+// ------------------------------------------------------------------------------
+
+#include "s-socket.h"
+#include "networking.h"
+
+#include <limits.h>
+
+#define WHEEL_MASK (SOCK_WHEEL_SLOTS - 1)
+#define WHEEL_SPAN (1ULL << (SOCK_WHEEL_BITS * SOCK_WHEEL_LEVELS)) // ticks the wheel can hold at once
+#define WHEEL_EXPIRED (SOCK_WHEEL_LEVELS * SOCK_WHEEL_SLOTS + 1)   // SockTimer.slot of a fired timer
+
+// Offset from `from` to the next set bit, going round; bits must not be zero
+static unsigned wheel_next_bit(unsigned long long bits, unsigned from)
+{
+    unsigned long long r = from ? (bits >> from) | (bits << (SOCK_WHEEL_SLOTS - from)) : bits;
+#if defined(__GNUC__)
+    return (unsigned)__builtin_ctzll(r);
+#else
+    unsigned k = 0;
+    while (!(r & 1)) {
+        r >>= 1;
+        ++k;
+    }
+    return k;
+#endif
+}
+
+static void wheel_unlink(struct SockWheel *wheel, struct SockTimer *timer)
+{
+    if (timer->slot == WHEEL_EXPIRED) {
+        if (timer->prev)
+            timer->prev->next = timer->next;
+        else
+            wheel->expired = timer->next;
+        if (timer->next)
+            timer->next->prev = timer->prev;
+        else
+            wheel->expired_tail = timer->prev;
+    } else {
+        unsigned level = (timer->slot - 1) / SOCK_WHEEL_SLOTS, idx = (timer->slot - 1) % SOCK_WHEEL_SLOTS;
+        if (timer->prev)
+            timer->prev->next = timer->next;
+        else
+            wheel->slots[level][idx] = timer->next;
+        if (timer->next)
+            timer->next->prev = timer->prev;
+        if (!wheel->slots[level][idx])
+            wheel->occupied[level] &= ~(1ULL << idx);
+    }
+    timer->next = timer->prev = NULL;
+    timer->slot = 0;
+}
+
+// Queues a timer on the level whose slots are just fine enough for its distance from the current tick
+static void wheel_place(struct SockWheel *wheel, struct SockTimer *timer)
+{
+    unsigned long long at = timer->expires < wheel->now ? wheel->now : timer->expires;
+    unsigned level = 0, idx;
+
+    if (at - wheel->now >= WHEEL_SPAN)
+        at = wheel->now + WHEEL_SPAN - 1; // parked in the last slot it can reach and re-queued from there
+    while (at - wheel->now >= 1ULL << (SOCK_WHEEL_BITS * (level + 1)))
+        ++level;
+    idx = (unsigned)(at >> (SOCK_WHEEL_BITS * level)) & WHEEL_MASK;
+
+    timer->prev = NULL;
+    timer->next = wheel->slots[level][idx];
+    if (timer->next)
+        timer->next->prev = timer;
+    wheel->slots[level][idx] = timer;
+    wheel->occupied[level] |= 1ULL << idx;
+    timer->slot = level * SOCK_WHEEL_SLOTS + idx + 1;
+}
+
+static void wheel_fire(struct SockWheel *wheel, struct SockTimer *timer)
+{
+    timer->slot = WHEEL_EXPIRED;
+    timer->next = NULL;
+    timer->prev = wheel->expired_tail;
+    if (wheel->expired_tail)
+        wheel->expired_tail->next = timer;
+    else
+        wheel->expired = timer;
+    wheel->expired_tail = timer;
+}
+
+static int wheel_empty(struct SockWheel *wheel)
+{
+    int level;
+    for (level = 0; level < SOCK_WHEEL_LEVELS; ++level)
+        if (wheel->occupied[level])
+            return 0;
+    return 1;
+}
+
+// Processes every tick up to and including target: a tick first moves the higher level slots that start
+// at it down the wheel, then fires its level 0 slot
+static void wheel_advance(struct SockWheel *wheel, unsigned long long target)
+{
+    while (wheel->now <= target) {
+        unsigned idx = (unsigned)wheel->now & WHEEL_MASK;
+        struct SockTimer *timer;
+        int level;
+
+        if (wheel_empty(wheel)) {
+            wheel->now = target + 1;
+            break;
+        }
+        // nothing to do until the next cascade
+        if (!wheel->occupied[0] && idx != 0) {
+            unsigned long long next = (wheel->now | WHEEL_MASK) + 1;
+            wheel->now = next < target + 1 ? next : target + 1;
+            continue;
+        }
+
+        if (idx == 0) {
+            for (level = 1; level < SOCK_WHEEL_LEVELS; ++level) {
+                unsigned lidx = (unsigned)(wheel->now >> (SOCK_WHEEL_BITS * level)) & WHEEL_MASK;
+                while ((timer = wheel->slots[level][lidx])) {
+                    wheel_unlink(wheel, timer);
+                    wheel_place(wheel, timer);
+                }
+                if (lidx != 0)
+                    break;
+            }
+        }
+        while ((timer = wheel->slots[0][idx])) {
+            wheel_unlink(wheel, timer);
+            wheel_fire(wheel, timer);
+        }
+        wheel->now++;
+    }
+}
+
+SOCK_INTERNAL void sock_wheel_init(struct SockWheel *wheel)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = sockNowMs();
+}
+
+SOCK_INTERNAL void sock_wheel_add(struct SockWheel *wheel, struct SockTimer *timer, unsigned timeout_ms, void *udata)
+{
+    if (timer->slot)
+        wheel_unlink(wheel, timer);
+    timer->udata = udata;
+    timer->expires = sockNowMs() + timeout_ms;
+    // the wheel already processed that tick
+    if (timer->expires < wheel->now)
+        wheel_fire(wheel, timer);
+    else
+        wheel_place(wheel, timer);
+}
+
+SOCK_INTERNAL void sock_wheel_del(struct SockWheel *wheel, struct SockTimer *timer)
+{
+    if (timer->slot)
+        wheel_unlink(wheel, timer);
+}
+
+SOCK_INTERNAL int sock_wheel_timeout(struct SockWheel *wheel, int timeout_ms)
+{
+    unsigned long long due = ULLONG_MAX, now;
+    int level;
+
+    if (wheel->expired)
+        return 0;
+
+    // the first tick with work on it: a level 0 slot firing or a higher slot cascading
+    for (level = 0; level < SOCK_WHEEL_LEVELS; ++level) {
+        unsigned shift = SOCK_WHEEL_BITS * level;
+        unsigned cur = (unsigned)(wheel->now >> shift) & WHEEL_MASK, k;
+        unsigned long long bits = wheel->occupied[level], tick;
+        int started = level > 0 && (wheel->now & ((1ULL << shift) - 1)) != 0;
+
+        if (!bits)
+            continue;
+        // a higher level's current slot cascades at its first tick; past that, anything still on it
+        // belongs to the next lap, so the slots after it come first
+        if (started && (bits & ~(1ULL << cur)))
+            bits &= ~(1ULL << cur);
+        k = wheel_next_bit(bits, cur);
+        if (started && k == 0)
+            k = SOCK_WHEEL_SLOTS;
+        tick = level == 0 ? wheel->now + k : ((wheel->now >> shift) + k) << shift;
+        if (tick < due)
+            due = tick;
+    }
+    if (due == ULLONG_MAX)
+        return timeout_ms;
+
+    now = sockNowMs();
+    if (due <= now)
+        return 0;
+    if (due - now < (unsigned long long)INT_MAX && (timeout_ms < 0 || due - now < (unsigned long long)timeout_ms))
+        return (int)(due - now);
+    return timeout_ms;
+}
+
+SOCK_INTERNAL size_t sock_wheel_expire(struct SockWheel *wheel, struct SockEvent *events, size_t maxevents)
+{
+    size_t n = 0;
+
+    wheel_advance(wheel, sockNowMs());
+    while (n < maxevents && wheel->expired) {
+        struct SockTimer *timer = wheel->expired;
+        wheel_unlink(wheel, timer);
+        events[n].udata = timer->udata;
+        events[n].events = SOCK_EV_TIMER;
+        n++;
+    }
+    return n;
+}
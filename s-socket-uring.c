@@ -0,0 +1,721 @@
+// io_uring completion ring for the linux backend, see s-socket.h for documentation
+// ------------------------------------------------------------------------------
+//
+// Talks to the kernel interface directly (io_uring_setup/enter/register and the mmap'd queues), so there
+// is no liburing dependency.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "s-socket.h"
+#include "networking.h"
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// What a queued operation needs to finish its completion, and the storage the kernel reads and writes
+// while it is in flight
+struct RingOp {
+    void *udata;
+    struct TCPSocket *client;   // accept: handle that takes over the connection
+    size_t flags;               // accept: TCP_ACCEPT_* flags
+    unsigned sockflags;         // accept: the listener's SOCK_F_INET6 and SOCK_F_UNIX bits, inherited by the client
+    struct AddrInfo *info;      // accept, udp recv: address to unmap on completion
+    struct sockaddr_in6 name;   // udp send: v4-mapped destination on an ipv6 socket
+    struct msghdr msg;          // udp send/recv
+    struct iovec iov;
+    socklen_t addrlen;          // accept
+    struct RingOp *next;        // free list
+};
+
+struct SockRing {
+    int fd;
+    unsigned setup_flags;
+
+    // submission queue
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_flags;
+    unsigned sq_entries;
+    unsigned sq_local;          // tail including sqes prepared since the last submit
+    struct io_uring_sqe *sqes;
+
+    // completion queue
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+
+    // one op per completion queue entry, so in-flight operations can never overflow it
+    struct RingOp *ops, *free_ops;
+
+    // fixed file table: slot -> fd, and fd -> slot for the descriptors that have one
+    int *slots;
+    unsigned nslots;
+    int *slot_of_fd;
+    size_t fdcap;
+
+    // provided buffer ring, group 0, with buffer ids equal to indices in bufpool
+    struct io_uring_buf_ring *br;
+    size_t br_sz;
+    unsigned short br_mask, br_tail;
+    struct SockBufPool *bufpool;
+    unsigned short *provided;   // ids of the buffers taken from bufpool
+    unsigned nprovided;
+};
+
+static int ring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int ring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// MSG_NOSIGNAL for the same reason as tcp_send
+static int ring_send_flags(unsigned sockflags, size_t flags)
+{
+    int sysflags = MSG_NOSIGNAL;
+    if (flags & TCP_SEND_DONTROUTE)   sysflags |= MSG_DONTROUTE;
+    if (flags & TCP_SEND_OOB)         sysflags |= MSG_OOB;
+    if (sockflags & SOCK_F_ZEROCOPY)  sysflags |= MSG_ZEROCOPY;
+    return sysflags;
+}
+
+static int ring_recv_flags(size_t flags)
+{
+    int sysflags = 0;
+    if (flags & TCP_RECV_PEEK)    sysflags |= MSG_PEEK;
+    if (flags & TCP_RECV_OOB)     sysflags |= MSG_OOB;
+    if (flags & TCP_RECV_WAITALL) sysflags |= MSG_WAITALL;
+    return sysflags;
+}
+
+static void ring_unmap(struct SockRing *ring)
+{
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_sz);
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_sz);
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_sz);
+}
+
+struct SockRing* ring_create(unsigned entries, size_t flags)
+{
+    struct io_uring_params p;
+    struct SockRing *ring = calloc(1, sizeof(*ring));
+    unsigned *sq_array;
+    unsigned i;
+
+    if (!ring)
+        return NULL;
+
+    memset(&p, 0, sizeof(p));
+    if (flags & SOCK_RING_SQPOLL) {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = 1000;
+    }
+
+    ring->fd = ring_setup(entries, &p);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+    ring->setup_flags = p.flags;
+
+    ring->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_sz > ring->sq_ring_sz)
+            ring->sq_ring_sz = ring->cq_ring_sz;
+        ring->cq_ring_sz = ring->sq_ring_sz;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ring = ring->sq_ring;
+    else
+        ring->cq_ring = mmap(NULL, ring->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED)
+        goto fail;
+    ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail;
+
+    ring->sq_head = (unsigned*)((char*)ring->sq_ring + p.sq_off.head);
+    ring->sq_tail = (unsigned*)((char*)ring->sq_ring + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)((char*)ring->sq_ring + p.sq_off.ring_mask);
+    ring->sq_flags = (unsigned*)((char*)ring->sq_ring + p.sq_off.flags);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_local = *ring->sq_tail;
+    ring->cq_head = (unsigned*)((char*)ring->cq_ring + p.cq_off.head);
+    ring->cq_tail = (unsigned*)((char*)ring->cq_ring + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)((char*)ring->cq_ring + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ring + p.cq_off.cqes);
+
+    // sqe slot i always sits at array index i, so the indirection array never changes after this
+    sq_array = (unsigned*)((char*)ring->sq_ring + p.sq_off.array);
+    for (i = 0; i < p.sq_entries; ++i)
+        sq_array[i] = i;
+
+    ring->ops = calloc(p.cq_entries, sizeof(*ring->ops));
+    ring->nslots = p.sq_entries;
+    ring->slots = malloc(ring->nslots * sizeof(int));
+    if (!ring->ops || !ring->slots)
+        goto fail;
+    for (i = 0; i < p.cq_entries; ++i) {
+        ring->ops[i].next = ring->free_ops;
+        ring->free_ops = &ring->ops[i];
+    }
+
+    // a sparse fixed file table, filled in by ring_fix_*
+    for (i = 0; i < ring->nslots; ++i)
+        ring->slots[i] = -1;
+    if (ring_register(ring->fd, IORING_REGISTER_FILES, ring->slots, ring->nslots) < 0)
+        goto fail;
+
+    return ring;
+
+fail:
+    ring_unmap(ring);
+    close(ring->fd);
+    free(ring->ops);
+    free(ring->slots);
+    free(ring);
+    return NULL;
+}
+
+// Gives the ring's buffers back to their pool and drops the buffer ring itself
+static void ring_release_buffers(struct SockRing *ring)
+{
+    unsigned i;
+
+    for (i = 0; i < ring->nprovided; ++i)
+        sock_buf_put(ring->bufpool, ring->bufpool->arena + ring->provided[i] * ring->bufpool->stride);
+    if (ring->br)
+        munmap(ring->br, ring->br_sz);
+    free(ring->provided);
+}
+
+int ring_free(struct SockRing *ring)
+{
+    int status;
+    if (!ring)
+        return -EINVAL;
+    ring_unmap(ring);
+    status = close(ring->fd) < 0 ? sockErr() : 0;
+    ring_release_buffers(ring);
+    free(ring->ops);
+    free(ring->slots);
+    free(ring->slot_of_fd);
+    free(ring);
+    return status;
+}
+
+// Grabs the next free sqe plus an op to track it, pointing the sqe at the fixed file slot if fd has one
+static struct io_uring_sqe* ring_sqe(struct SockRing *ring, sock_t fd, struct RingOp **op, void *udata)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+
+    if (ring->sq_local - head >= ring->sq_entries || !ring->free_ops)
+        return NULL;
+
+    *op = ring->free_ops;
+    ring->free_ops = (*op)->next;
+    memset(*op, 0, sizeof(**op));
+    (*op)->udata = udata;
+
+    sqe = &ring->sqes[ring->sq_local & *ring->sq_mask];
+    ring->sq_local++;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (unsigned long long)(uintptr_t)*op;
+
+    if (fd >= 0 && (size_t)fd < ring->fdcap && ring->slot_of_fd[fd] >= 0) {
+        sqe->fd = ring->slot_of_fd[fd];
+        sqe->flags |= IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = fd;
+    }
+    return sqe;
+}
+
+int ring_tcp_send(struct SockRing *ring, struct TCPSocket *sock, void *msgbuf, size_t buflen, size_t flags, void *udata)
+{
+    struct RingOp *op;
+    struct io_uring_sqe *sqe = ring_sqe(ring, sock->fd, &op, udata);
+    if (!sqe)
+        return SOCK_ERR_WOULDBLOCK;
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->addr = (unsigned long long)(uintptr_t)msgbuf;
+    sqe->len = (unsigned)buflen;
+    sqe->msg_flags = ring_send_flags(sock->flags, flags);
+    return 0;
+}
+
+int ring_tcp_recv(struct SockRing *ring, struct TCPSocket *sock, void *msgbuf, size_t buflen, size_t flags, void *udata)
+{
+    struct RingOp *op;
+    struct io_uring_sqe *sqe = ring_sqe(ring, sock->fd, &op, udata);
+    if (!sqe)
+        return SOCK_ERR_WOULDBLOCK;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->addr = (unsigned long long)(uintptr_t)msgbuf;
+    sqe->len = (unsigned)buflen;
+    sqe->msg_flags = ring_recv_flags(flags);
+    return 0;
+}
+
+int ring_tcp_accept(struct SockRing *ring, struct TCPSocket *sock, struct TCPSocket *client, struct AddrInfo *clientInfo,
+                    size_t flags, void *udata)
+{
+    struct RingOp *op;
+    struct io_uring_sqe *sqe = ring_sqe(ring, sock->fd, &op, udata);
+    if (!sqe)
+        return SOCK_ERR_WOULDBLOCK;
+
+    op->client = client;
+    op->flags = flags;
+    op->sockflags = sock->flags & (SOCK_F_INET6 | SOCK_F_UNIX);
+    op->info = clientInfo;
+    op->addrlen = sizeof(clientInfo->addr);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    if (clientInfo) {
+        sockNameClear(&clientInfo->addr);
+        sqe->addr = (unsigned long long)(uintptr_t)&clientInfo->addr;
+        sqe->addr2 = (unsigned long long)(uintptr_t)&op->addrlen;
+    }
+    sqe->accept_flags = SOCK_CLOEXEC | ((flags & TCP_ACCEPT_NONBLOCK) ? SOCK_NONBLOCK : 0);
+    return 0;
+}
+
+int ring_udp_send(struct SockRing *ring, struct UDPSocket *sock, struct AddrInfo *destInfo, void *msgbuf, size_t msglen,
+                  size_t flags, void *udata)
+{
+    struct RingOp *op;
+    struct io_uring_sqe *sqe = ring_sqe(ring, sock->fd, &op, udata);
+    if (!sqe)
+        return SOCK_ERR_WOULDBLOCK;
+
+    op->iov.iov_base = msgbuf;
+    op->iov.iov_len = msglen;
+    if (destInfo)
+        op->msg.msg_name = sockName(sock->flags, &destInfo->addr, &op->name, &op->msg.msg_namelen);
+    op->msg.msg_iov = &op->iov;
+    op->msg.msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (unsigned long long)(uintptr_t)&op->msg;
+    sqe->len = 1;
+    sqe->msg_flags = (flags & UDP_SEND_DONTROUTE) ? MSG_DONTROUTE : 0;
+    if (sock->flags & SOCK_F_ZEROCOPY)
+        sqe->msg_flags |= MSG_ZEROCOPY;
+    return 0;
+}
+
+int ring_udp_recv(struct SockRing *ring, struct UDPSocket *sock, void *msgbuf, size_t buflen, size_t flags,
+                  struct AddrInfo *out, void *udata)
+{
+    struct RingOp *op;
+    struct io_uring_sqe *sqe = ring_sqe(ring, sock->fd, &op, udata);
+    if (!sqe)
+        return SOCK_ERR_WOULDBLOCK;
+
+    op->iov.iov_base = msgbuf;
+    op->iov.iov_len = buflen;
+    if (out) {
+        op->info = out;
+        op->msg.msg_name = &out->addr;
+        op->msg.msg_namelen = sizeof(out->addr);
+        sockNameClear(&out->addr);
+    }
+    op->msg.msg_iov = &op->iov;
+    op->msg.msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->addr = (unsigned long long)(uintptr_t)&op->msg;
+    sqe->len = 1;
+    sqe->msg_flags = (flags & UDP_RECV_PEEK) ? MSG_PEEK : 0;
+    return 0;
+}
+
+int ring_register_buffers(struct SockRing *ring, struct SockBuf *bufs, size_t nbufs)
+{
+    struct iovec *iovs = malloc(nbufs * sizeof(*iovs));
+    size_t i;
+    int rc;
+
+    if (!iovs)
+        return -ENOMEM;
+    for (i = 0; i < nbufs; ++i) {
+        iovs[i].iov_base = bufs[i].buf;
+        iovs[i].iov_len = bufs[i].len;
+    }
+
+    // a second registration has to drop the first one explicitly
+    ring_register(ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    rc = ring_register(ring->fd, IORING_REGISTER_BUFFERS, iovs, (unsigned)nbufs) < 0 ? sockErr() : 0;
+    free(iovs);
+    return rc;
+}
+
+// Queues buffer id for the kernel to pick; bufs[0] shares its tail half with the ring's tail index, so only
+// addr, len and bid are written
+static void ring_buf_add(struct SockRing *ring, unsigned short bid)
+{
+    struct io_uring_buf *b = &ring->br->bufs[ring->br_tail & ring->br_mask];
+
+    b->addr = (unsigned long long)(uintptr_t)(ring->bufpool->arena + bid * ring->bufpool->stride);
+    b->len = (unsigned)ring->bufpool->size;
+    b->bid = bid;
+    ring->br_tail++;
+    __atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+}
+
+int ring_provide_buffers(struct SockRing *ring, struct SockBufPool *pool, unsigned count)
+{
+    struct io_uring_buf_reg reg;
+    unsigned entries = 1;
+    void *buf;
+
+    if (!pool || count == 0 || count > 32768 || pool->count > 65536 || pool->size > UINT32_MAX || ring->br)
+        return -EINVAL;
+    while (entries < count)
+        entries *= 2;
+
+    ring->br_sz = entries * sizeof(struct io_uring_buf);
+    ring->br = mmap(NULL, ring->br_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->provided = malloc(count * sizeof(*ring->provided));
+    if (ring->br == MAP_FAILED || !ring->provided) {
+        if (ring->br != MAP_FAILED)
+            munmap(ring->br, ring->br_sz);
+        ring->br = NULL;
+        free(ring->provided);
+        ring->provided = NULL;
+        return -ENOMEM;
+    }
+    ring->br_mask = (unsigned short)(entries - 1);
+    ring->br_tail = 0;
+    ring->bufpool = pool;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(uintptr_t)ring->br;
+    reg.ring_entries = entries;
+    reg.bgid = 0;
+    if (ring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int rc = sockErr();
+        ring_release_buffers(ring);
+        ring->br = NULL;
+        ring->provided = NULL;
+        return rc;
+    }
+
+    while (ring->nprovided < count && (buf = sock_buf_get(pool))) {
+        unsigned short bid = (unsigned short)sockBufIndex(pool, buf);
+        ring->provided[ring->nprovided++] = bid;
+        ring_buf_add(ring, bid);
+    }
+    if (ring->nprovided < count) {
+        ring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        ring_release_buffers(ring);
+        ring->br = NULL;
+        ring->provided = NULL;
+        ring->nprovided = 0;
+        return -ENOBUFS;
+    }
+    return 0;
+}
+
+int ring_buf_put(struct SockRing *ring, void *buf)
+{
+    long index;
+
+    if (!ring->br || (index = sockBufIndex(ring->bufpool, buf)) < 0)
+        return -EINVAL;
+    ring_buf_add(ring, (unsigned short)index);
+    return 0;
+}
+
+int ring_tcp_recv_pooled(struct SockRing *ring, struct TCPSocket *sock, size_t flags, void *udata)
+{
+    struct RingOp *op;
+    struct io_uring_sqe *sqe;
+
+    if (!ring->br)
+        return -EINVAL;
+    if (!(sqe = ring_sqe(ring, sock->fd, &op, udata)))
+        return SOCK_ERR_WOULDBLOCK;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->len = (unsigned)ring->bufpool->size;
+    sqe->msg_flags = ring_recv_flags(flags);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    return 0;
+}
+
+int ring_udp_recv_pooled(struct SockRing *ring, struct UDPSocket *sock, size_t flags, struct AddrInfo *out,
+                         void *udata)
+{
+    struct RingOp *op;
+    struct io_uring_sqe *sqe;
+
+    if (!ring->br)
+        return -EINVAL;
+    if (!(sqe = ring_sqe(ring, sock->fd, &op, udata)))
+        return SOCK_ERR_WOULDBLOCK;
+
+    // with buffer select the kernel swaps the selected buffer in for the single iovec
+    op->iov.iov_len = ring->bufpool->size;
+    if (out) {
+        op->info = out;
+        op->msg.msg_name = &out->addr;
+        op->msg.msg_namelen = sizeof(out->addr);
+        sockNameClear(&out->addr);
+    }
+    op->msg.msg_iov = &op->iov;
+    op->msg.msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->addr = (unsigned long long)(uintptr_t)&op->msg;
+    sqe->len = 1;
+    sqe->msg_flags = (flags & UDP_RECV_PEEK) ? MSG_PEEK : 0;
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    return 0;
+}
+
+// Sockets aren't seekable, so READ/WRITE_FIXED with offset 0 behave like recv/send into registered memory
+static int ring_rw_fixed(struct SockRing *ring, sock_t fd, unsigned char opcode, void *msgbuf, size_t buflen,
+                         unsigned bufindex, void *udata)
+{
+    struct RingOp *op;
+    struct io_uring_sqe *sqe = ring_sqe(ring, fd, &op, udata);
+    if (!sqe)
+        return SOCK_ERR_WOULDBLOCK;
+
+    sqe->opcode = opcode;
+    sqe->addr = (unsigned long long)(uintptr_t)msgbuf;
+    sqe->len = (unsigned)buflen;
+    sqe->buf_index = (unsigned short)bufindex;
+    return 0;
+}
+
+int ring_tcp_send_fixed(struct SockRing *ring, struct TCPSocket *sock, void *msgbuf, size_t buflen, unsigned bufindex,
+                        void *udata)
+{
+    return ring_rw_fixed(ring, sock->fd, IORING_OP_WRITE_FIXED, msgbuf, buflen, bufindex, udata);
+}
+
+int ring_tcp_recv_fixed(struct SockRing *ring, struct TCPSocket *sock, void *msgbuf, size_t buflen, unsigned bufindex,
+                        void *udata)
+{
+    return ring_rw_fixed(ring, sock->fd, IORING_OP_READ_FIXED, msgbuf, buflen, bufindex, udata);
+}
+
+static int ring_update_slot(struct SockRing *ring, unsigned slot, int fd)
+{
+    struct io_uring_files_update up;
+
+    memset(&up, 0, sizeof(up));
+    up.offset = slot;
+    up.fds = (unsigned long long)(uintptr_t)&fd;
+    if (ring_register(ring->fd, IORING_REGISTER_FILES_UPDATE, &up, 1) < 0)
+        return sockErr();
+    ring->slots[slot] = fd;
+    return 0;
+}
+
+static int ring_fix(struct SockRing *ring, sock_t fd)
+{
+    unsigned slot;
+    int rc;
+
+    if ((size_t)fd >= ring->fdcap) {
+        size_t cap = ring->fdcap ? ring->fdcap : 64, i;
+        int *map;
+        while (cap <= (size_t)fd)
+            cap *= 2;
+        map = realloc(ring->slot_of_fd, cap * sizeof(int));
+        if (!map)
+            return -ENOMEM;
+        for (i = ring->fdcap; i < cap; ++i)
+            map[i] = -1;
+        ring->slot_of_fd = map;
+        ring->fdcap = cap;
+    }
+    if (ring->slot_of_fd[fd] >= 0)
+        return 0;
+
+    for (slot = 0; slot < ring->nslots && ring->slots[slot] >= 0; ++slot)
+        ;
+    if (slot == ring->nslots)
+        return -ENFILE;
+
+    if ((rc = ring_update_slot(ring, slot, fd)) < 0)
+        return rc;
+    ring->slot_of_fd[fd] = (int)slot;
+    return 0;
+}
+
+static int ring_unfix(struct SockRing *ring, sock_t fd)
+{
+    int slot, rc;
+
+    if ((size_t)fd >= ring->fdcap || (slot = ring->slot_of_fd[fd]) < 0)
+        return -EINVAL;
+    if ((rc = ring_update_slot(ring, (unsigned)slot, -1)) < 0)
+        return rc;
+    ring->slot_of_fd[fd] = -1;
+    return 0;
+}
+
+int ring_fix_tcp(struct SockRing *ring, struct TCPSocket *sock)
+{
+    return ring_fix(ring, sock->fd);
+}
+
+int ring_fix_udp(struct SockRing *ring, struct UDPSocket *sock)
+{
+    return ring_fix(ring, sock->fd);
+}
+
+int ring_unfix_tcp(struct SockRing *ring, struct TCPSocket *sock)
+{
+    return ring_unfix(ring, sock->fd);
+}
+
+int ring_unfix_udp(struct SockRing *ring, struct UDPSocket *sock)
+{
+    return ring_unfix(ring, sock->fd);
+}
+
+// Publishes the prepared sqes and, unless the sqpoll thread is awake to pick them up, enters the kernel
+static int ring_flush(struct SockRing *ring, unsigned min_complete)
+{
+    unsigned published = ring->sq_local - *ring->sq_tail;
+    unsigned to_submit = published;
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    int rc;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_local, __ATOMIC_RELEASE);
+
+    if (ring->setup_flags & IORING_SETUP_SQPOLL) {
+        // full barrier: the tail store must be visible before the flags are read, or a poll thread going
+        // to sleep can be missed while it still hasn't seen the new sqes (liburing's io_uring_smp_mb)
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        else if (!min_complete)
+            return (int)published;
+        to_submit = 0;
+    } else if (!to_submit && !min_complete) {
+        return 0;
+    }
+
+    do {
+        rc = ring_enter(ring->fd, to_submit, min_complete, flags);
+    } while (rc < 0 && errno == EINTR && !min_complete);
+
+    if (rc < 0)
+        return errno == EINTR ? 0 : sockErr();
+    return (ring->setup_flags & IORING_SETUP_SQPOLL) ? (int)published : rc;
+}
+
+int ring_submit(struct SockRing *ring)
+{
+    return ring_flush(ring, 0);
+}
+
+static int ring_reap(struct SockRing *ring, struct SockCompletion *out, size_t n)
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    size_t found = 0;
+
+    while (head != tail && found < n) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        struct RingOp *op = (struct RingOp*)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+
+        // an accepted connection lands in the client handle, like tcp_accept
+        if (op->client && res >= 0) {
+            if (op->client->fd != SOCK_INVALID)
+                sockClose(op->client->fd);
+            op->client->fd = res;
+            SOCK_STATS_INIT(op->client);
+            op->client->flags = ((op->flags & TCP_ACCEPT_NONBLOCK) ? SOCK_F_NONBLOCK : 0) | op->sockflags |
+                                (op->client->flags & SOCK_F_EXTERNAL);
+            res = 0;
+        }
+        if (op->info && res >= 0)
+            sockUnmap(&op->info->addr);
+
+        // a pooled receive that brought no data hands its buffer straight back
+        out[found].buf = NULL;
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            if (res > 0)
+                out[found].buf = ring->bufpool->arena + bid * ring->bufpool->stride;
+            else
+                ring_buf_add(ring, bid);
+        }
+
+        out[found].udata = op->udata;
+        out[found].result = res < 0 ? sockCode(-res) : res;
+        found++;
+
+        op->next = ring->free_ops;
+        ring->free_ops = op;
+        head++;
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return (int)found;
+}
+
+int ring_wait(struct SockRing *ring, struct SockCompletion *out, size_t n, int timeout_ms)
+{
+    int rc, found;
+
+    if ((rc = ring_flush(ring, 0)) < 0)
+        return rc;
+    if ((found = ring_reap(ring, out, n)) > 0 || timeout_ms == 0)
+        return found;
+
+    // the ring fd polls readable once completions are posted, which gives us a timeout on any kernel version
+    if (timeout_ms > 0) {
+        struct pollfd pfd;
+        pfd.fd = ring->fd;
+        pfd.events = POLLIN;
+        rc = poll(&pfd, 1, timeout_ms);
+        if (rc < 0)
+            return errno == EINTR ? 0 : sockErr();
+    } else if ((rc = ring_flush(ring, 1)) < 0) {
+        return rc;
+    }
+
+    return ring_reap(ring, out, n);
+}
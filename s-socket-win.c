@@ -0,0 +1,1951 @@
+// Windows backend for the S-Socket C API, see s-socket.h for documentation
+// ------------------------------------------------------------------------------
+
+#include "s-socket.h"
+#include "networking.h"
+
+#include <mswsock.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// ---------------------
+// ---- Library API ----
+// ---------------------
+
+// Every socket and resolver call holds a winsock reference, WSAStartup runs for the first and WSACleanup for the last
+static volatile long wsa_refs;
+static sock_mutex wsa_lock = SOCK_MUTEX_INIT;
+
+int sockInit(void)
+{
+    WSADATA wsa_data;
+    long n;
+    int rc = 0;
+
+    // winsock is already up, just count another user
+    while ((n = wsa_refs) > 0)
+        if (sockAtomicCas(&wsa_refs, n, n + 1))
+            return 0;
+
+    sockLock(&wsa_lock);
+    if (wsa_refs > 0 || (rc = WSAStartup(MAKEWORD(2,2), &wsa_data)) == 0)
+        sockAtomicAdd(&wsa_refs, 1);
+    sockUnlock(&wsa_lock);
+    return rc;
+}
+
+int sockQuit(void)
+{
+    long n;
+    int rc = 0;
+
+    // other users remain, winsock stays up
+    while ((n = wsa_refs) > 1)
+        if (sockAtomicCas(&wsa_refs, n, n - 1))
+            return 0;
+
+    sockLock(&wsa_lock);
+    if (sockAtomicAdd(&wsa_refs, -1) == 1)
+        rc = WSACleanup();
+    sockUnlock(&wsa_lock);
+    return rc;
+}
+
+int sock_startup()
+{
+    int rc = sockInit();
+    return rc == 0 ? 0 : -rc;
+}
+
+int sock_cleanup()
+{
+    return sockQuit() == 0 ? 0 : sockErr();
+}
+
+// None of the optional features exist on windows yet; USO/URO would be probed here once supported
+int sock_supports(int feature)
+{
+    (void)feature;
+    return 0;
+}
+
+
+// ---------------------
+// ---- Address API ----
+// ---------------------
+
+struct AddrInfo* mkaddrinfo()
+{
+    return calloc(1, sizeof(struct AddrInfo));
+}
+
+void addrinfo_free(struct AddrInfo *info)
+{
+    free(info);
+}
+
+int addrinfo_count(struct AddrInfo *info)
+{
+    return info ? (int)info->count : -WSAEINVAL;
+}
+
+int addrinfo_select(struct AddrInfo *info, size_t index)
+{
+    if (!info || index >= info->count)
+        return -WSAEINVAL;
+    info->addr = info->list[index];
+    return 0;
+}
+
+char* gethost(struct AddrInfo *in)
+{
+    const void *ip;
+
+    if (!in)
+        return NULL;
+    if (in->addr.ss_family == AF_UNIX)
+        return ((struct sockaddr_un*)&in->addr)->sun_path;
+    ip = in->addr.ss_family == AF_INET6 ? (const void*)&((struct sockaddr_in6*)&in->addr)->sin6_addr
+                                        : (const void*)&((struct sockaddr_in*)&in->addr)->sin_addr;
+    if (!inet_ntop(in->addr.ss_family, ip, in->host, sizeof(in->host)))
+        return NULL;
+    return in->host;
+}
+
+int getport(struct AddrInfo *in)
+{
+    if (!in)
+        return -WSAEINVAL;
+    if (in->addr.ss_family == AF_UNIX)
+        return 0;
+    if (in->addr.ss_family == AF_INET6)
+        return ntohs(((struct sockaddr_in6*)&in->addr)->sin6_port);
+    return ntohs(((struct sockaddr_in*)&in->addr)->sin_port);
+}
+
+
+// -----------------
+// ---- UDP API ----
+// -----------------
+
+// copies up to SOCK_IOV_MAX SockBufs into WSABUFs, returning how many were used
+static DWORD sock_wsabufs(WSABUF *wsabufs, struct SockBuf *bufs, size_t nbufs)
+{
+    size_t i;
+    if (nbufs > SOCK_IOV_MAX)
+        nbufs = SOCK_IOV_MAX;
+    for (i = 0; i < nbufs; ++i) {
+        wsabufs[i].buf = bufs[i].buf;
+        wsabufs[i].len = (ULONG)bufs[i].len;
+    }
+    return (DWORD)nbufs;
+}
+
+// Option helpers shared by udp_mod_sock/tcp_mod_sock and their getters; winsock takes BOOL and DWORD
+// values, both int sized, and timeouts as DWORD milliseconds
+static int opt_set(SOCKET fd, int level, int name, int value)
+{
+    return setsockopt(fd, level, name, (char*)&value, sizeof(value)) == SOCKET_ERROR ? sockErr() : 0;
+}
+
+static int opt_get(SOCKET fd, int level, int name, int *value)
+{
+    int len = sizeof(*value);
+    *value = 0;
+    return getsockopt(fd, level, name, (char*)value, &len) == SOCKET_ERROR ? sockErr() : 0;
+}
+
+static int opt_get_bool(SOCKET fd, int level, int name, int *value)
+{
+    int rc = opt_get(fd, level, name, value);
+    *value = *value != 0;
+    return rc;
+}
+
+// Dual stack sockets carry ipv4 traffic too, so options that exist once per family are set at both levels
+static int opt_set_dual(SOCKET fd, unsigned flags, int name6, int name4, int value)
+{
+    int rc;
+    if ((flags & SOCK_F_INET6) && (rc = opt_set(fd, IPPROTO_IPV6, name6, value)) < 0)
+        return rc;
+    return opt_set(fd, IPPROTO_IP, name4, value);
+}
+
+static int opt_get_dual(SOCKET fd, unsigned flags, int name6, int name4, int *value)
+{
+    return (flags & SOCK_F_INET6) ? opt_get(fd, IPPROTO_IPV6, name6, value) : opt_get(fd, IPPROTO_IP, name4, value);
+}
+
+static int udp_send_flags(size_t flags)
+{
+    int sysflags = 0;
+    if (flags & UDP_SEND_DONTROUTE) sysflags |= MSG_DONTROUTE;
+    return sysflags;
+}
+
+static int udp_recv_flags(size_t flags)
+{
+    int sysflags = 0;
+    if (flags & UDP_RECV_PEEK) sysflags |= MSG_PEEK;
+    return sysflags;
+}
+
+// Builds a handle in place around a fresh socket
+static struct UDPSocket* udp_setup(struct UDPSocket *sock, unsigned flags)
+{
+    // every socket holds a winsock reference, released again in udp_free
+    if (sockInit() != 0)
+        return NULL;
+    sock->flags = flags;
+    sock->refs = SOCK_REF_ONE;
+    sock->pool = NULL;
+    SOCK_STATS_INIT(sock);
+    sock->fd = sockOpen(SOCK_DGRAM, &sock->flags);
+    if (sock->fd == SOCK_INVALID) {
+        sockQuit();
+        return NULL;
+    }
+    return sock;
+}
+
+struct UDPSocket* udp_mksocket()
+{
+    struct UDPSocket *sock = malloc(sizeof(*sock));
+    if (!sock)
+        return NULL;
+
+    if (!udp_setup(sock, 0)) {
+        free(sock);
+        return NULL;
+    }
+    return sock;
+}
+
+struct UDPSocket* udp_mksocket_in(void *storage)
+{
+    return storage ? udp_setup(storage, SOCK_F_EXTERNAL) : NULL;
+}
+
+// Closes the socket and releases the handle once its last reference is gone
+static int udp_destroy(struct UDPSocket *sock)
+{
+    int status = sockClose(sock->fd) == SOCKET_ERROR ? sockErr() : 0;
+    sockQuit();
+    sockRelease(sock, sock->pool, sock->flags);
+    return status;
+}
+
+// Data calls run between udp_enter and udp_leave so a concurrent udp_free can't close the socket under them
+static void udp_leave(struct UDPSocket *sock)
+{
+    if (sockLeave(&sock->refs))
+        udp_destroy(sock);
+}
+
+static int udp_enter(struct UDPSocket *sock)
+{
+    if (sockEnter(&sock->refs))
+        return 1;
+    udp_leave(sock);
+    return 0;
+}
+
+int udp_send(struct UDPSocket *sock,
+                struct AddrInfo *destInfo,
+                void *msgbuf,
+                size_t msglen,
+                size_t flags)
+{
+    struct sockaddr_in6 tmp;
+    socklen_t len = 0;
+    // a sock_pair_dgram end has its peer already, it takes no destination
+    struct sockaddr *name = destInfo ? sockName(sock->flags, &destInfo->addr, &tmp, &len) : NULL;
+    int sent;
+
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    sent = sendto(sock->fd, msgbuf, (int)msglen, udp_send_flags(flags), name, len);
+    if (sent == SOCKET_ERROR)
+        sent = sockErr();
+    SOCK_STAT_SEND(sock, 0, sent);
+    udp_leave(sock);
+    return sent;
+}
+
+static int udp_send_batch_held(struct UDPSocket *sock,
+                        struct UDPMsg *msgs,
+                        size_t n,
+                        size_t flags)
+{
+    size_t done;
+
+    // no sendmmsg on windows, one sendto per datagram with the same stop-at-first-failure contract
+    for (done = 0; done < n; ++done) {
+        int sent = udp_send(sock, msgs[done].addr, msgs[done].msgbuf, msgs[done].buflen, flags);
+        msgs[done].result = sent;
+        if (sent < 0)
+            return done > 0 ? (int)done : sent;
+    }
+
+    return (int)done;
+}
+
+int udp_send_batch(struct UDPSocket *sock,
+                   struct UDPMsg *msgs,
+                   size_t n,
+                   size_t flags)
+{
+    int rc;
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = udp_send_batch_held(sock, msgs, n, flags);
+    udp_leave(sock);
+    return rc;
+}
+
+int udp_sendv(struct UDPSocket *sock,
+              struct AddrInfo *destInfo,
+              struct SockBuf *bufs,
+              size_t nbufs,
+              size_t flags)
+{
+    WSABUF wsabufs[SOCK_IOV_MAX];
+    struct sockaddr_in6 tmp;
+    struct sockaddr *name;
+    socklen_t len = 0;
+    DWORD sent = 0;
+    DWORD count;
+    int rc;
+
+    // a datagram can't be split across calls, so refuse rather than truncate it
+    if (nbufs > SOCK_IOV_MAX)
+        return -WSAEINVAL;
+
+    count = sock_wsabufs(wsabufs, bufs, nbufs);
+    name = destInfo ? sockName(sock->flags, &destInfo->addr, &tmp, &len) : NULL;
+
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    if (WSASendTo(sock->fd, wsabufs, count, &sent, (DWORD)udp_send_flags(flags), name, len, NULL, NULL) == SOCKET_ERROR)
+        rc = sockErr();
+    else
+        rc = (int)sent;
+    SOCK_STAT_SEND(sock, 0, rc);
+    udp_leave(sock);
+    return rc;
+}
+
+int udp_bind(struct UDPSocket *sock,
+             struct AddrInfo *hostInfo)
+{
+    struct sockaddr_in6 tmp;
+    socklen_t len;
+    struct sockaddr *name;
+    int rc = sockFamily(&sock->fd, SOCK_DGRAM, &sock->flags, &hostInfo->addr);
+
+    if (rc != 0)
+        return rc;
+    name = sockName(sock->flags, &hostInfo->addr, &tmp, &len);
+    if (bind(sock->fd, name, len) == SOCKET_ERROR)
+        return sockErr();
+    return 0;
+}
+
+int udp_recv(struct UDPSocket *sock,
+             void *msgbuf,
+             size_t buflen,
+             size_t flags,
+             struct AddrInfo *out)
+{
+    int addrlen = sizeof(out->addr);
+    int got;
+
+    if (out)
+        sockNameClear(&out->addr);
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    got = recvfrom(sock->fd, msgbuf, (int)buflen, udp_recv_flags(flags),
+                   out ? (struct sockaddr*)&out->addr : NULL, out ? &addrlen : NULL);
+    if (got == SOCKET_ERROR) {
+        // winsock reports truncated datagrams as an error, linux just returns the truncated length
+        got = WSAGetLastError() == WSAEMSGSIZE ? (int)buflen : sockErr();
+    }
+    SOCK_STAT_RECV(sock, 0, got);
+    udp_leave(sock);
+
+    if (got >= 0 && out)
+        sockUnmap(&out->addr);
+    return got;
+}
+
+// winsock has no receive timestamps yet, the stamps come back empty as documented for unrecorded fields
+int udp_recv_ts(struct UDPSocket *sock,
+                void *msgbuf,
+                size_t buflen,
+                size_t flags,
+                struct AddrInfo *out,
+                struct SockTimestamp *stamp)
+{
+    if (!stamp)
+        return -WSAEINVAL;
+    memset(stamp, 0, sizeof(*stamp));
+    return udp_recv(sock, msgbuf, buflen, flags, out);
+}
+
+static int udp_recv_batch_held(struct UDPSocket *sock,
+                        struct UDPMsg *msgs,
+                        size_t n,
+                        size_t flags)
+{
+    size_t done = 0;
+
+    // no recvmmsg on windows: block for the first datagram, then keep reading while more are queued
+    while (done < n) {
+        int got;
+
+        if (done > 0) {
+            u_long avail = 0;
+            if (ioctlsocket(sock->fd, FIONREAD, &avail) == SOCKET_ERROR || avail == 0)
+                break;
+        }
+
+        got = udp_recv(sock, msgs[done].msgbuf, msgs[done].buflen, flags, msgs[done].addr);
+        if (got < 0) {
+            if (done > 0)
+                break;
+            return got;
+        }
+        if (msgs[done].stamp)
+            memset(msgs[done].stamp, 0, sizeof(*msgs[done].stamp));
+        msgs[done++].result = got;
+    }
+
+    return (int)done;
+}
+
+int udp_recv_batch(struct UDPSocket *sock,
+                   struct UDPMsg *msgs,
+                   size_t n,
+                   size_t flags)
+{
+    int rc;
+    if (!udp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = udp_recv_batch_held(sock, msgs, n, flags);
+    udp_leave(sock);
+    return rc;
+}
+
+// no segmentation offload, so every datagram is its own send
+int udp_send_segmented(struct UDPSocket *sock,
+                       struct AddrInfo *destInfo,
+                       void *msgbuf,
+                       size_t msglen,
+                       size_t segsize,
+                       size_t flags)
+{
+    size_t done = 0;
+
+    if (!sock || !destInfo || segsize == 0 || segsize > 0xffff || msglen > sockUdpPayloadMax(&destInfo->addr) ||
+        (msglen + segsize - 1) / segsize > SOCK_GSO_SEGMENTS_MAX)
+        return -WSAEINVAL;
+
+    do {
+        size_t len = msglen - done < segsize ? msglen - done : segsize;
+        int sent = udp_send(sock, destInfo, (char*)msgbuf + done, len, flags);
+        if (sent < 0)
+            return done > 0 ? (int)done : sent;
+        done += len;
+    } while (done < msglen);
+    return (int)done;
+}
+
+// without receive coalescing every call returns a single datagram
+int udp_recv_segmented(struct UDPSocket *sock,
+                       void *msgbuf,
+                       size_t buflen,
+                       size_t flags,
+                       struct AddrInfo *out,
+                       size_t *segsize)
+{
+    int got;
+
+    if (!sock || !segsize)
+        return -WSAEINVAL;
+    got = udp_recv(sock, msgbuf, buflen, flags, out);
+    if (got >= 0)
+        *segsize = (size_t)got;
+    return got;
+}
+
+int udp_zerocopy_reap(struct UDPSocket *sock, struct SockZeroCopy *done, size_t n)
+{
+    (void)sock; (void)done; (void)n;
+    return SOCK_ERR_UNSUPPORTED;
+}
+
+int udp_free(struct UDPSocket* sock)
+{
+    if (!sock)
+        return -WSAEINVAL;
+    if (!sockClosing(&sock->refs))
+        return SOCK_ERR_CLOSED;
+
+    // calls still running in other threads are woken up and the last one out closes the socket
+    if (sock->refs != (SOCK_REF_ONE | SOCK_REF_CLOSING))
+        shutdown(sock->fd, SD_BOTH);
+    return sockLeave(&sock->refs) ? udp_destroy(sock) : 0;
+}
+
+int udp_mod_sock(struct UDPSocket *sock, int mod, int mod_value)
+{
+    int rc;
+
+    switch (mod) {
+    case UDP_MOD_BROADCAST: {
+        BOOL value = mod_value != 0;
+        if (setsockopt(sock->fd, SOL_SOCKET, SO_BROADCAST, (char*)&value, sizeof(value)) == SOCKET_ERROR)
+            return sockErr();
+        return 0;
+    }
+    case UDP_MOD_REUSEADDR: {
+        // note that windows SO_REUSEADDR also lets another socket take over an address that is in active use
+        BOOL value = mod_value != 0;
+        if (setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, (char*)&value, sizeof(value)) == SOCKET_ERROR)
+            return sockErr();
+        return 0;
+    }
+    case UDP_MOD_REUSEPORT:
+        return SOCK_ERR_UNSUPPORTED;
+    case UDP_MOD_ZEROCOPY:
+        return SOCK_ERR_UNSUPPORTED;
+    case UDP_MOD_V6ONLY: {
+        DWORD value = mod_value != 0;
+        if (!(sock->flags & SOCK_F_INET6))
+            return SOCK_ERR_UNSUPPORTED;
+        if (setsockopt(sock->fd, IPPROTO_IPV6, IPV6_V6ONLY, (char*)&value, sizeof(value)) == SOCKET_ERROR)
+            return sockErr();
+        return 0;
+    }
+    case UDP_MOD_NONBLOCK:
+        if ((rc = sockNonblock(sock->fd, mod_value)) == 0)
+            sock->flags = mod_value ? (sock->flags | SOCK_F_NONBLOCK) : (sock->flags & ~SOCK_F_NONBLOCK);
+        return rc;
+    case UDP_MOD_RCVTIMEO: return opt_set(sock->fd, SOL_SOCKET, SO_RCVTIMEO, mod_value);
+    case UDP_MOD_SNDTIMEO: return opt_set(sock->fd, SOL_SOCKET, SO_SNDTIMEO, mod_value);
+    case UDP_MOD_SNDBUF:   return opt_set(sock->fd, SOL_SOCKET, SO_SNDBUF, mod_value);
+    case UDP_MOD_RCVBUF:   return opt_set(sock->fd, SOL_SOCKET, SO_RCVBUF, mod_value);
+    case UDP_MOD_BUSY_POLL:
+    case UDP_MOD_TOS:
+    case UDP_MOD_PRIORITY:
+    case UDP_MOD_INCOMING_CPU:
+    case UDP_MOD_GRO:
+    case UDP_MOD_TIMESTAMP:
+        // IP_TOS is accepted but ignored by winsock, DSCP marking goes through the qWAVE API instead
+        return SOCK_ERR_UNSUPPORTED;
+    case UDP_MOD_MULTICAST_LOOP:
+        return opt_set_dual(sock->fd, sock->flags, IPV6_MULTICAST_LOOP, IP_MULTICAST_LOOP, mod_value != 0);
+    case UDP_MOD_MULTICAST_TTL:
+        return opt_set_dual(sock->fd, sock->flags, IPV6_MULTICAST_HOPS, IP_MULTICAST_TTL, mod_value);
+    case UDP_MOD_MULTICAST_IF:
+        // an IP_MULTICAST_IF value of the form 0.0.0.x, in network order, is an interface index
+        if ((sock->flags & SOCK_F_INET6) && (rc = opt_set(sock->fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, mod_value)) < 0)
+            return rc;
+        return opt_set(sock->fd, IPPROTO_IP, IP_MULTICAST_IF, (int)htonl((u_long)mod_value));
+    default:
+        return -WSAEINVAL;
+    }
+}
+
+int udp_get_sock(struct UDPSocket *sock, int mod, int *mod_value)
+{
+    if (!sock || !mod_value)
+        return -WSAEINVAL;
+
+    switch (mod) {
+    case UDP_MOD_BROADCAST: return opt_get_bool(sock->fd, SOL_SOCKET, SO_BROADCAST, mod_value);
+    case UDP_MOD_REUSEADDR: return opt_get_bool(sock->fd, SOL_SOCKET, SO_REUSEADDR, mod_value);
+    case UDP_MOD_V6ONLY:
+        if (!(sock->flags & SOCK_F_INET6))
+            return SOCK_ERR_UNSUPPORTED;
+        return opt_get_bool(sock->fd, IPPROTO_IPV6, IPV6_V6ONLY, mod_value);
+    case UDP_MOD_NONBLOCK:
+        *mod_value = (sock->flags & SOCK_F_NONBLOCK) != 0;
+        return 0;
+    case UDP_MOD_RCVTIMEO:  return opt_get(sock->fd, SOL_SOCKET, SO_RCVTIMEO, mod_value);
+    case UDP_MOD_SNDTIMEO:  return opt_get(sock->fd, SOL_SOCKET, SO_SNDTIMEO, mod_value);
+    case UDP_MOD_SNDBUF:    return opt_get(sock->fd, SOL_SOCKET, SO_SNDBUF, mod_value);
+    case UDP_MOD_RCVBUF:    return opt_get(sock->fd, SOL_SOCKET, SO_RCVBUF, mod_value);
+    case UDP_MOD_REUSEPORT:
+    case UDP_MOD_ZEROCOPY:
+    case UDP_MOD_BUSY_POLL:
+    case UDP_MOD_TOS:
+    case UDP_MOD_PRIORITY:
+    case UDP_MOD_INCOMING_CPU:
+    case UDP_MOD_GRO:
+    case UDP_MOD_TIMESTAMP:
+        return SOCK_ERR_UNSUPPORTED;
+    case UDP_MOD_MULTICAST_LOOP:
+        return opt_get_dual(sock->fd, sock->flags, IPV6_MULTICAST_LOOP, IP_MULTICAST_LOOP, mod_value);
+    case UDP_MOD_MULTICAST_TTL:
+        return opt_get_dual(sock->fd, sock->flags, IPV6_MULTICAST_HOPS, IP_MULTICAST_TTL, mod_value);
+    case UDP_MOD_MULTICAST_IF:
+        if (!(sock->flags & SOCK_F_INET6))
+            return SOCK_ERR_UNSUPPORTED;
+        return opt_get(sock->fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, mod_value);
+    default:
+        return -WSAEINVAL;
+    }
+}
+
+// Joins or leaves with the protocol independent requests (RFC 3678, Vista and up), which take either family.
+// An ipv4 group on a dual stack socket is joined at the IPPROTO_IP level, like on an ipv4 socket
+static int udp_membership(struct UDPSocket *sock, struct AddrInfo *group, struct AddrInfo *source,
+                          unsigned ifindex, int join)
+{
+    int level, rc;
+
+    if (!sock || !group || (source && source->addr.ss_family != group->addr.ss_family))
+        return -WSAEINVAL;
+    level = group->addr.ss_family == AF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP;
+
+    if (source) {
+        GROUP_SOURCE_REQ req;
+        memset(&req, 0, sizeof(req));
+        req.gsr_interface = ifindex;
+        memcpy(&req.gsr_group, &group->addr, sizeof(req.gsr_group));
+        memcpy(&req.gsr_source, &source->addr, sizeof(req.gsr_source));
+        rc = setsockopt(sock->fd, level, join ? MCAST_JOIN_SOURCE_GROUP : MCAST_LEAVE_SOURCE_GROUP,
+                        (char*)&req, sizeof(req));
+    } else {
+        GROUP_REQ req;
+        memset(&req, 0, sizeof(req));
+        req.gr_interface = ifindex;
+        memcpy(&req.gr_group, &group->addr, sizeof(req.gr_group));
+        rc = setsockopt(sock->fd, level, join ? MCAST_JOIN_GROUP : MCAST_LEAVE_GROUP, (char*)&req, sizeof(req));
+    }
+    return rc == SOCKET_ERROR ? sockErr() : 0;
+}
+
+int udp_join_group(struct UDPSocket *sock,
+                   struct AddrInfo *group,
+                   struct AddrInfo *source,
+                   unsigned ifindex)
+{
+    return udp_membership(sock, group, source, ifindex, 1);
+}
+
+int udp_leave_group(struct UDPSocket *sock,
+                    struct AddrInfo *group,
+                    struct AddrInfo *source,
+                    unsigned ifindex)
+{
+    return udp_membership(sock, group, source, ifindex, 0);
+}
+
+
+// -----------------
+// ---- TCP API ----
+// -----------------
+
+static int tcp_send_flags(size_t flags)
+{
+    int sysflags = 0;
+    if (flags & TCP_SEND_DONTROUTE) sysflags |= MSG_DONTROUTE;
+    if (flags & TCP_SEND_OOB)       sysflags |= MSG_OOB;
+    return sysflags;
+}
+
+static int tcp_recv_flags(size_t flags)
+{
+    int sysflags = 0;
+    if (flags & TCP_RECV_PEEK)    sysflags |= MSG_PEEK;
+    if (flags & TCP_RECV_OOB)     sysflags |= MSG_OOB;
+    if (flags & TCP_RECV_WAITALL) sysflags |= MSG_WAITALL;
+    return sysflags;
+}
+
+// Builds a handle in place, around a fresh socket if open is set
+static struct TCPSocket* tcp_setup(struct TCPSocket *sock, unsigned flags, int open)
+{
+    // every handle holds a winsock reference, released again in tcp_free
+    if (sockInit() != 0)
+        return NULL;
+    sock->flags = flags;
+    sock->refs = SOCK_REF_ONE;
+    sock->pool = NULL;
+    SOCK_STATS_INIT(sock);
+    sock->fd = open ? sockOpen(SOCK_STREAM, &sock->flags) : SOCK_INVALID;
+    if (open && sock->fd == SOCK_INVALID) {
+        sockQuit();
+        return NULL;
+    }
+    return sock;
+}
+
+struct TCPSocket* tcp_mksocket()
+{
+    struct TCPSocket *sock = malloc(sizeof(*sock));
+    if (!sock)
+        return NULL;
+
+    if (!tcp_setup(sock, 0, 1)) {
+        free(sock);
+        return NULL;
+    }
+    return sock;
+}
+
+struct TCPSocket* tcp_mksocket_in(void *storage)
+{
+    return storage ? tcp_setup(storage, SOCK_F_EXTERNAL, 1) : NULL;
+}
+
+struct TCPSocket* tcp_mkhandle_in(void *storage)
+{
+    return storage ? tcp_setup(storage, SOCK_F_EXTERNAL, 0) : NULL;
+}
+
+// Closes the socket and releases the handle once its last reference is gone
+static int tcp_destroy(struct TCPSocket *sock)
+{
+    // handles from tcp_mkhandle_in may never have been given a connection
+    int status = sock->fd != SOCK_INVALID && sockClose(sock->fd) == SOCKET_ERROR ? sockErr() : 0;
+    sockQuit();
+    sockRelease(sock, sock->pool, sock->flags);
+    return status;
+}
+
+// Data calls run between tcp_enter and tcp_leave so a concurrent tcp_free can't close the socket under them
+static void tcp_leave(struct TCPSocket *sock)
+{
+    if (sockLeave(&sock->refs))
+        tcp_destroy(sock);
+}
+
+static int tcp_enter(struct TCPSocket *sock)
+{
+    if (sockEnter(&sock->refs))
+        return 1;
+    tcp_leave(sock);
+    return 0;
+}
+
+int tcp_bind(struct TCPSocket *sock,
+                struct AddrInfo *hostInfo)
+{
+    struct sockaddr_in6 tmp;
+    socklen_t len;
+    struct sockaddr *name;
+    int rc = sockFamily(&sock->fd, SOCK_STREAM, &sock->flags, &hostInfo->addr);
+
+    if (rc != 0)
+        return rc;
+    name = sockName(sock->flags, &hostInfo->addr, &tmp, &len);
+    if (bind(sock->fd, name, len) == SOCKET_ERROR)
+        return sockErr();
+    return 0;
+}
+
+int tcp_listen(struct TCPSocket *sock,
+               int backlog)
+{
+    if (listen(sock->fd, backlog) == SOCKET_ERROR)
+        return sockErr();
+    return 0;
+}
+
+// Hands a connected socket to a handle, dropping whatever socket it held
+static void tcp_adopt(struct TCPSocket *sock, sock_t fd, unsigned flags)
+{
+    if (sock->fd != SOCK_INVALID)
+        sockClose(sock->fd);
+    sock->fd = fd;
+    SOCK_STATS_INIT(sock);
+    sock->flags = flags | (sock->flags & SOCK_F_EXTERNAL);
+}
+
+static int tcp_accept_held(struct TCPSocket *sock,
+                           struct TCPSocket *client,
+                           struct AddrInfo *clientInfo,
+                           size_t flags)
+{
+    int addrlen = sizeof(clientInfo->addr);
+    int nonblock = (flags & TCP_ACCEPT_NONBLOCK) != 0;
+    sock_t fd;
+
+    if (clientInfo)
+        sockNameClear(&clientInfo->addr);
+    fd = accept(sock->fd, clientInfo ? (struct sockaddr*)&clientInfo->addr : NULL, clientInfo ? &addrlen : NULL);
+    if (fd == SOCK_INVALID)
+        return sockErr();
+    if (clientInfo)
+        sockUnmap(&clientInfo->addr);
+
+    // accepted sockets inherit the listener's blocking mode on windows, only switch when asked for the other one
+    if (nonblock != ((sock->flags & SOCK_F_NONBLOCK) != 0)) {
+        int rc = sockNonblock(fd, nonblock);
+        if (rc < 0) {
+            sockClose(fd);
+            return rc;
+        }
+    }
+
+    // the client handle takes over the accepted connection
+    tcp_adopt(client, fd, (nonblock ? SOCK_F_NONBLOCK : 0) | (sock->flags & (SOCK_F_INET6 | SOCK_F_UNIX)));
+    return 0;
+}
+
+int tcp_accept(struct TCPSocket *sock,
+               struct TCPSocket *client,
+               struct AddrInfo *clientInfo,
+               size_t flags)
+{
+    int rc;
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = tcp_accept_held(sock, client, clientInfo, flags);
+    tcp_leave(sock);
+    return rc;
+}
+
+static int tcp_accept_batch_held(struct TCPSocket *sock,
+                                 struct TCPSocket **clients,
+                                 struct AddrInfo **clientInfo,
+                                 size_t n,
+                                 size_t flags)
+{
+    size_t done;
+
+    for (done = 0; done < n; ++done) {
+        int rc;
+
+        // a blocking listener would wait for the next connection, so only keep going while one is queued
+        if (done > 0 && !(sock->flags & SOCK_F_NONBLOCK)) {
+            WSAPOLLFD pfd;
+            pfd.fd = sock->fd;
+            pfd.events = POLLRDNORM;
+            pfd.revents = 0;
+            if (WSAPoll(&pfd, 1, 0) <= 0)
+                break;
+        }
+
+        rc = tcp_accept_held(sock, clients[done], clientInfo ? clientInfo[done] : NULL, flags);
+        if (rc < 0)
+            return done > 0 ? (int)done : rc;
+    }
+
+    return (int)done;
+}
+
+int tcp_accept_batch(struct TCPSocket *sock,
+                     struct TCPSocket **clients,
+                     struct AddrInfo **clientInfo,
+                     size_t n,
+                     size_t flags)
+{
+    int rc;
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = tcp_accept_batch_held(sock, clients, clientInfo, n, flags);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_connect(struct TCPSocket *sock,
+                struct AddrInfo *dest)
+{
+    struct sockaddr_in6 tmp;
+    socklen_t len;
+    struct sockaddr *name;
+    int rc;
+
+    if ((rc = sockFamily(&sock->fd, SOCK_STREAM, &sock->flags, &dest->addr)) != 0)
+        return rc;
+    name = sockName(sock->flags, &dest->addr, &tmp, &len);
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    if (connect(sock->fd, name, len) == SOCKET_ERROR)
+        rc = WSAGetLastError() == WSAEWOULDBLOCK ? SOCK_ERR_INPROGRESS : sockErr();
+    tcp_leave(sock);
+    return rc;
+}
+
+static int tcp_connect_finish_held(struct TCPSocket *sock)
+{
+    struct sockaddr_storage peer;
+    int len = sizeof(int);
+    int err = 0;
+
+    if (getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, (char*)&err, &len) == SOCKET_ERROR)
+        return sockErr();
+    if (err != 0)
+        return -err;
+
+    // no pending error but no peer either means the handshake hasn't finished
+    len = sizeof(peer);
+    if (getpeername(sock->fd, (struct sockaddr*)&peer, &len) == SOCKET_ERROR)
+        return WSAGetLastError() == WSAENOTCONN ? SOCK_ERR_INPROGRESS : sockErr();
+    return 0;
+}
+
+int tcp_connect_finish(struct TCPSocket *sock)
+{
+    int rc;
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = tcp_connect_finish_held(sock);
+    tcp_leave(sock);
+    return rc;
+}
+
+// Starts a non-blocking connect on fd, returning 1 if it completed at once, 0 if in progress
+static int connect_start(SOCKET fd, unsigned sockflags, struct sockaddr_storage *addr)
+{
+    struct sockaddr_in6 tmp;
+    socklen_t len;
+    struct sockaddr *name = sockName(sockflags, addr, &tmp, &len);
+
+    if (sockNonblock(fd, 1) != 0)
+        return sockErr();
+    if (connect(fd, name, len) == 0)
+        return 1;
+    return WSAGetLastError() == WSAEWOULDBLOCK ? 0 : sockErr();
+}
+
+int tcp_connect_fastest(struct TCPSocket *sock,
+                        struct AddrInfo *dest,
+                        int stagger_ms,
+                        int timeout_ms)
+{
+    SOCKET fds[SOCK_ADDR_MAX];
+    int slot[SOCK_ADDR_MAX]; // candidate index of each pending socket
+    struct sockaddr_storage *cands = dest->count ? dest->list : &dest->addr;
+    unsigned ncand = dest->count ? dest->count : 1;
+    unsigned long long now = sockNowMs(), next = now;
+    unsigned long long deadline = timeout_ms < 0 ? ~0ULL : now + timeout_ms;
+    unsigned started = 0;
+    int npending = 0, winner = -1, err = -WSAETIMEDOUT, i;
+
+    if (stagger_ms < 0)
+        stagger_ms = 0;
+    if ((err = sockFamily(&sock->fd, SOCK_STREAM, &sock->flags, &cands[0])) != 0)
+        return err;
+    err = -WSAETIMEDOUT;
+
+    while (winner < 0) {
+        fd_set wr, ex;
+        struct timeval tv;
+        unsigned long long until;
+        int rc;
+
+        // Start the next candidate once its turn comes, or straight away if nothing is pending
+        if (started < ncand && (now >= next || npending == 0)) {
+            unsigned fdflags = sock->flags;
+            SOCKET fd = started == 0 ? sock->fd : sockOpen(SOCK_STREAM, &fdflags);
+            rc = fd == SOCK_INVALID ? sockErr() : connect_start(fd, fdflags, &cands[started]);
+            if (rc == 1) {
+                winner = npending;
+                fds[npending] = fd;
+                slot[npending++] = started++;
+                break;
+            }
+            ++started;
+            if (rc == 0) {
+                fds[npending] = fd;
+                slot[npending++] = started - 1;
+                next = now + stagger_ms;
+            } else {
+                // a candidate that fails at once hands its turn straight to the next one
+                err = rc;
+                if (fd != SOCK_INVALID && fd != sock->fd)
+                    closesocket(fd);
+                next = now;
+            }
+            continue;
+        }
+
+        if (npending == 0)
+            break;
+        if (now >= deadline) {
+            err = -WSAETIMEDOUT;
+            break;
+        }
+
+        // select rather than WSAPoll, which misses failed connects on older Windows releases
+        FD_ZERO(&wr);
+        FD_ZERO(&ex);
+        for (i = 0; i < npending; ++i) {
+            FD_SET(fds[i], &wr);
+            FD_SET(fds[i], &ex);
+        }
+        until = deadline;
+        if (started < ncand && next < until)
+            until = next;
+        until = until - now > 1000000 ? 1000000 : until - now;
+        tv.tv_sec = (long)(until / 1000);
+        tv.tv_usec = (long)(until % 1000) * 1000;
+        rc = select(0, NULL, &wr, &ex, &tv);
+        if (rc == SOCKET_ERROR) {
+            err = sockErr();
+            break;
+        }
+        for (i = 0; rc > 0 && i < npending; ++i) {
+            int soerr = 0, len = sizeof(soerr);
+            if (FD_ISSET(fds[i], &wr)) {
+                winner = i;
+                break;
+            }
+            if (!FD_ISSET(fds[i], &ex))
+                continue;
+            // Failed attempts drop out of the set and the next candidate starts without waiting its stagger
+            getsockopt(fds[i], SOL_SOCKET, SO_ERROR, (char*)&soerr, &len);
+            err = soerr ? -soerr : -WSAECONNREFUSED;
+            next = now;
+            if (fds[i] != sock->fd)
+                closesocket(fds[i]);
+            fds[i] = fds[--npending];
+            slot[i] = slot[npending];
+            --i;
+        }
+        now = sockNowMs();
+    }
+
+    for (i = 0; i < npending; ++i)
+        if (i != winner && fds[i] != sock->fd)
+            closesocket(fds[i]);
+    if (winner < 0) {
+        sockNonblock(sock->fd, sock->flags & SOCK_F_NONBLOCK);
+        return err;
+    }
+
+    if (fds[winner] != sock->fd) {
+        closesocket(sock->fd);
+        sock->fd = fds[winner];
+    }
+    addrinfo_select(dest, slot[winner]);
+    return sockNonblock(sock->fd, sock->flags & SOCK_F_NONBLOCK);
+}
+
+int tcp_send(struct TCPSocket *sock,
+                void *msgbuf,
+                size_t buflen,
+                size_t flags)
+{
+    int sent;
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    sent = send(sock->fd, msgbuf, (int)buflen, tcp_send_flags(flags));
+    if (sent == SOCKET_ERROR)
+        sent = sockErr();
+    SOCK_STAT_SEND(sock, buflen, sent);
+    tcp_leave(sock);
+    return sent;
+}
+
+int tcp_sendv(struct TCPSocket *sock,
+              struct SockBuf *bufs,
+              size_t nbufs,
+              size_t flags)
+{
+    WSABUF wsabufs[SOCK_IOV_MAX];
+    DWORD sent = 0;
+    DWORD count = sock_wsabufs(wsabufs, bufs, nbufs);
+    int rc;
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    if (WSASend(sock->fd, wsabufs, count, &sent, (DWORD)tcp_send_flags(flags), NULL, NULL) == SOCKET_ERROR)
+        rc = sockErr();
+    else
+        rc = (int)sent;
+    SOCK_STAT_SEND(sock, sockBufsLen(bufs, nbufs), rc);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_recv(struct TCPSocket *sock,
+                void *msgbuf,
+                size_t buflen,
+                size_t flags)
+{
+    int got;
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    got = recv(sock->fd, msgbuf, (int)buflen, tcp_recv_flags(flags));
+    if (got == SOCKET_ERROR)
+        got = sockErr();
+    SOCK_STAT_RECV(sock, buflen, got);
+    tcp_leave(sock);
+    return got;
+}
+
+int tcp_recvv(struct TCPSocket *sock,
+              struct SockBuf *bufs,
+              size_t nbufs,
+              size_t flags)
+{
+    WSABUF wsabufs[SOCK_IOV_MAX];
+    DWORD got = 0;
+    DWORD sysflags = (DWORD)tcp_recv_flags(flags);
+    DWORD count = sock_wsabufs(wsabufs, bufs, nbufs);
+    int rc;
+
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    if (WSARecv(sock->fd, wsabufs, count, &got, &sysflags, NULL, NULL) == SOCKET_ERROR)
+        rc = sockErr();
+    else
+        rc = (int)got;
+    SOCK_STAT_RECV(sock, sockBufsLen(bufs, nbufs), rc);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_recv_ts(struct TCPSocket *sock,
+                void *msgbuf,
+                size_t buflen,
+                size_t flags,
+                struct SockTimestamp *stamp)
+{
+    if (!stamp)
+        return -WSAEINVAL;
+    memset(stamp, 0, sizeof(*stamp));
+    return tcp_recv(sock, msgbuf, buflen, flags);
+}
+
+// Waits for an overlapped file or socket operation started on ov, returning the bytes transferred
+static long long overlapped_wait(HANDLE handle, OVERLAPPED *ov, int is_socket)
+{
+    DWORD bytes = 0, flags = 0;
+    BOOL ok = is_socket ? WSAGetOverlappedResult((SOCKET)handle, (WSAOVERLAPPED*)ov, &bytes, TRUE, &flags)
+                        : GetOverlappedResult(handle, ov, &bytes, TRUE);
+    if (!ok)
+        return is_socket ? sockErr() : -(long long)GetLastError();
+    return bytes;
+}
+
+// Handles TransmitFile refuses get read at the requested offset and sent with plain send calls
+static long long sendfile_copy(struct TCPSocket *sock, HANDLE file, long long offset, size_t count)
+{
+    char buf[16384];
+    long long total = 0;
+
+    while ((size_t)total < count) {
+        DWORD want = (DWORD)(count - total < sizeof(buf) ? count - total : sizeof(buf));
+        DWORD got = 0;
+        OVERLAPPED ov;
+        int sent;
+
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = (DWORD)((offset + total) & 0xffffffff);
+        ov.OffsetHigh = (DWORD)((offset + total) >> 32);
+        if (!ReadFile(file, buf, want, &got, &ov)) {
+            DWORD err = GetLastError();
+            long long done;
+            if (err == ERROR_HANDLE_EOF)
+                break;
+            if (err != ERROR_IO_PENDING || (done = overlapped_wait(file, &ov, 0)) < 0)
+                return total > 0 ? total : -(long long)err;
+            got = (DWORD)done;
+        }
+        if (got == 0)
+            break;
+
+        sent = send(sock->fd, buf, (int)got, 0);
+        if (sent == SOCKET_ERROR)
+            return total > 0 ? total : sockErr();
+        total += sent;
+        if ((DWORD)sent < got)
+            break;
+    }
+    return total;
+}
+
+static long long tcp_sendfile_held(struct TCPSocket *sock,
+                                   sock_file_t file,
+                                   long long offset,
+                                   size_t count)
+{
+    long long total = 0;
+
+    while ((size_t)total < count) {
+        // TransmitFile sends at most 2^31 - 2 bytes per call
+        DWORD chunk = (DWORD)(count - total < 0x7ffffffe ? count - total : 0x7ffffffe);
+        OVERLAPPED ov;
+        long long sent;
+
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = (DWORD)((offset + total) & 0xffffffff);
+        ov.OffsetHigh = (DWORD)((offset + total) >> 32);
+        ov.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+        if (!ov.hEvent)
+            return total > 0 ? total : -(long long)GetLastError();
+
+        if (TransmitFile(sock->fd, file, chunk, 0, &ov, NULL, 0))
+            sent = overlapped_wait((HANDLE)sock->fd, &ov, 1);
+        else if (WSAGetLastError() == WSA_IO_PENDING)
+            sent = overlapped_wait((HANDLE)sock->fd, &ov, 1);
+        else
+            sent = sockErr();
+        CloseHandle(ov.hEvent);
+
+        if (sent < 0) {
+            if (total == 0 && (sent == -WSAEINVAL || sent == -WSAEOPNOTSUPP))
+                return sendfile_copy(sock, file, offset, count);
+            return total > 0 ? total : sent;
+        }
+        if (sent == 0)
+            break;
+        total += sent;
+    }
+    return total;
+}
+
+long long tcp_sendfile(struct TCPSocket *sock,
+                       sock_file_t file,
+                       long long offset,
+                       size_t count)
+{
+    long long rc;
+    if (!tcp_enter(sock))
+        return SOCK_ERR_CLOSED;
+    rc = tcp_sendfile_held(sock, file, offset, count);
+    SOCK_STAT_SEND(sock, count, rc);
+    tcp_leave(sock);
+    return rc;
+}
+
+int tcp_zerocopy_reap(struct TCPSocket *sock, struct SockZeroCopy *done, size_t n)
+{
+    (void)sock; (void)done; (void)n;
+    return SOCK_ERR_UNSUPPORTED;
+}
+
+int tcp_free(struct TCPSocket* sock)
+{
+    if (!sock)
+        return -WSAEINVAL;
+    if (!sockClosing(&sock->refs))
+        return SOCK_ERR_CLOSED;
+
+    // calls still running in other threads are woken up and the last one out closes the socket
+    if (sock->refs != (SOCK_REF_ONE | SOCK_REF_CLOSING) && sock->fd != SOCK_INVALID)
+        shutdown(sock->fd, SD_BOTH);
+    return sockLeave(&sock->refs) ? tcp_destroy(sock) : 0;
+}
+
+int tcp_mod_sock(struct TCPSocket *sock, int mod, int mod_value)
+{
+    int rc;
+
+    switch (mod) {
+    case TCP_MOD_KEEPALIVE: {
+        BOOL value = mod_value != 0;
+        rc = setsockopt(sock->fd, SOL_SOCKET, SO_KEEPALIVE, (char*)&value, sizeof(value));
+        break;
+    }
+    case TCP_MOD_DONTROUTE: {
+        BOOL value = mod_value != 0;
+        rc = setsockopt(sock->fd, SOL_SOCKET, SO_DONTROUTE, (char*)&value, sizeof(value));
+        break;
+    }
+    case TCP_MOD_RCVTIMEO: {
+        DWORD timeout = (DWORD)mod_value;
+        rc = setsockopt(sock->fd, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
+        break;
+    }
+    case TCP_MOD_REUSEADDR: {
+        // note that windows SO_REUSEADDR also lets another socket take over an address that is in active use
+        BOOL value = mod_value != 0;
+        rc = setsockopt(sock->fd, SOL_SOCKET, SO_REUSEADDR, (char*)&value, sizeof(value));
+        break;
+    }
+    case TCP_MOD_REUSEPORT:
+        return SOCK_ERR_UNSUPPORTED;
+    case TCP_MOD_ZEROCOPY:
+        return SOCK_ERR_UNSUPPORTED;
+    case TCP_MOD_V6ONLY: {
+        DWORD value = mod_value != 0;
+        if (!(sock->flags & SOCK_F_INET6))
+            return SOCK_ERR_UNSUPPORTED;
+        rc = setsockopt(sock->fd, IPPROTO_IPV6, IPV6_V6ONLY, (char*)&value, sizeof(value));
+        break;
+    }
+    case TCP_MOD_NODELAY: {
+        BOOL value = mod_value != 0;
+        rc = setsockopt(sock->fd, IPPROTO_TCP, TCP_NODELAY, (char*)&value, sizeof(value));
+        break;
+    }
+    case TCP_MOD_CORK:
+        return SOCK_ERR_UNSUPPORTED;
+    case TCP_MOD_NONBLOCK:
+        if ((rc = sockNonblock(sock->fd, mod_value)) == 0)
+            sock->flags = mod_value ? (sock->flags | SOCK_F_NONBLOCK) : (sock->flags & ~SOCK_F_NONBLOCK);
+        return rc;
+    case TCP_MOD_SNDTIMEO: return opt_set(sock->fd, SOL_SOCKET, SO_SNDTIMEO, mod_value);
+    case TCP_MOD_SNDBUF:   return opt_set(sock->fd, SOL_SOCKET, SO_SNDBUF, mod_value);
+    case TCP_MOD_RCVBUF:   return opt_set(sock->fd, SOL_SOCKET, SO_RCVBUF, mod_value);
+    case TCP_MOD_QUICKACK:
+    case TCP_MOD_BUSY_POLL:
+    case TCP_MOD_FASTOPEN:
+    case TCP_MOD_FASTOPEN_CONNECT:
+    case TCP_MOD_TOS:
+    case TCP_MOD_PRIORITY:
+    case TCP_MOD_INCOMING_CPU:
+    case TCP_MOD_TIMESTAMP:
+        // windows fast open only works through ConnectEx, and IP_TOS is accepted but ignored
+        return SOCK_ERR_UNSUPPORTED;
+    default:
+        return -WSAEINVAL;
+    }
+
+    return rc == SOCKET_ERROR ? sockErr() : 0;
+}
+
+int tcp_get_sock(struct TCPSocket *sock, int mod, int *mod_value)
+{
+    if (!sock || !mod_value)
+        return -WSAEINVAL;
+
+    switch (mod) {
+    case TCP_MOD_KEEPALIVE: return opt_get_bool(sock->fd, SOL_SOCKET, SO_KEEPALIVE, mod_value);
+    case TCP_MOD_DONTROUTE: return opt_get_bool(sock->fd, SOL_SOCKET, SO_DONTROUTE, mod_value);
+    case TCP_MOD_RCVTIMEO:  return opt_get(sock->fd, SOL_SOCKET, SO_RCVTIMEO, mod_value);
+    case TCP_MOD_REUSEADDR: return opt_get_bool(sock->fd, SOL_SOCKET, SO_REUSEADDR, mod_value);
+    case TCP_MOD_V6ONLY:
+        if (!(sock->flags & SOCK_F_INET6))
+            return SOCK_ERR_UNSUPPORTED;
+        return opt_get_bool(sock->fd, IPPROTO_IPV6, IPV6_V6ONLY, mod_value);
+    case TCP_MOD_NONBLOCK:
+        *mod_value = (sock->flags & SOCK_F_NONBLOCK) != 0;
+        return 0;
+    case TCP_MOD_NODELAY:   return opt_get_bool(sock->fd, IPPROTO_TCP, TCP_NODELAY, mod_value);
+    case TCP_MOD_SNDTIMEO:  return opt_get(sock->fd, SOL_SOCKET, SO_SNDTIMEO, mod_value);
+    case TCP_MOD_SNDBUF:    return opt_get(sock->fd, SOL_SOCKET, SO_SNDBUF, mod_value);
+    case TCP_MOD_RCVBUF:    return opt_get(sock->fd, SOL_SOCKET, SO_RCVBUF, mod_value);
+    case TCP_MOD_REUSEPORT:
+    case TCP_MOD_ZEROCOPY:
+    case TCP_MOD_CORK:
+    case TCP_MOD_QUICKACK:
+    case TCP_MOD_BUSY_POLL:
+    case TCP_MOD_FASTOPEN:
+    case TCP_MOD_FASTOPEN_CONNECT:
+    case TCP_MOD_TOS:
+    case TCP_MOD_PRIORITY:
+    case TCP_MOD_INCOMING_CPU:
+    case TCP_MOD_TIMESTAMP:
+        return SOCK_ERR_UNSUPPORTED;
+    default:
+        return -WSAEINVAL;
+    }
+}
+
+// SIO_TCP_INFO (windows 10 1703) sits behind a newer NTDDI_VERSION than we build for, so the ioctl and its
+// version 0 layout are declared here; older systems fail the ioctl
+#define SOCK_SIO_TCP_INFO _WSAIORW(IOC_VENDOR, 39)
+
+struct tcp_info_v0 {
+    int State;
+    ULONG Mss;
+    ULONG64 ConnectionTimeMs;
+    BOOLEAN TimestampsEnabled;
+    ULONG RttUs;
+    ULONG MinRttUs;
+    ULONG BytesInFlight;
+    ULONG Cwnd;
+    ULONG SndWnd;
+    ULONG RcvWnd;
+    ULONG RcvBuf;
+    ULONG64 BytesOut;
+    ULONG64 BytesIn;
+    ULONG BytesReordered;
+    ULONG BytesRetrans;
+    ULONG FastRetrans;
+    ULONG DupAcksIn;
+    ULONG TimeoutEpisodes;
+    UCHAR SynRetrans;
+};
+
+int tcp_get_info(struct TCPSocket *sock, struct SockTcpInfo *out)
+{
+    struct tcp_info_v0 info;
+    DWORD version = 0, bytes = 0;
+
+    if (!sock || !out)
+        return -WSAEINVAL;
+    memset(&info, 0, sizeof(info));
+    if (WSAIoctl(sock->fd, SOCK_SIO_TCP_INFO, &version, sizeof(version), &info, sizeof(info), &bytes,
+                 NULL, NULL) == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        return err == WSAEOPNOTSUPP || err == WSAEINVAL ? SOCK_ERR_UNSUPPORTED : -err;
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->rtt_us = info.RttUs;
+    out->cwnd = info.Cwnd;
+    out->mss = info.Mss;
+    out->retransmits = info.Mss ? info.BytesRetrans / info.Mss : 0;
+    return 0;
+}
+
+
+// -------------------------
+// ---- TLS Offload API ----
+// -------------------------
+
+// Windows has no kernel TLS record layer for plain sockets, encryption stays with the handshake library
+int tcp_tls_install(struct TCPSocket *sock, struct SockTlsKeys *keys, size_t flags)
+{
+    (void)sock; (void)keys; (void)flags;
+    return SOCK_ERR_UNSUPPORTED;
+}
+
+int tcp_tls_recv_record(struct TCPSocket *sock, void *msgbuf, size_t buflen, size_t flags, int *type)
+{
+    (void)sock; (void)msgbuf; (void)buflen; (void)flags; (void)type;
+    return SOCK_ERR_UNSUPPORTED;
+}
+
+int tcp_tls_send_record(struct TCPSocket *sock, int type, void *msgbuf, size_t buflen)
+{
+    (void)sock; (void)type; (void)msgbuf; (void)buflen;
+    return SOCK_ERR_UNSUPPORTED;
+}
+
+
+// -------------------------
+// ---- Unix Socket API ----
+// -------------------------
+
+// Windows has no socketpair, so the pair meets on a socket file in the temp directory, gone again once connected
+int sock_pair(struct TCPSocket *a, struct TCPSocket *b)
+{
+    static volatile long pair_seq;
+    struct sockaddr_un addr;
+    char dir[MAX_PATH];
+    DWORD n = GetTempPathA(sizeof(dir), dir);
+    sock_t listener, client = INVALID_SOCKET, server = INVALID_SOCKET;
+    int rc = 0;
+
+    if (!a || !b || a == b)
+        return -WSAEINVAL;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (n == 0 || n >= sizeof(dir))
+        return -(int)GetLastError();
+    n = (DWORD)snprintf(addr.sun_path, sizeof(addr.sun_path), "%ss-socket-%lu-%ld.sock", dir,
+                        GetCurrentProcessId(), sockAtomicAdd(&pair_seq, 1));
+    if (n >= sizeof(addr.sun_path))
+        return -WSAENAMETOOLONG;
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET)
+        return sockErr();
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(listener, 1) == SOCKET_ERROR ||
+        (client = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET ||
+        connect(client, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        (server = accept(listener, NULL, NULL)) == INVALID_SOCKET)
+        rc = sockErr();
+    closesocket(listener);
+    DeleteFileA(addr.sun_path);
+
+    if (rc != 0) {
+        if (client != INVALID_SOCKET)
+            closesocket(client);
+        return rc;
+    }
+    tcp_adopt(a, client, SOCK_F_UNIX);
+    tcp_adopt(b, server, SOCK_F_UNIX);
+    return 0;
+}
+
+// Binds a loopback UDP socket to a free port, its address left in addr
+static sock_t pair_dgram_socket(struct sockaddr_in *addr)
+{
+    int len = sizeof(*addr);
+    sock_t s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (s == INVALID_SOCKET)
+        return INVALID_SOCKET;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s, (struct sockaddr*)addr, sizeof(*addr)) != 0 || getsockname(s, (struct sockaddr*)addr, &len) != 0) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+// No unix datagram sockets on windows, a pair of loopback UDP sockets connected to each other stands in
+int sock_pair_dgram(struct UDPSocket *a, struct UDPSocket *b)
+{
+    struct sockaddr_in addr_a, addr_b;
+    sock_t sa, sb;
+    int rc = 0;
+
+    if (!a || !b || a == b)
+        return -WSAEINVAL;
+    if ((sa = pair_dgram_socket(&addr_a)) == INVALID_SOCKET)
+        return sockErr();
+    if ((sb = pair_dgram_socket(&addr_b)) == INVALID_SOCKET) {
+        rc = sockErr();
+        closesocket(sa);
+        return rc;
+    }
+    if (connect(sa, (struct sockaddr*)&addr_b, sizeof(addr_b)) != 0 ||
+        connect(sb, (struct sockaddr*)&addr_a, sizeof(addr_a)) != 0) {
+        rc = sockErr();
+        closesocket(sa);
+        closesocket(sb);
+        return rc;
+    }
+
+    sockClose(a->fd);
+    sockClose(b->fd);
+    a->fd = sa;
+    b->fd = sb;
+    a->flags = a->flags & SOCK_F_EXTERNAL;
+    b->flags = b->flags & SOCK_F_EXTERNAL;
+    return 0;
+}
+
+// Unix sockets on windows don't carry SCM_RIGHTS; WSADuplicateSocket needs the receiving process up front
+int tcp_send_fd(struct TCPSocket *sock,
+                sock_file_t file,
+                void *msgbuf,
+                size_t buflen)
+{
+    (void)sock; (void)file; (void)msgbuf; (void)buflen;
+    return SOCK_ERR_UNSUPPORTED;
+}
+
+int tcp_recv_fd(struct TCPSocket *sock,
+                void *msgbuf,
+                size_t buflen,
+                size_t flags,
+                sock_file_t *file)
+{
+    (void)sock; (void)msgbuf; (void)buflen; (void)flags; (void)file;
+    return SOCK_ERR_UNSUPPORTED;
+}
+
+int tcp_send_sock(struct TCPSocket *sock,
+                  struct TCPSocket *pass,
+                  void *msgbuf,
+                  size_t buflen)
+{
+    (void)sock; (void)pass; (void)msgbuf; (void)buflen;
+    return SOCK_ERR_UNSUPPORTED;
+}
+
+int tcp_recv_sock(struct TCPSocket *sock,
+                  struct TCPSocket *into,
+                  void *msgbuf,
+                  size_t buflen,
+                  size_t flags,
+                  int *passed)
+{
+    (void)sock; (void)into; (void)msgbuf; (void)buflen; (void)flags; (void)passed;
+    return SOCK_ERR_UNSUPPORTED;
+}
+
+
+// ----------------------
+// ---- Sharding API ----
+// ----------------------
+
+int sock_ncpu()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+// Affinity masks only reach the process's processor group, so placement covers its first 64 cpus
+#define CPU_MASK_BITS ((int)sizeof(DWORD_PTR) * 8)
+
+SOCK_INTERNAL int sock_cpu_for(int worker, int numa)
+{
+    DWORD_PTR allowed, system;
+    int order[64], n = 0, cpu;
+
+    // cpus outside the process affinity mask would fail to pin
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &allowed, &system) || !allowed)
+        return worker % sock_ncpu();
+
+    if (numa) {
+        ULONGLONG nodes[64];
+        ULONG highest, id;
+        int nnodes = 0, round, placed = 1;
+
+        if (GetNumaHighestNodeNumber(&highest)) {
+            for (id = 0; id <= highest && nnodes < 64; ++id) {
+                ULONGLONG mask;
+                if (GetNumaNodeProcessorMask((UCHAR)id, &mask) && (mask & allowed))
+                    nodes[nnodes++] = mask & allowed;
+            }
+        }
+        // the r-th allowed cpu of every node, then the r+1-th, ...
+        for (round = 0; nnodes > 1 && placed; ++round) {
+            placed = 0;
+            for (id = 0; id < (ULONG)nnodes; ++id) {
+                int seen = 0;
+                for (cpu = 0; cpu < CPU_MASK_BITS; ++cpu) {
+                    if ((nodes[id] >> cpu & 1) && seen++ == round) {
+                        order[n++] = cpu;
+                        placed = 1;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    if (n == 0) {
+        for (cpu = 0; cpu < CPU_MASK_BITS; ++cpu)
+            if (allowed >> cpu & 1)
+                order[n++] = cpu;
+    }
+    return order[worker % n];
+}
+
+SOCK_INTERNAL int sock_cpu_pin(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_MASK_BITS)
+        return -WSAEINVAL;
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) ? 0 : -(int)GetLastError();
+}
+
+// windows has no SO_REUSEPORT, so the only shard layout it supports is a single socket
+
+int tcp_mkshards(struct TCPSocket **socks,
+                 size_t n,
+                 struct AddrInfo *hostInfo,
+                 int backlog,
+                 size_t flags)
+{
+    int rc;
+
+    if (n > 1 || (flags & SOCK_SHARD_CPU))
+        return SOCK_ERR_UNSUPPORTED;
+    if (n == 0)
+        return 0;
+
+    socks[0] = tcp_mksocket();
+    if (!socks[0])
+        return -WSAENOBUFS;
+    if ((rc = tcp_bind(socks[0], hostInfo)) < 0 || (rc = tcp_listen(socks[0], backlog)) < 0) {
+        tcp_free(socks[0]);
+        socks[0] = NULL;
+    }
+    return rc;
+}
+
+int udp_mkshards(struct UDPSocket **socks,
+                 size_t n,
+                 struct AddrInfo *hostInfo,
+                 size_t flags)
+{
+    int rc;
+
+    if (n > 1 || (flags & SOCK_SHARD_CPU))
+        return SOCK_ERR_UNSUPPORTED;
+    if (n == 0)
+        return 0;
+
+    socks[0] = udp_mksocket();
+    if (!socks[0])
+        return -WSAENOBUFS;
+    if ((rc = udp_bind(socks[0], hostInfo)) < 0) {
+        udp_free(socks[0]);
+        socks[0] = NULL;
+    }
+    return rc;
+}
+
+
+// ------------------------
+// ---- Event Loop API ----
+// ------------------------
+
+// WSAPoll based loop: a pollfd array plus a parallel udata array, swap-removal keeps both dense.
+// The slot after the last socket is the wake socket's, filled in by every loop_wait.
+// Note that WSAPoll only reports failed connects from windows 10 2004 on.
+struct SockLoop {
+    WSAPOLLFD *fds;
+    void **udata;
+    size_t n, cap;
+    size_t next;    // where the next loop_wait starts scanning, so a short events array can't starve sockets
+    sock_t wake;            // udp socket connected to itself, WSAPoll only waits on sockets
+    volatile long woken;    // a wake is pending, later ones skip the send
+    struct SockWheel wheel;
+};
+
+static SHORT loop_pollevents(int events)
+{
+    SHORT pollevents = 0;
+    if (events & SOCK_EV_READ)  pollevents |= POLLRDNORM;
+    if (events & SOCK_EV_WRITE) pollevents |= POLLWRNORM;
+    return pollevents;
+}
+
+static int loop_find(struct SockLoop *loop, sock_t fd)
+{
+    size_t i;
+    for (i = 0; i < loop->n; ++i)
+        if (loop->fds[i].fd == fd)
+            return (int)i;
+    return -1;
+}
+
+static int loop_add(struct SockLoop *loop, sock_t fd, int events, void *udata)
+{
+    if (loop_find(loop, fd) >= 0)
+        return -WSAEINVAL;
+
+    if (loop->n + 1 == loop->cap) {
+        size_t cap = loop->cap ? loop->cap * 2 : 16;
+        WSAPOLLFD *fds = realloc(loop->fds, cap * sizeof(*fds));
+        void **udatas;
+        if (!fds)
+            return -WSAENOBUFS;
+        loop->fds = fds;
+        udatas = realloc(loop->udata, cap * sizeof(*udatas));
+        if (!udatas)
+            return -WSAENOBUFS;
+        loop->udata = udatas;
+        loop->cap = cap;
+    }
+
+    loop->fds[loop->n].fd = fd;
+    loop->fds[loop->n].events = loop_pollevents(events);
+    loop->fds[loop->n].revents = 0;
+    loop->udata[loop->n] = udata;
+    loop->n++;
+    return 0;
+}
+
+static int loop_mod(struct SockLoop *loop, sock_t fd, int events, void *udata)
+{
+    int i = loop_find(loop, fd);
+    if (i < 0)
+        return -WSAENOTSOCK;
+    loop->fds[i].events = loop_pollevents(events);
+    loop->udata[i] = udata;
+    return 0;
+}
+
+static int loop_del(struct SockLoop *loop, sock_t fd)
+{
+    int i = loop_find(loop, fd);
+    if (i < 0)
+        return -WSAENOTSOCK;
+    loop->n--;
+    loop->fds[i] = loop->fds[loop->n];
+    loop->udata[i] = loop->udata[loop->n];
+    return 0;
+}
+
+static sock_t loop_wake_socket(void)
+{
+    struct sockaddr_in addr;
+    int len = sizeof(addr);
+    u_long nonblock = 1;
+    sock_t s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (s == INVALID_SOCKET)
+        return INVALID_SOCKET;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(s, (struct sockaddr*)&addr, &len) != 0 ||
+        connect(s, (struct sockaddr*)&addr, len) != 0 ||
+        ioctlsocket(s, FIONBIO, &nonblock) != 0) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+struct SockLoop* loop_create()
+{
+    struct SockLoop *loop = calloc(1, sizeof(*loop));
+    if (!loop)
+        return NULL;
+
+    // the loop holds a winsock reference, released again in loop_free
+    if (sockInit() != 0) {
+        free(loop);
+        return NULL;
+    }
+    loop->cap = 16;
+    loop->fds = malloc(loop->cap * sizeof(*loop->fds));
+    loop->udata = malloc(loop->cap * sizeof(*loop->udata));
+    loop->wake = loop_wake_socket();
+    if (!loop->fds || !loop->udata || loop->wake == INVALID_SOCKET) {
+        if (loop->wake != INVALID_SOCKET)
+            closesocket(loop->wake);
+        free(loop->fds);
+        free(loop->udata);
+        free(loop);
+        sockQuit();
+        return NULL;
+    }
+    sock_wheel_init(&loop->wheel);
+    return loop;
+}
+
+int loop_add_tcp(struct SockLoop *loop, struct TCPSocket *sock, int events, void *udata)
+{
+    return loop_add(loop, sock->fd, events, udata);
+}
+
+int loop_add_udp(struct SockLoop *loop, struct UDPSocket *sock, int events, void *udata)
+{
+    return loop_add(loop, sock->fd, events, udata);
+}
+
+int loop_mod_tcp(struct SockLoop *loop, struct TCPSocket *sock, int events, void *udata)
+{
+    return loop_mod(loop, sock->fd, events, udata);
+}
+
+int loop_mod_udp(struct SockLoop *loop, struct UDPSocket *sock, int events, void *udata)
+{
+    return loop_mod(loop, sock->fd, events, udata);
+}
+
+int loop_del_tcp(struct SockLoop *loop, struct TCPSocket *sock)
+{
+    return loop_del(loop, sock->fd);
+}
+
+int loop_del_udp(struct SockLoop *loop, struct UDPSocket *sock)
+{
+    return loop_del(loop, sock->fd);
+}
+
+int loop_timer_add(struct SockLoop *loop, struct SockTimer *timer, unsigned timeout_ms, void *udata)
+{
+    if (!loop || !timer)
+        return -WSAEINVAL;
+    sock_wheel_add(&loop->wheel, timer, timeout_ms, udata);
+    return 0;
+}
+
+int loop_timer_del(struct SockLoop *loop, struct SockTimer *timer)
+{
+    if (!loop || !timer)
+        return -WSAEINVAL;
+    sock_wheel_del(&loop->wheel, timer);
+    return 0;
+}
+
+int loop_wait(struct SockLoop *loop, struct SockEvent *events, size_t maxevents, int timeout_ms)
+{
+    size_t i, found = 0;
+    int ready;
+
+    timeout_ms = sock_wheel_timeout(&loop->wheel, timeout_ms);
+
+    loop->fds[loop->n].fd = loop->wake;
+    loop->fds[loop->n].events = POLLRDNORM;
+    loop->fds[loop->n].revents = 0;
+    ready = WSAPoll(loop->fds, (ULONG)loop->n + 1, timeout_ms < 0 ? -1 : timeout_ms);
+    if (ready == SOCKET_ERROR)
+        return sockErr();
+
+    if (loop->fds[loop->n].revents) {
+        char drain[16];
+        // cleared after draining: a wake landing before the clear skipped its send, but this call
+        // returns anyway, and one after it sends again, so a pending wake always has its byte
+        while (recv(loop->wake, drain, sizeof(drain), 0) > 0)
+            ;
+        sockAtomicCas(&loop->woken, 1, 0);
+        ready--;
+    }
+
+    for (i = 0; i < loop->n && found < maxevents && ready > 0; ++i) {
+        size_t idx = (loop->next + i) % loop->n;
+        SHORT revents = loop->fds[idx].revents;
+        int evs = 0;
+
+        if (!revents)
+            continue;
+        ready--;
+        if (revents & POLLRDNORM)            evs |= SOCK_EV_READ;
+        if (revents & POLLWRNORM)            evs |= SOCK_EV_WRITE;
+        if (revents & (POLLERR | POLLNVAL))  evs |= SOCK_EV_ERROR;
+        if (revents & POLLHUP)               evs |= SOCK_EV_HUP;
+
+        events[found].udata = loop->udata[idx];
+        events[found].events = evs;
+        found++;
+    }
+    if (loop->n)
+        loop->next = (loop->next + i) % loop->n;
+
+    return (int)(found + sock_wheel_expire(&loop->wheel, events + found, maxevents - found));
+}
+
+int loop_wake(struct SockLoop *loop)
+{
+    char one = 1;
+
+    if (!loop)
+        return -WSAEINVAL;
+    if (!sockAtomicCas(&loop->woken, 0, 1))
+        return 0;
+    // only fails if the wake socket's buffer is full, and then a wake is pending anyway
+    if (send(loop->wake, &one, 1, 0) == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK)
+        return sockErr();
+    return 0;
+}
+
+int loop_free(struct SockLoop *loop)
+{
+    if (!loop)
+        return -WSAEINVAL;
+    closesocket(loop->wake);
+    free(loop->fds);
+    free(loop->udata);
+    free(loop);
+    sockQuit();
+    return 0;
+}
+
+
+// -------------------
+// ---- Error API ----
+// -------------------
+
+char* get_error(int errnum)
+{
+    static SOCK_THREAD_LOCAL char msg[256];
+
+    switch (errnum) {
+    case SOCK_ERR_RESOLVE:
+        return "host could not be resolved";
+    case SOCK_ERR_WOULDBLOCK:
+        return "operation would block";
+    case SOCK_ERR_INPROGRESS:
+        return "connection in progress";
+    case SOCK_ERR_UNSUPPORTED:
+        return "not supported on this platform";
+    case SOCK_ERR_CLOSED:
+        return "socket is being freed";
+    default:
+        if (!FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL,
+                            (DWORD)(errnum < 0 ? -errnum : errnum), 0, msg, sizeof(msg), NULL))
+            return "unknown error";
+        return msg;
+    }
+}
@@ -5,8 +5,106 @@
 // See accompanying file LICENSE
 // ------------------------------------------------------------------------------
 
+#ifndef S_SOCKET_H
+#define S_SOCKET_H
+
+/**
+ * Build modes
+ *
+ * By default this header only declares the API, and the s-socket library (the CMake target and the
+ * installed package) provides it, out of line behind opaque handles.
+ *
+ * Defining S_SOCKET_IMPLEMENTATION in one source file before including this header compiles the whole
+ * library into that file instead, single header style, so no library needs building or linking beyond the
+ * system ones (ws2_32 and mswsock on windows, pthreads elsewhere). Calls from that file can then be inlined
+ * down to the system call, other files include the header as usual and link against it.
+ *
+ * Defining S_SOCKET_INLINE does the same with every function static inline, for programs that make all of
+ * their socket calls from one file: nothing is exported and whatever isn't called is dropped. Every file
+ * defining it gets a private copy of the library, process-wide state such as the resolver cache included.
+ *
+ * Both modes want this header included ahead of any system header, the linux backend needs _GNU_SOURCE
+ * to be in effect for them. S_SOCKET_IO_URING and S_SOCKET_STATS select the same options the CMake ones do.
+ * The sources are C: C++ code includes this header (or s-socket.hpp) for declarations only and links
+ * the library, or a .c file built in implementation mode.
+ */
+#ifdef S_SOCKET_INLINE
+#ifndef S_SOCKET_IMPLEMENTATION
+#define S_SOCKET_IMPLEMENTATION
+#endif
+#define S_SOCKET_API static inline
+#else
+#define S_SOCKET_API
+#endif
+
+#if defined(S_SOCKET_IMPLEMENTATION) && !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bytes and alignment a handle needs when it lives in caller storage, see udp_mksocket_in / tcp_mksocket_in
+#ifdef S_SOCKET_STATS
+#define S_SOCKET_UDP_SIZE 96
+#define S_SOCKET_TCP_SIZE 96
+#else
+#define S_SOCKET_UDP_SIZE 32
+#define S_SOCKET_TCP_SIZE 32
+#endif
+#define S_SOCKET_ALIGN 8
+
+
+// ---------------------
+// ---- Library API ----
+// ---------------------
+
+/**
+ * Threading model
+ *
+ * - Different handles never share state, any number of threads can use any number of handles.
+ * - On one TCPSocket, one thread may send while another receives (tcp_send/tcp_sendv/tcp_sendfile against
+ *   tcp_recv/tcp_recvv). Two concurrent senders or two concurrent receivers are safe as calls, but the
+ *   bytes of a stream may interleave, so give each direction a single thread.
+ * - On one UDPSocket any number of threads may send and receive at once, every datagram is atomic.
+ * - tcp_free/udp_free may run while other threads are inside data calls (send, recv, accept, connect and
+ *   their batch/vector forms) on the same handle. The socket is shut down so blocked calls wake up, calls
+ *   that begin after free started return SOCK_ERR_CLOSED, and the descriptor and memory are released by
+ *   whichever of those calls returns last. A call may not begin after free has returned.
+ * - Configuration calls (bind, listen, tcp_mod_sock/udp_mod_sock, tcp_connect_fastest, the event loop and
+ *   ring registrations) must not overlap other calls on the same handle; do them before sharing it.
+ * - AddrInfo objects, event loops and completion rings belong to one thread at a time.
+ *   setaddrinfo, setaddrinfo_async and the handle and buffer pool calls may be called from any thread.
+ */
+
+/**
+ * Every handle keeps the platform socket layer (winsock) started while it exists, so a process that keeps
+ * opening and closing its only sockets restarts winsock every time. sock_startup holds a process-wide
+ * reference until the matching sock_cleanup, avoiding that. Both are thread safe, and no-ops on linux.
+ * @return zero on success, negative values for failure
+ */
+S_SOCKET_API int sock_startup();
+S_SOCKET_API int sock_cleanup();
+
+/**
+ * Reports whether an optional offload or kernel feature works on this system, so callers can choose between
+ * a fast path and the portable one at runtime. The answer is probed once and then cached
+ * @param feature a SOCK_FEATURE_* value
+ * @return 1 if available, 0 if not
+ */
+S_SOCKET_API int sock_supports(int feature);
+
+enum {
+    SOCK_FEATURE_UDP_GSO,    // udp_send_segmented is offloaded instead of sending datagram by datagram
+    SOCK_FEATURE_UDP_GRO,    // UDP_MOD_GRO can be enabled
+    SOCK_FEATURE_ZEROCOPY,   // UDP_MOD_ZEROCOPY and TCP_MOD_ZEROCOPY can be enabled
+    SOCK_FEATURE_REUSEPORT,  // UDP_MOD_REUSEPORT, TCP_MOD_REUSEPORT and the sharding API spread load across sockets
+    SOCK_FEATURE_KTLS        // tcp_tls_install can hand TLS records to the kernel
+};
+
 // ---------------------
 // ---- Address API ----
 // ---------------------
@@ -14,25 +112,117 @@
 /**
  * The address API just consists of the AddrInfo type and a few helpers
  * to encapsulate resolved address info a cross-platform way
+ *
+ * An AddrInfo holds an ipv4 or an ipv6 address and every socket takes either: sockets are
+ * ipv6 dual stack where the host supports it, so ipv4 peers are reached through v4-mapped
+ * addresses without callers ever seeing those. Bind "::" to serve both families on one socket.
+ *
+ * It can also hold a unix domain socket path, from setaddrinfo_unix, for processes on the same host:
+ * a socket bound or connected to one becomes a unix socket, skipping the whole TCP/IP stack.
  */
 struct AddrInfo;
 
+/**
+ * Allocates an empty AddrInfo object to be populated by setaddrinfo or by a receive call
+ * @return NULL on allocation failure
+ */
+S_SOCKET_API struct AddrInfo* mkaddrinfo();
+
+/**
+ * Releases an AddrInfo object created with mkaddrinfo()
+ */
+S_SOCKET_API void addrinfo_free(struct AddrInfo *info);
+
 /**
  * Populates AddrInfo object based on args
  *
+ * Numeric ips are parsed in place without touching the resolver. Names go through
+ * getaddrinfo once and are then served from an in-process cache keyed by (host, port)
+ * until they expire, see setaddrinfo_cache_ttl
+ *
  * @param host pointer to null-terminated hostname or ip
  * @param port port number we want to use for host
  * @param out a pointer to an AddrInfo object that this function will populate
- * @return zero on success
+ * @return zero on success, SOCK_ERR_RESOLVE if the host could not be resolved
  *
  * Some examples:
- * setaddrinfo("www.google.com", 80, &request);
- * setaddrinfo("8.8.8.8", 53, &dnsInfo);
- * setaddrinfo("0.0.0.0", 8080, &serverInfo);
+ * setaddrinfo("www.google.com", 80, request);
+ * setaddrinfo("8.8.8.8", 53, dnsInfo);
+ * setaddrinfo("0.0.0.0", 8080, serverInfo);
+ */
+S_SOCKET_API int setaddrinfo(char *host,
+                             size_t port,
+                             struct AddrInfo *out);
+
+/**
+ * Populates an AddrInfo object with a unix domain socket path. tcp_bind/udp_bind create the socket
+ * file and fail if it already exists, nothing removes it again, so servers unlink stale paths first.
+ * A UDP socket has to be bound to a path of its own, or be a sock_pair_dgram end, for replies to reach it
+ *
+ * @param path pointer to a null-terminated file system path, shorter than the platform limit (108 bytes)
+ * @param out a pointer to an AddrInfo object that this function will populate
+ * @return zero on success, negative values for failure
+ *
+ * gethost returns the path of such an AddrInfo (empty for unnamed peers) and getport zero
+ */
+S_SOCKET_API int setaddrinfo_unix(char *path,
+                                  struct AddrInfo *out);
+
+/**
+ * Completion callback for setaddrinfo_async
+ *
+ * @param out the AddrInfo passed to setaddrinfo_async, populated when result is zero
+ * @param result zero on success, negative values for failure as with setaddrinfo
+ * @param udata the pointer passed to setaddrinfo_async
+ */
+typedef void (*sock_resolve_cb)(struct AddrInfo *out, int result, void *udata);
+
+/**
+ * setaddrinfo that never blocks on the resolver. Numeric ips and cached names complete
+ * immediately, calling cb before this returns. Anything else is queued to a resolver
+ * thread and cb runs on that thread once the lookup finishes
+ *
+ * host is copied, out must stay valid until cb has run
+ * @return zero if the lookup completed or was queued, negative values for failure (cb is not called)
+ */
+S_SOCKET_API int setaddrinfo_async(char *host,
+                                   size_t port,
+                                   struct AddrInfo *out,
+                                   sock_resolve_cb cb,
+                                   void *udata);
+
+/**
+ * Sets how long resolved names stay in the setaddrinfo cache, SOCK_DNS_TTL_DEFAULT until changed
+ * getaddrinfo does not report record ttls, so this is the ttl applied to every cached name
+ *
+ * @param ttl_ms lifetime of new cache entries in milliseconds, zero disables the cache and empties it
+ */
+S_SOCKET_API void setaddrinfo_cache_ttl(unsigned ttl_ms);
+
+enum {
+  SOCK_DNS_TTL_DEFAULT = 30000 // 30 seconds
+};
+
+/**
+ * Number of addresses the last setaddrinfo resolved into an AddrInfo object. The first one
+ * is selected on return, the others are fallbacks for multi-homed hosts
+ *
+ * @return candidate count on success (zero if info was never resolved), negative values for failure
+ */
+S_SOCKET_API int addrinfo_count(struct AddrInfo *info);
+
+/**
+ * Makes one of the resolved candidates the address used by gethost, getport and every
+ * socket call taking this AddrInfo object
+ *
+ * @param index candidate to use, less than addrinfo_count(info)
+ * @return zero on success, negative values for failure
  */
-int setaddrinfo(char *host,
-                size_t port,
-                struct AddrInfo *out);
+S_SOCKET_API int addrinfo_select(struct AddrInfo *info, size_t index);
+
+enum {
+  SOCK_ADDR_MAX = 8 // most candidates setaddrinfo keeps per AddrInfo object
+};
 
 /**
  * Prints resolved ip of an AddrInfo object, useful for checking out the ip of
@@ -40,14 +230,14 @@ int setaddrinfo(char *host,
  *
  * @return null-terminated string on success, NULL on failure
  */
-char* gethost(struct AddrInfo *in);
+S_SOCKET_API char* gethost(struct AddrInfo *in);
 
 /**
  * Returns port set in AddrInfo object
  *
  * @return port on success, negative values for failure
  */
-int getport(struct AddrInfo *in);
+S_SOCKET_API int getport(struct AddrInfo *in);
 
 
 // -----------------
@@ -70,36 +260,115 @@ int getport(struct AddrInfo *in);
 struct UDPSocket;
 
 /**
- * Creates and returns a socket file descriptor.
+ * Creates and returns a socket file descriptor, ipv6 dual stack if available, ipv4 otherwise.
  * @return If the system fails in socket creation, we return NULL
  */
-struct UDPSocket* udp_mksocket();
+S_SOCKET_API struct UDPSocket* udp_mksocket();
+
+/**
+ * udp_mksocket without the allocation: the handle is built in caller storage, e.g. a struct SockStorage
+ * member of a connection object. udp_free closes the socket and leaves the storage alone
+ * @param storage at least S_SOCKET_UDP_SIZE bytes aligned to S_SOCKET_ALIGN, in use until udp_free
+ * @return storage as a handle, NULL if the socket could not be created
+ */
+S_SOCKET_API struct UDPSocket* udp_mksocket_in(void *storage);
 
 /**
  * Sends a buffer msgbuf of size msglen to destInfo over socket sock
  * @param sock pointer to a valid socket
- * @param destInfo pointer to a populated description of our destination
+ * @param destInfo pointer to a populated description of our destination, NULL on a sock_pair_dgram end
  * @param msgbuf pointer to the data we're sending
  * @param msglen length of the message we're sending
  * @return bytes sent, negative on failure
  */
-int udp_send(struct UDPSocket *sock,
-                struct AddrInfo *destInfo,
-                void *msgbuf,
-                size_t msglen,
-                size_t flags);
+S_SOCKET_API int udp_send(struct UDPSocket *sock,
+                             struct AddrInfo *destInfo,
+                             void *msgbuf,
+                             size_t msglen,
+                             size_t flags);
+
+enum {
+      UDP_SEND_DONTROUTE = 1 << 0   // data should not be subjected to routing
+};
+
+/**
+ * One datagram slot for the batched UDP calls
+ */
+struct UDPMsg {
+    void *msgbuf;           // buffer the datagram is stored in or sent from
+    size_t buflen;          // capacity of msgbuf on receive, bytes to send on send
+    struct AddrInfo *addr;  // populated with the source address on receive (can be NULL), destination on send
+                            // (NULL on a sock_pair_dgram end)
+    int result;             // bytes received or sent for this slot, negative on failure
+    struct SockTimestamp *stamp; // receive only: set to the datagram's timestamps if not NULL, see UDP_MOD_TIMESTAMP
+};
+
+/**
+ * Receive timestamps in nanoseconds, taken before the receive call returns so they exclude the scheduling
+ * delay between a packet's arrival and the reader waking up. Enable them with UDP_MOD_TIMESTAMP or
+ * TCP_MOD_TIMESTAMP, then receive with udp_recv_ts, tcp_recv_ts, or udp_recv_batch with UDPMsg.stamp set.
+ */
+struct SockTimestamp {
+    long long software;  // when the kernel took the packet in, CLOCK_REALTIME since the epoch, 0 if not recorded
+    long long hardware;  // when the NIC took it in, in the NIC's own clock, 0 if not recorded
+};
+
+enum {
+    SOCK_TSTAMP_SOFTWARE = 1 << 0,  // kernel receive timestamps
+    SOCK_TSTAMP_HARDWARE = 1 << 1   // NIC receive timestamps; the interface must have hardware stamping enabled too
+                                    //     (SIOCSHWTSTAMP, e.g. hwstamp_ctl -r 1), which needs privileges
+};
+
+/**
+ * udp_send_batch sends n datagrams, each to its own destination, with as few system calls as possible
+ * (sendmmsg on linux). Sending stops at the first datagram that fails; its result holds the error, so
+ * the caller can retry from msgs + return value.
+ * @param sock pointer to a valid socket
+ * @param msgs array of n datagrams, msgs[i].result is set for every slot that was attempted
+ * @param n number of datagrams in msgs
+ * @param flags UDP_SEND_* flags applied to every datagram
+ * @return number of datagrams sent, negative on failure if not even the first one could be sent
+ */
+S_SOCKET_API int udp_send_batch(struct UDPSocket *sock,
+                                struct UDPMsg *msgs,
+                                size_t n,
+                                size_t flags);
+
+/**
+ * A buffer for the vectored (scatter/gather) calls, udp_sendv, tcp_sendv and tcp_recvv
+ */
+struct SockBuf {
+    void *buf;   // start of the buffer
+    size_t len;  // bytes in/capacity of buf
+};
 
 enum {
-      UDP_SEND_DONTROUTE    // data should not be subjected to routing
+    SOCK_IOV_MAX = 64   // most buffers a vectored call passes to the system at once
 };
 
+/**
+ * udp_sendv sends the concatenation of nbufs buffers as a single datagram (sendmsg on linux,
+ * WSASendTo on windows), without copying them into one staging buffer first
+ * @param sock pointer to a valid socket
+ * @param destInfo pointer to a populated description of our destination, NULL on a sock_pair_dgram end
+ * @param bufs the pieces of the datagram, in order
+ * @param nbufs number of buffers, at most SOCK_IOV_MAX
+ * @param flags UDP_SEND_* flags
+ * @return bytes sent, negative on failure
+ */
+S_SOCKET_API int udp_sendv(struct UDPSocket *sock,
+                           struct AddrInfo *destInfo,
+                           struct SockBuf *bufs,
+                           size_t nbufs,
+                           size_t flags);
+
 /**
  * udp_bind binds a UDPSocket to a local address and port, which is a prerequisite to udp_recv
  * @param sock valid socket created with udp_mksocket()
  * @param hostInfo description of the interface we're binding
  */
-int udp_bind(struct UDPSocket *sock,
-             struct AddrInfo *hostInfo);
+S_SOCKET_API int udp_bind(struct UDPSocket *sock,
+                          struct AddrInfo *hostInfo);
 
 /**
  * udp_recv blocks until it receives data on the bound socket
@@ -111,21 +380,83 @@ int udp_bind(struct UDPSocket *sock,
  *        but can also be NULL
  * @return bytes received, less than zero indicates error
  */
-int udp_recv(struct UDPSocket *sock,
-             void *msgbuf,
-             size_t buflen,
-             size_t flags,
-             struct AddrInfo *out);
+S_SOCKET_API int udp_recv(struct UDPSocket *sock,
+                          void *msgbuf,
+                          size_t buflen,
+                          size_t flags,
+                          struct AddrInfo *out);
+
+enum {
+      UDP_RECV_PEEK = 1 << 0  // The data is copied into the buffer but is not removed from the input queue,
+};                            //     udp_recv returns the data-size that can be read in a single call
+
+/**
+ * udp_recv that also returns the datagram's receive timestamps
+ * @param stamp set to the timestamps, fields the socket doesn't record (see UDP_MOD_TIMESTAMP) are 0
+ * @return bytes received, negative values for failure
+ */
+S_SOCKET_API int udp_recv_ts(struct UDPSocket *sock,
+                             void *msgbuf,
+                             size_t buflen,
+                             size_t flags,
+                             struct AddrInfo *out,
+                             struct SockTimestamp *stamp);
+
+/**
+ * udp_recv_batch receives up to n datagrams on the bound socket with as few system calls as possible
+ * (recvmmsg on linux). It blocks until at least one datagram is available, then drains whatever else
+ * is already queued without blocking again.
+ * @param sock a socket bound to a local interface
+ * @param msgs array of n slots, msgs[i].result is set for every slot that was filled
+ * @param n number of slots in msgs
+ * @param flags UDP_RECV_* flags applied to every datagram
+ * @return number of slots filled, less than zero indicates error
+ */
+S_SOCKET_API int udp_recv_batch(struct UDPSocket *sock,
+                                struct UDPMsg *msgs,
+                                size_t n,
+                                size_t flags);
+
+/**
+ * Sends msglen bytes as a train of segsize byte datagrams to one destination, the last one possibly shorter,
+ * in a single call. The kernel or the NIC does the splitting (UDP generic segmentation offload), which costs
+ * one trip through the stack instead of one per datagram. Where sock_supports(SOCK_FEATURE_UDP_GSO) is 0
+ * the datagrams are sent one by one instead, with the same result on the wire.
+ * @param msglen at most 65507 bytes (65527 over ipv6) and SOCK_GSO_SEGMENTS_MAX segments
+ * @param segsize payload bytes per datagram, which should keep each one within the path MTU
+ * @return bytes sent, negative values for failure
+ */
+S_SOCKET_API int udp_send_segmented(struct UDPSocket *sock,
+                                    struct AddrInfo *destInfo,
+                                    void *msgbuf,
+                                    size_t msglen,
+                                    size_t segsize,
+                                    size_t flags);
 
 enum {
-      UDP_RECV_PEEK    // The data is copied into the buffer but is not removed from the input queue,
-};                     //     udp_recv returns the data-size that can be read in a single call
+    SOCK_GSO_SEGMENTS_MAX = 64  // most datagrams one udp_send_segmented call may carry
+};
+
+/**
+ * udp_recv that also reports the datagram size. With UDP_MOD_GRO enabled the kernel may hand several
+ * consecutive datagrams from the same sender over as one buffer, laid out back to back, each segsize
+ * bytes except for a possibly shorter last one
+ * @param buflen room for a coalesced buffer, up to 65535 bytes
+ * @param segsize set to the size of each datagram, equal to the return value when only one arrived
+ * @return total bytes received, negative values for failure
+ */
+S_SOCKET_API int udp_recv_segmented(struct UDPSocket *sock,
+                                    void *msgbuf,
+                                    size_t buflen,
+                                    size_t flags,
+                                    struct AddrInfo *out,
+                                    size_t *segsize);
 
 /**
  * Closes a udp socket when you're done with it
  * @return non-zero on failure
  */
-int udp_free(struct UDPSocket* sock);
+S_SOCKET_API int udp_free(struct UDPSocket* sock);
 
 /**
  * Here we can set special socket options
@@ -135,11 +466,84 @@ int udp_free(struct UDPSocket* sock);
  * mod_value Pointer to the value we want to set, if we're setting a flag with a value
  * @return zero on success.
  */
-int udp_mod_sock(struct TCPSocket *sock, int mod, int mod_value);
+S_SOCKET_API int udp_mod_sock(struct UDPSocket *sock, int mod, int mod_value);
 
 enum {
     UDP_MOD_BROADCAST,  // Permit sending of broadcast messages, takes an int value which is treated like a boolean
-}
+    UDP_MOD_NONBLOCK,   // Calls that would have to wait return SOCK_ERR_WOULDBLOCK instead, treated like a bool
+    UDP_MOD_REUSEADDR,  // Allow binding an address that is still in use, treated like a bool, set before udp_bind
+    UDP_MOD_REUSEPORT,  // Let several sockets bind the same port and share its datagrams (linux only), set before udp_bind
+    UDP_MOD_ZEROCOPY,   // Sends pin the caller's buffer instead of copying it (linux only), see udp_zerocopy_reap
+    UDP_MOD_V6ONLY,     // Restrict the socket to ipv6 peers, treated like a bool, 0 (dual stack) by default, set before udp_bind
+    UDP_MOD_RCVTIMEO,   // Sets the timeout, in milliseconds, for blocking receive calls, 0 waits forever
+    UDP_MOD_SNDTIMEO,   // Sets the timeout, in milliseconds, for blocking send calls, 0 waits forever
+    UDP_MOD_SNDBUF,     // Kernel send buffer size in bytes (linux reports back double the value set, its bookkeeping included)
+    UDP_MOD_RCVBUF,     // Kernel receive buffer size in bytes, raise it to ride out bursts without drops
+    UDP_MOD_BUSY_POLL,  // Microseconds a blocking receive spins on the device queue before sleeping (linux only)
+    UDP_MOD_TOS,        // IP type of service / traffic class byte, DSCP in the upper six bits (linux only)
+    UDP_MOD_PRIORITY,   // Queueing priority of outgoing packets, 0 to 6 without privileges (linux only)
+    UDP_MOD_INCOMING_CPU, // Steer the socket's packets to this cpu; reads back the cpu that last handled one (linux only)
+    UDP_MOD_GRO,        // Let receives coalesce datagrams of one flow, treated like a bool, see udp_recv_segmented (linux only)
+    UDP_MOD_TIMESTAMP,  // Record receive timestamps, SOCK_TSTAMP_* bits or 0 for none, see struct SockTimestamp (linux only)
+    UDP_MOD_MULTICAST_LOOP, // Deliver our own multicast sends to local members too, treated like a bool, on by default
+    UDP_MOD_MULTICAST_TTL,  // Hop limit of outgoing multicast datagrams, 1 (local network only) by default
+    UDP_MOD_MULTICAST_IF,   // Interface index multicast is sent from, 0 lets the routing table pick
+};
+
+/**
+ * Reads an option back as the system reports it, to verify what udp_mod_sock actually applied
+ * @param mod a UDP_MOD_* option
+ * @param mod_value set to the current value, bools as 0 or 1 and timeouts in milliseconds (rounded up to the
+ *        kernel tick on linux)
+ * @return zero on success, SOCK_ERR_UNSUPPORTED where the option isn't available, negative values for failure
+ */
+S_SOCKET_API int udp_get_sock(struct UDPSocket *sock, int mod, int *mod_value);
+
+/**
+ * Joins a multicast group, so datagrams sent to it arrive at the socket. Bind the group's port (on the
+ * wildcard address, with UDP_MOD_REUSEADDR if several sockets listen) and receive as usual; for high
+ * rate feeds, pair it with udp_recv_batch and a large UDP_MOD_RCVBUF. A socket can join many groups
+ * @param group the group address, ipv4 or ipv6
+ * @param source NULL for any-source multicast, otherwise only this sender's datagrams are delivered
+ *        (source-specific multicast); a group can be joined for several sources by calling again
+ * @param ifindex interface to join on (see if_nametoindex), 0 lets the system pick
+ * @return zero on success, negative values for failure
+ */
+S_SOCKET_API int udp_join_group(struct UDPSocket *sock,
+                                struct AddrInfo *group,
+                                struct AddrInfo *source,
+                                unsigned ifindex);
+
+/**
+ * Leaves a group joined with udp_join_group, with the same arguments. Freeing the socket leaves every group
+ * @return zero on success, negative values for failure
+ */
+S_SOCKET_API int udp_leave_group(struct UDPSocket *sock,
+                                 struct AddrInfo *group,
+                                 struct AddrInfo *source,
+                                 unsigned ifindex);
+
+/**
+ * Zero copy sends (UDP_MOD_ZEROCOPY / TCP_MOD_ZEROCOPY) return before the kernel is done with the buffer,
+ * which must stay untouched until its completion has been reaped. Every successful send on the socket after
+ * enabling the mode gets the next id, starting from 0 (32 bit, wrapping); each datagram of a batch counts as one. Completions arrive on the
+ * socket's error queue, which an event loop reports as SOCK_EV_ERROR.
+ * Zero copy only pays off for large payloads, ~10KB and up.
+ */
+struct SockZeroCopy {
+    unsigned int first;   // id of the first completed send
+    unsigned int last;    // id of the last completed send, inclusive
+    int copied;           // non-zero if the kernel ended up copying these sends after all
+};
+
+/**
+ * Collects zero copy completions, never blocks
+ * @param sock a socket with UDP_MOD_ZEROCOPY enabled
+ * @param done array the completed ranges are stored in
+ * @param n capacity of done
+ * @return number of ranges stored, zero if none are pending, negative on failure
+ */
+S_SOCKET_API int udp_zerocopy_reap(struct UDPSocket *sock, struct SockZeroCopy *done, size_t n);
 
 
 // -----------------
@@ -155,7 +559,7 @@ enum {
  *
  * client: populate address info -> make socket -> connect socket -> send and recv -> free socket
  *
- * server: populate local addr -> make socket -> bind locally -> listen for connections --
+ * server: populate local addr -> make socket -> bind locally -> listen for connections -> accept connections --
  *           --> receive or send from the established connection -> free socket
  *
  * The main notable difference from udp programatically is that you can recv and send on the same socket
@@ -165,35 +569,115 @@ enum {
  */
 struct TCPSocket;
 
-struct TCPSocket* tcp_mksocket();
 /**
- * tcp_bind binds a TCPSocket to a local address and port, which is a prerequisite to tcp_listen_accept
+ * Creates and returns a socket, ipv6 dual stack if available, ipv4 otherwise.
+ * @return If the system fails in socket creation, we return NULL
+ */
+S_SOCKET_API struct TCPSocket* tcp_mksocket();
+
+/**
+ * tcp_mksocket without the allocation: the handle is built in caller storage, e.g. a struct SockStorage
+ * member of a connection object. tcp_free closes the socket and leaves the storage alone
+ * @param storage at least S_SOCKET_TCP_SIZE bytes aligned to S_SOCKET_ALIGN, in use until tcp_free
+ * @return storage as a handle, NULL if the socket could not be created
+ */
+S_SOCKET_API struct TCPSocket* tcp_mksocket_in(void *storage);
+
+/**
+ * Like tcp_mksocket_in but without opening a socket, for handles that only receive connections
+ * from tcp_accept. Saves creating a descriptor that accept would close again
+ * @return storage as a handle, NULL on failure
+ */
+S_SOCKET_API struct TCPSocket* tcp_mkhandle_in(void *storage);
+
+/**
+ * tcp_bind binds a TCPSocket to a local address and port, which is a prerequisite to tcp_listen
  */
-int tcp_bind(struct UDPSocket *sock,
-                struct AddrInfo *hostInfo);
+S_SOCKET_API int tcp_bind(struct TCPSocket *sock,
+                             struct AddrInfo *hostInfo);
 
 /**
- * tcp_listen listens for incoming connections on a bound socket and then accepts them if we are still
- * within backlog active connections. Returns zero on success. If we succeed, we are furnished
- * with the client address, and an active socket to the client.
+ * tcp_listen turns a bound socket into a listening socket that queues up to backlog incoming connections
+ * for tcp_accept. It only needs to be called once per socket.
+ * @return zero on success.
+ */
+S_SOCKET_API int tcp_listen(struct TCPSocket *sock,
+                            int backlog);
+
+/**
+ * tcp_accept takes the next connection off a listening socket's queue. If we succeed, we are furnished
+ * with the client address, and an active socket to the client. On a TCP_MOD_NONBLOCK listener an empty
+ * queue returns SOCK_ERR_WOULDBLOCK, so it can be called when the event loop reports SOCK_EV_READ.
  *
- * The client socket is ultimately what we use to tx/rx over tcp, with the bound socket acting as a "daemon" socket
+ * The client socket is ultimately what we use to tx/rx over tcp, with the listening socket acting as a "daemon" socket
+ * @param sock a listening socket
+ * @param client a handle (e.g. from tcp_mksocket) that takes over the connection, any descriptor it held is closed
+ * @param clientInfo populated with the client address, can be NULL
+ * @param flags TCP_ACCEPT_* flags
+ * @return zero on success.
+ */
+S_SOCKET_API int tcp_accept(struct TCPSocket *sock,
+                            struct TCPSocket *client,
+                            struct AddrInfo *clientInfo,
+                            size_t flags);
+
+enum {
+    TCP_ACCEPT_NONBLOCK = 1 << 0    // the accepted socket starts in TCP_MOD_NONBLOCK mode, without an extra call
+};
+
+/**
+ * tcp_accept_batch accepts up to n queued connections in one call, stopping as soon as the queue is
+ * empty. A blocking listener waits for the first connection only.
+ * @param sock a listening socket
+ * @param clients n handles that take over the accepted connections, as in tcp_accept
+ * @param clientInfo NULL, or n AddrInfo pointers (each may be NULL) populated with the client addresses
+ * @param n number of handles in clients
+ * @param flags TCP_ACCEPT_* flags applied to every accepted socket
+ * @return number of connections accepted, negative on failure if none were
  */
-int tcp_listen(struct TCPSocket *sock,
-               int backlog, 
-               struct TCPSocket *client,
-               struct AddrInfo *clientInfo);
+S_SOCKET_API int tcp_accept_batch(struct TCPSocket *sock,
+                                  struct TCPSocket **clients,
+                                  struct AddrInfo **clientInfo,
+                                  size_t n,
+                                  size_t flags);
 
 
 /**
  * connect is like bind() but for a client; it establishes a maintained connection that lets us continually
  * send and receive data without interruption.
+ * On a TCP_MOD_NONBLOCK socket the connection is only started and SOCK_ERR_INPROGRESS is returned; wait for
+ * SOCK_EV_WRITE on the socket (e.g. with an event loop) and then call tcp_connect_finish.
  * @param sock An inactive socket
  * @param dest A description of our client
  * @return zero on success.
  */
-int tcp_connect(struct TCPSocket *sock,
-                struct AddrInfo *dest);
+S_SOCKET_API int tcp_connect(struct TCPSocket *sock,
+                             struct AddrInfo *dest);
+
+/**
+ * Completes a non-blocking tcp_connect once the socket reported writable
+ * @param sock a socket tcp_connect returned SOCK_ERR_INPROGRESS for
+ * @return zero once connected, SOCK_ERR_INPROGRESS if still connecting, otherwise why the connect failed
+ */
+S_SOCKET_API int tcp_connect_finish(struct TCPSocket *sock);
+
+/**
+ * Connects to whichever resolved candidate of dest answers first, Happy Eyeballs style
+ * (RFC 8305). Candidates are tried in addrinfo order, a new attempt starts every stagger_ms
+ * or as soon as an earlier one fails, and the first handshake to complete wins while the
+ * others are closed. sock ends up connected on the winner, which dest then has selected
+ *
+ * The first candidate is tried on sock itself and the others on fresh sockets, so set
+ * socket options after this returns
+ *
+ * @param stagger_ms delay before starting the next attempt, 250 is the RFC default
+ * @param timeout_ms overall limit, or -1 to wait until every attempt has failed
+ * @return zero on success, negative values for failure (the last attempt's error)
+ */
+S_SOCKET_API int tcp_connect_fastest(struct TCPSocket *sock,
+                                     struct AddrInfo *dest,
+                                     int stagger_ms,
+                                     int timeout_ms);
 
 
 /**
@@ -204,15 +688,29 @@ int tcp_connect(struct TCPSocket *sock,
  * @param flags
  * @return bytes sent
  */
-int tcp_send(struct TCPSocket *sock,
-                void *msgbuf,
-                size_t buflen,
-                size_t flags);
+S_SOCKET_API int tcp_send(struct TCPSocket *sock,
+                             void *msgbuf,
+                             size_t buflen,
+                             size_t flags);
 enum {
-    TCP_SEND_DONTROUTE,    // data should not be subjected to routing
-    TCP_SEND_OOB           // sends out-of-band data
+    TCP_SEND_DONTROUTE = 1 << 0,    // data should not be subjected to routing
+    TCP_SEND_OOB       = 1 << 1     // sends out-of-band data
 };
 
+/**
+ * Sends the concatenation of nbufs buffers over active socket sock in one call (sendmsg on linux,
+ * WSASend on windows), e.g. a protocol header and a payload that live in different places
+ * @param sock a tcp socket that must have an established connection
+ * @param bufs the buffers to send, in order
+ * @param nbufs number of buffers, only the first SOCK_IOV_MAX are sent per call
+ * @param flags TCP_SEND_* flags
+ * @return bytes sent, which may end partway through any buffer
+ */
+S_SOCKET_API int tcp_sendv(struct TCPSocket *sock,
+                           struct SockBuf *bufs,
+                           size_t nbufs,
+                           size_t flags);
+
 /**
  * Receives incoming traffic on tcp connections
  * @param sock a tcp socket that must have an established connection
@@ -221,23 +719,71 @@ enum {
  * @param flags
  * @return The bytes we've received and stored in msgbuf
  */
-int tcp_recv(struct TCPSocket *sock,
-                void *msgbuf,
-                size_t buflen,
-                size_t flags);
+S_SOCKET_API int tcp_recv(struct TCPSocket *sock,
+                             void *msgbuf,
+                             size_t buflen,
+                             size_t flags);
 
 enum {
-    TCP_RECV_PEEK,      // The data is copied into the buffer but is not removed from the input queue,
-                        //     tcp_recv returns the data-size that can be read in a single call
-    TCP_RECV_OOB,       // Process out-of-band data
-    TCP_RECV_WAITALL    // tcp_recv now returns when the buffer is full, the connection has been lost, or the request has been cancelled
+    TCP_RECV_PEEK    = 1 << 0,  // The data is copied into the buffer but is not removed from the input queue,
+                                //     tcp_recv returns the data-size that can be read in a single call
+    TCP_RECV_OOB     = 1 << 1,  // Process out-of-band data
+    TCP_RECV_WAITALL = 1 << 2   // tcp_recv now returns when the buffer is full, the connection has been lost, or the request has been cancelled
 };
 
 /**
- * Closes a tcp socket when you're done with it
+ * Receives incoming traffic on tcp connections, filling nbufs buffers in order (recvmsg on linux,
+ * WSARecv on windows)
+ * @param sock a tcp socket that must have an established connection
+ * @param bufs the buffers to fill, in order
+ * @param nbufs number of buffers, only the first SOCK_IOV_MAX are filled per call
+ * @param flags TCP_RECV_* flags
+ * @return The bytes we've received across all buffers
+ */
+S_SOCKET_API int tcp_recvv(struct TCPSocket *sock,
+                           struct SockBuf *bufs,
+                           size_t nbufs,
+                           size_t flags);
+
+/**
+ * tcp_recv that also returns receive timestamps. A stream read can span several segments; the stamp is
+ * that of the last segment the data came from
+ * @param stamp set to the timestamps, fields the socket doesn't record (see TCP_MOD_TIMESTAMP) are 0
+ * @return bytes received, negative values for failure
+ */
+S_SOCKET_API int tcp_recv_ts(struct TCPSocket *sock,
+                             void *msgbuf,
+                             size_t buflen,
+                             size_t flags,
+                             struct SockTimestamp *stamp);
+
+#ifdef _WIN32
+typedef void* sock_file_t;  // a file HANDLE
+#else
+typedef int sock_file_t;    // a file descriptor
+#endif
+
+/**
+ * Sends count bytes of a file, starting at offset, without passing them through a user space buffer
+ * (sendfile, or splice for pipes, on linux and TransmitFile on windows). Files the kernel can't send
+ * directly fall back to a read and send loop. The file position is not used or changed, except for
+ * pipes which are read from wherever they are.
+ * @param sock a tcp socket that must have an established connection
+ * @param file the open file to send from
+ * @param offset where in the file to start
+ * @param count how many bytes to send
+ * @return bytes sent, less than count if the end of the file was reached or a non-blocking socket filled up
+ */
+S_SOCKET_API long long tcp_sendfile(struct TCPSocket *sock,
+                                    sock_file_t file,
+                                    long long offset,
+                                    size_t count);
+
+/**
+ * Closes a tcp socket when you're done with it, handing its memory back to wherever it came from
  * @return non-zero on failure
  */
-int tcp_free(struct TCPSocket* sock);
+S_SOCKET_API int tcp_free(struct TCPSocket* sock);
 
 /**
  * Here we can set special socket options
@@ -247,16 +793,1021 @@ int tcp_free(struct TCPSocket* sock);
  * @param mod_value Value we want to set for the option
  * @return zero on success.
  */
-int tcp_mod_sock(struct TCPSocket *sock, int mod, int mod_value);
+S_SOCKET_API int tcp_mod_sock(struct TCPSocket *sock, int mod, int mod_value);
 
 enum {
     TCP_MOD_KEEPALIVE,  // Keeps connections active by enabling periodic transmission of messages, treated like a bool, 0 by default
     TCP_MOD_DONTROUTE,  // Request that outgoing messages bypass standard routing
     TCP_MOD_RCVTIMEO,   // Sets the timeout, in milliseconds, for blocking receive calls
-}
+    TCP_MOD_NONBLOCK,   // Calls that would have to wait return SOCK_ERR_WOULDBLOCK instead, treated like a bool
+    TCP_MOD_REUSEADDR,  // Allow binding an address with connections in TIME_WAIT, treated like a bool, set before tcp_bind
+    TCP_MOD_REUSEPORT,  // Let several listeners bind the same port and share its connections (linux only), set before tcp_bind
+    TCP_MOD_ZEROCOPY,   // Sends pin the caller's buffer instead of copying it (linux only), see tcp_zerocopy_reap
+    TCP_MOD_V6ONLY,     // Restrict the socket to ipv6 peers, treated like a bool, 0 (dual stack) by default, set before tcp_bind
+    TCP_MOD_NODELAY,    // Send small segments at once instead of waiting for outstanding acks (Nagle off), treated like a bool
+    TCP_MOD_CORK,       // Hold partial segments until uncorked or 200ms pass, treated like a bool (linux only)
+    TCP_MOD_SNDTIMEO,   // Sets the timeout, in milliseconds, for blocking send calls, 0 waits forever
+    TCP_MOD_SNDBUF,     // Kernel send buffer size in bytes (linux reports back double the value set, its bookkeeping included)
+    TCP_MOD_RCVBUF,     // Kernel receive buffer size in bytes, which also caps the advertised window; set before tcp_connect/tcp_listen
+    TCP_MOD_QUICKACK,   // Ack at once instead of delaying, treated like a bool; the kernel may drop back to delayed acks,
+                        //     so set it again after receives where latency matters (linux only)
+    TCP_MOD_BUSY_POLL,  // Microseconds a blocking receive spins on the device queue before sleeping (linux only)
+    TCP_MOD_FASTOPEN,   // Listener side TCP Fast Open: how many pending fast open requests to queue, set before tcp_listen (linux only)
+    TCP_MOD_FASTOPEN_CONNECT, // Client side TCP Fast Open, treated like a bool, set before tcp_connect: the connect returns at once
+                        //     and the first send goes out in the SYN when a cookie for the server is cached (linux only)
+    TCP_MOD_TOS,        // IP type of service / traffic class byte, DSCP in the upper six bits (linux only)
+    TCP_MOD_PRIORITY,   // Queueing priority of outgoing packets, 0 to 6 without privileges (linux only)
+    TCP_MOD_INCOMING_CPU, // Steer the socket's packets to this cpu; reads back the cpu that last handled one (linux only)
+    TCP_MOD_TIMESTAMP,  // Record receive timestamps, SOCK_TSTAMP_* bits or 0 for none, see tcp_recv_ts (linux only)
+};
 
 /**
- * Get a string description of an error
- * @return null-terminated error string
+ * Reads an option back as the system reports it, to verify what tcp_mod_sock actually applied
+ * @param mod a TCP_MOD_* option
+ * @param mod_value set to the current value, bools as 0 or 1 and timeouts in milliseconds (rounded up to the
+ *        kernel tick on linux)
+ * @return zero on success, SOCK_ERR_UNSUPPORTED where the option isn't available, negative values for failure
+ */
+S_SOCKET_API int tcp_get_sock(struct TCPSocket *sock, int mod, int *mod_value);
+
+/**
+ * Collects zero copy completions of a TCP_MOD_ZEROCOPY socket without blocking, see struct SockZeroCopy
+ * @return number of ranges stored, zero if none are pending, negative on failure
+ */
+S_SOCKET_API int tcp_zerocopy_reap(struct TCPSocket *sock, struct SockZeroCopy *done, size_t n);
+
+
+// -------------------------
+// ---- TLS Offload API ----
+// -------------------------
+
+/**
+ * TLS offload moves the record layer of an established TLS session into the kernel (kTLS, linux only).
+ * The handshake still runs in user space, in whatever library negotiated it, which hands the session keys
+ * over with tcp_tls_install, once per direction. From then on:
+ *
+ * - tcp_send, tcp_sendv and the stream API take plaintext that the kernel encrypts as it builds records,
+ *   so there is no user space ciphertext buffer to fill and copy again
+ * - tcp_sendfile encrypts straight from the page cache, with SOCK_TLS_ZEROCOPY_SENDFILE without copying
+ *   the file pages at all
+ * - tcp_recv and tcp_recvv return decrypted application data
+ *
+ * Records that aren't application data (alerts, TLS 1.3 key updates and session tickets) stop tcp_recv,
+ * which fails with -EIO when one is next; tcp_tls_recv_record returns it along with its type, and
+ * tcp_tls_send_record sends one (a close_notify alert, say), so the handshake library can still do its
+ * part. TCP_MOD_ZEROCOPY sends aren't possible on an offloaded socket: the kernel has to read the
+ * plaintext into the records it encrypts anyway.
+ */
+struct SockTlsKeys {
+    int version;               // SOCK_TLS_1_2 or SOCK_TLS_1_3
+    int cipher;                // SOCK_TLS_AES_128_GCM, SOCK_TLS_AES_256_GCM or SOCK_TLS_CHACHA20_POLY1305
+    unsigned char key[32];     // the direction's traffic key, the first 16 bytes for AES-128
+    unsigned char iv[12];      // AES-GCM: 4 byte implicit salt, then the 8 byte explicit nonce (TLS 1.2) or
+                               // the rest of the traffic iv (TLS 1.3); ChaCha20: the 12 byte traffic iv
+    unsigned char rec_seq[8];  // big endian sequence number of the direction's next record
+};
+
+enum {
+    SOCK_TLS_1_2 = 0x0303,     // protocol versions, as on the wire
+    SOCK_TLS_1_3 = 0x0304
+};
+
+enum {
+    SOCK_TLS_AES_128_GCM = 1,
+    SOCK_TLS_AES_256_GCM,
+    SOCK_TLS_CHACHA20_POLY1305
+};
+
+enum {
+    SOCK_TLS_TX = 1 << 0,                 // the keys encrypt what this side sends
+    SOCK_TLS_RX = 1 << 1,                 // the keys decrypt what this side receives
+    SOCK_TLS_ZEROCOPY_SENDFILE = 1 << 2   // with SOCK_TLS_TX: tcp_sendfile encrypts from the file's pages in place,
+                                          // which must not change until they're sent
+};
+
+enum {
+    SOCK_TLS_RECORD_ALERT = 21,      // TLS record content types, as on the wire
+    SOCK_TLS_RECORD_HANDSHAKE = 22,
+    SOCK_TLS_RECORD_DATA = 23
+};
+
+/**
+ * Installs one direction's negotiated keys on a connected socket, after the handshake's last record in
+ * that direction has been sent or received with plain tcp calls. The keys are copied, the caller may wipe them.
+ * @param sock an established connection
+ * @param keys the direction's keys, version and cipher
+ * @param flags SOCK_TLS_TX or SOCK_TLS_RX, optionally with SOCK_TLS_ZEROCOPY_SENDFILE
+ * @return zero on success, SOCK_ERR_UNSUPPORTED without kernel TLS or for a cipher it lacks, negative on failure
+ */
+S_SOCKET_API int tcp_tls_install(struct TCPSocket *sock, struct SockTlsKeys *keys, size_t flags);
+
+/**
+ * Receives the next record's payload whatever its type, after SOCK_TLS_RX was installed
+ * @param sock the offloaded socket
+ * @param msgbuf buffer the decrypted payload is stored in
+ * @param buflen capacity of msgbuf
+ * @param flags TCP_RECV_* flags
+ * @param type set to the record's SOCK_TLS_RECORD_* type
+ * @return bytes received, zero if the peer closed, negative on failure
+ */
+S_SOCKET_API int tcp_tls_recv_record(struct TCPSocket *sock, void *msgbuf, size_t buflen, size_t flags, int *type);
+
+/**
+ * Sends msgbuf as one record of the given type, after SOCK_TLS_TX was installed
+ * @param sock the offloaded socket
+ * @param type SOCK_TLS_RECORD_* type
+ * @param msgbuf the record's plaintext payload
+ * @param buflen payload size
+ * @return bytes sent, negative on failure
+ */
+S_SOCKET_API int tcp_tls_send_record(struct TCPSocket *sock, int type, void *msgbuf, size_t buflen);
+
+
+// -------------------------
+// ---- Unix Socket API ----
+// -------------------------
+
+/**
+ * Same host IPC besides setaddrinfo_unix: connected pairs of unix sockets, and passing open files and
+ * connections from one process to another over a unix stream socket, so a front process can accept
+ * connections and hand them to workers instead of proxying their bytes. Passing needs SCM_RIGHTS,
+ * which windows unix sockets lack, so there it returns SOCK_ERR_UNSUPPORTED.
+ */
+
+/**
+ * Connects two TCPSocket handles to each other through an unnamed unix stream socket pair, replacing
+ * whatever connection they held. On windows the pair goes through a temporary socket file.
+ * @param a one end, from tcp_mksocket or tcp_mkhandle_in
+ * @param b the other end
+ * @return zero on success, negative values for failure
  */
-char* get_error(int errnum);
+S_SOCKET_API int sock_pair(struct TCPSocket *a, struct TCPSocket *b);
+
+/**
+ * sock_pair for datagrams: UDPSocket handles whose udp_send and udp_sendv reach the other end when given
+ * a NULL destInfo. Windows has no unix datagram sockets, its pair is two connected loopback UDP sockets.
+ * @param a one end, from udp_mksocket
+ * @param b the other end
+ * @return zero on success, negative values for failure
+ */
+S_SOCKET_API int sock_pair_dgram(struct UDPSocket *a, struct UDPSocket *b);
+
+/**
+ * Sends msgbuf along with a duplicate of an open file descriptor over a unix stream socket;
+ * the caller keeps its own and closes it as usual, but a socket passed this way must not be shut down
+ * @param sock a connected unix stream socket
+ * @param file the descriptor to pass, a file, pipe or socket
+ * @param msgbuf data that carries the descriptor, at least one byte
+ * @param buflen size of msgbuf
+ * @return bytes sent on success, negative values for failure
+ */
+S_SOCKET_API int tcp_send_fd(struct TCPSocket *sock,
+                             sock_file_t file,
+                             void *msgbuf,
+                             size_t buflen);
+
+/**
+ * Receives data and the descriptor passed along with it, if any
+ * @param sock a connected unix stream socket
+ * @param msgbuf buffer the data is stored in
+ * @param buflen capacity of msgbuf
+ * @param flags TCP_RECV_* flags
+ * @param file set to the received descriptor, owned by the caller, or to -1 if none came with this data;
+ *             one comes per message, and any further ones a sender attached are closed
+ * @return bytes received, zero if the peer closed, negative values for failure
+ */
+S_SOCKET_API int tcp_recv_fd(struct TCPSocket *sock,
+                             void *msgbuf,
+                             size_t buflen,
+                             size_t flags,
+                             sock_file_t *file);
+
+/**
+ * tcp_send_fd for a connection: moves the one behind pass to the receiving process. Once sent, pass no
+ * longer holds it and tcp_free only releases the handle, where a connection it still held would be shut
+ * down for the receiver too. Nothing else may be using pass meanwhile
+ * @return bytes sent on success, negative values for failure
+ */
+S_SOCKET_API int tcp_send_sock(struct TCPSocket *sock,
+                               struct TCPSocket *pass,
+                               void *msgbuf,
+                               size_t buflen);
+
+/**
+ * tcp_recv_fd for a connection: a socket that came with the data is handed to into, like tcp_accept
+ * hands over an accepted one, replacing whatever connection into held
+ * @param into handle that takes the passed connection, from tcp_mksocket or tcp_mkhandle_in
+ * @param passed set to 1 if into took a connection, 0 if none came with this data
+ * @return bytes received, zero if the peer closed, negative values for failure (-ENOTSOCK, with the
+ *         descriptor closed, when what came isn't a stream socket)
+ */
+S_SOCKET_API int tcp_recv_sock(struct TCPSocket *sock,
+                               struct TCPSocket *into,
+                               void *msgbuf,
+                               size_t buflen,
+                               size_t flags,
+                               int *passed);
+
+
+// --------------------
+// ---- Stream API ----
+// --------------------
+
+/**
+ * A TCPStream buffers both directions of a connected TCPSocket in user space. Small writes are
+ * coalesced and go out in one send once the stream is flushed or a size or age threshold is reached,
+ * and reads pull in up to a buffer's worth per recv so token-by-token parsing (stream_read_exact,
+ * stream_read_until, stream_peek) rarely needs a syscall. Since the stream already batches writes,
+ * pair it with TCP_MOD_NODELAY so every flush hits the wire at once.
+ *
+ * Reading through the stream first flushes pending output, so a request is never left sitting in
+ * the buffer while its response is awaited. A stream belongs to one thread at a time and does not
+ * own its socket: free the stream, then the socket.
+ *
+ * On a TCP_MOD_NONBLOCK socket calls that can't finish return SOCK_ERR_WOULDBLOCK; buffered data
+ * stays in the stream, so retry the same call once the socket is ready.
+ */
+struct TCPStream;
+
+enum {
+    SOCK_STREAM_BUF_DEFAULT = 16384  // read and write buffer size used when stream_create is given 0
+};
+
+/**
+ * @param sock a connected tcp socket, which must outlive the stream
+ * @param bufsize capacity of each of the read and write buffers, 0 for SOCK_STREAM_BUF_DEFAULT
+ * @return NULL on failure
+ */
+S_SOCKET_API struct TCPStream* stream_create(struct TCPSocket *sock, size_t bufsize);
+
+/**
+ * Flushes pending output and releases the stream, leaving its socket open
+ * @return zero on success, otherwise the flush error (the stream is released either way)
+ */
+S_SOCKET_API int stream_free(struct TCPStream *stream);
+
+/**
+ * Sets when buffered output is sent without an explicit stream_flush
+ * @param max_bytes flush once this many bytes are pending, 0 (the default) for a full buffer
+ * @param max_delay_ms flush on the first write that finds the oldest pending byte this old, 0 (the default)
+ *        for no age limit; see stream_flush_due for flushing idle streams
+ * @return zero on success, negative values for failure
+ */
+S_SOCKET_API int stream_set_coalesce(struct TCPStream *stream, size_t max_bytes, unsigned max_delay_ms);
+
+/**
+ * Queues data for sending. Writes at least as large as the buffer skip the copy and go out together
+ * with the pending bytes in one vectored send
+ * @return bytes accepted, which is less than len only on a non-blocking socket, negative on failure
+ */
+S_SOCKET_API int stream_write(struct TCPStream *stream, void *data, size_t len);
+
+/**
+ * Sends everything pending
+ * @return zero once nothing is pending, negative values for failure
+ */
+S_SOCKET_API int stream_flush(struct TCPStream *stream);
+
+/**
+ * @return bytes written but not yet sent
+ */
+S_SOCKET_API int stream_pending(struct TCPStream *stream);
+
+/**
+ * For event loops: how long until pending output reaches the stream_set_coalesce age limit
+ * @return milliseconds until stream_flush should be called (0 if overdue), -1 if no flush is scheduled
+ */
+S_SOCKET_API int stream_flush_due(struct TCPStream *stream);
+
+/**
+ * Reads up to len bytes, from the buffer when it holds any and otherwise with one recv
+ * @return bytes read, 0 once the peer has closed the connection, negative values for failure
+ */
+S_SOCKET_API int stream_read(struct TCPStream *stream, void *buf, size_t len);
+
+/**
+ * Reads exactly len bytes. On a non-blocking socket len may not exceed the buffer size, and nothing
+ * is consumed until all len bytes are buffered
+ * @return len, 0 if the connection closed first, negative values for failure
+ */
+S_SOCKET_API int stream_read_exact(struct TCPStream *stream, void *buf, size_t len);
+
+/**
+ * Reads through the first occurrence of delim, e.g. "\r\n"
+ * @param line set to the bytes read, delimiter included, inside the stream's buffer; valid until the next
+ *        read call on the stream
+ * @return length of line, 0 if the connection closed first, -ENOBUFS (-WSAENOBUFS) if no delimiter turned up
+ *         within a full buffer, other negative values for failure
+ */
+S_SOCKET_API int stream_read_until(struct TCPStream *stream, void *delim, size_t delimlen, void **line);
+
+/**
+ * Buffers at least want bytes without consuming them
+ * @param want at most the buffer size, 0 to only report what is already buffered
+ * @param data set to the buffered bytes, valid until the next read call on the stream
+ * @return bytes buffered (at least want), 0 if the connection closed first, negative values for failure
+ */
+S_SOCKET_API int stream_peek(struct TCPStream *stream, size_t want, void **data);
+
+/**
+ * Drops n bytes previously seen with stream_peek
+ * @return zero on success, negative if fewer than n bytes are buffered
+ */
+S_SOCKET_API int stream_consume(struct TCPStream *stream, size_t n);
+
+/**
+ * @return bytes that can be read without a syscall
+ */
+S_SOCKET_API int stream_buffered(struct TCPStream *stream);
+
+/**
+ * Length-prefixed messages over a TCPStream. Each frame is a length followed by that many payload bytes;
+ * receiving parses frames in place in the stream's read buffer, so one recv can deliver many frames and
+ * the caller gets views of them rather than copies. A frame must fit in the stream's buffer.
+ */
+enum {
+    SOCK_FRAME_VARINT,  // unsigned LEB128 length, 1 to 5 bytes (the protobuf varint)
+    SOCK_FRAME_U16,     // 2 byte big-endian length
+    SOCK_FRAME_U32      // 4 byte big-endian length
+};
+
+/**
+ * Queues one frame, coalesced with other writes like stream_write. A frame that fits the buffer is queued
+ * whole or not at all; a larger one (blocking sockets only) goes out together with its prefix in one
+ * vectored send, and a failure partway through that send leaves the connection mid-frame
+ * @param prefix SOCK_FRAME_* length encoding
+ * @return len once the whole frame is queued or sent, SOCK_ERR_WOULDBLOCK if the buffer can't take the
+ *         frame yet (nothing is written), SOCK_ENOBUFS for a non-blocking frame larger than the buffer,
+ *         other negative values for failure
+ */
+S_SOCKET_API int stream_send_frame(struct TCPStream *stream, int prefix, void *data, size_t len);
+
+/**
+ * Receives one frame
+ * @param frame set to the payload inside the stream's buffer, valid until the next read call on the stream
+ * @return 1 for a frame, 0 if the connection closed first, -ENOBUFS (-WSAENOBUFS) for a frame larger than
+ *         the buffer, other negative values for failure
+ */
+S_SOCKET_API int stream_recv_frame(struct TCPStream *stream, int prefix, struct SockBuf *frame);
+
+/**
+ * Receives up to n frames: waits for the first like stream_recv_frame, then adds every further frame that
+ * is already complete in the buffer without another syscall. All views stay valid until the next read call
+ * @return number of frames stored, 0 if the connection closed first, negative values for failure
+ */
+S_SOCKET_API int stream_recv_frames(struct TCPStream *stream, int prefix, struct SockBuf *frames, size_t n);
+
+
+// ----------------------
+// ---- Sharding API ----
+// ----------------------
+
+/**
+ * Sharded sockets let N worker threads each own a socket bound to the same port (SO_REUSEPORT), so the
+ * kernel spreads connections and datagrams across them instead of every worker contending on one queue.
+ * The usual layout is one shard per cpu, with worker i pinned to cpu i and serving socks[i].
+ */
+
+/**
+ * @return the number of online cpus, the natural shard count
+ */
+S_SOCKET_API int sock_ncpu();
+
+/**
+ * Creates n listening sockets bound to the same address
+ * @param socks array of n pointers that receive the listeners
+ * @param n number of listeners to create
+ * @param hostInfo the local address every listener binds
+ * @param backlog listen backlog of each listener
+ * @param flags SOCK_SHARD_* flags
+ * @return zero on success; on failure no sockets are left open
+ */
+S_SOCKET_API int tcp_mkshards(struct TCPSocket **socks,
+                              size_t n,
+                              struct AddrInfo *hostInfo,
+                              int backlog,
+                              size_t flags);
+
+/**
+ * Creates n udp sockets bound to the same address, datagrams are spread across them by source address
+ * @return zero on success; on failure no sockets are left open
+ */
+S_SOCKET_API int udp_mkshards(struct UDPSocket **socks,
+                              size_t n,
+                              struct AddrInfo *hostInfo,
+                              size_t flags);
+
+enum {
+    SOCK_SHARD_CPU = 1 << 0   // Steer each connection/datagram to socks[cpu % n] for the cpu that received it,
+                              //     instead of hashing (linux, attaches a classic BPF reuseport program)
+};
+
+
+// -------------------------
+// ---- Handle Pool API ----
+// -------------------------
+
+/**
+ * Storage for one handle of either type, for embedding in caller structs (see tcp_mksocket_in)
+ */
+struct SockStorage {
+  union {
+    unsigned char bytes[S_SOCKET_TCP_SIZE > S_SOCKET_UDP_SIZE ? S_SOCKET_TCP_SIZE : S_SOCKET_UDP_SIZE];
+    long long align_ll;
+    void *align_p;
+  } u;
+};
+
+/**
+ * A pool hands out handles from slabs of contiguous slots with an O(1) free list, so heavy connection
+ * churn costs no malloc/free per connection. tcp_free and udp_free put pooled handles back, from
+ * whichever thread drops the last reference, so the free list is locked; one pool per thread or event
+ * loop keeps that lock uncontended
+ */
+struct SockPool;
+
+/**
+ * @param count slots per slab; the pool starts with one slab and adds another whenever it runs dry
+ * @return NULL on allocation failure
+ */
+S_SOCKET_API struct SockPool* sock_pool_create(size_t count);
+
+/**
+ * Releases the pool's slabs
+ * @return zero on success, negative (and nothing released) while handles from the pool are still open
+ */
+S_SOCKET_API int sock_pool_free(struct SockPool *pool);
+
+/**
+ * tcp_accept into a handle taken from pool
+ * @param client set to the new handle on success
+ * @return zero on success, negative values for failure as with tcp_accept
+ */
+S_SOCKET_API int tcp_accept_into_pool(struct TCPSocket *sock,
+                                      struct SockPool *pool,
+                                      struct TCPSocket **client,
+                                      struct AddrInfo *clientInfo,
+                                      size_t flags);
+
+/**
+ * tcp_mksocket / udp_mksocket with the handle taken from pool
+ * @return NULL on failure
+ */
+S_SOCKET_API struct TCPSocket* tcp_mksocket_pool(struct SockPool *pool);
+S_SOCKET_API struct UDPSocket* udp_mksocket_pool(struct SockPool *pool);
+
+
+// -------------------------
+// ---- Buffer Pool API ----
+// -------------------------
+
+/**
+ * A buffer pool is one arena of equally sized receive buffers shared by many sockets. Instead of every
+ * connection owning a receive buffer, a buffer is taken only once data is actually there and handed back
+ * once it has been processed, so memory follows the traffic in flight rather than the connection count.
+ *
+ * With the event loop, register non-blocking sockets and call tcp_recv_pooled/udp_recv_pooled on
+ * SOCK_EV_READ; a call that would block returns the buffer straight away. With the completion ring,
+ * ring_provide_buffers lets the kernel pick the buffer when the data arrives.
+ *
+ * Free buffers are reused most recently released first, so the buffers in use stay cache warm and, on
+ * linux, arena pages that were never needed are never touched. The pool is locked, so buffers may be
+ * released from any thread.
+ */
+struct SockBufPool;
+
+/**
+ * @param bufsize bytes per buffer
+ * @param count buffers in the arena, the pool never grows
+ * @return NULL on allocation failure
+ */
+S_SOCKET_API struct SockBufPool* sock_bufpool_create(size_t bufsize, size_t count);
+
+/**
+ * Releases the arena
+ * @return zero on success, negative (and nothing released) while buffers from the pool are still out
+ */
+S_SOCKET_API int sock_bufpool_free(struct SockBufPool *pool);
+
+/**
+ * Takes a buffer of the pool's bufsize
+ * @return NULL when every buffer is in use
+ */
+S_SOCKET_API void* sock_buf_get(struct SockBufPool *pool);
+
+/**
+ * Gives a buffer back to the pool
+ * @return zero on success, negative if buf did not come from the pool
+ */
+S_SOCKET_API int sock_buf_put(struct SockBufPool *pool, void *buf);
+
+/**
+ * tcp_recv / udp_recv into a buffer taken from pool. The buffer is only kept when data was received,
+ * hand it back with sock_buf_put once done with out->buf
+ * @param out set to the buffer and the number of bytes received in it
+ * @return bytes received, zero (tcp: peer closed, udp: empty datagram) or negative values for failure,
+ *         in which case no buffer is held; the negated ENOBUFS when the pool is exhausted
+ */
+S_SOCKET_API int tcp_recv_pooled(struct TCPSocket *sock,
+                                 struct SockBufPool *pool,
+                                 struct SockBuf *out,
+                                 size_t flags);
+S_SOCKET_API int udp_recv_pooled(struct UDPSocket *sock,
+                                 struct SockBufPool *pool,
+                                 struct SockBuf *out,
+                                 size_t flags,
+                                 struct AddrInfo *from);
+
+
+// ------------------------
+// ---- Event Loop API ----
+// ------------------------
+
+/**
+ * The event loop lets one thread serve many sockets: sockets are registered with the read/write readiness
+ * they're interested in, and loop_wait reports the ones that became ready. It is backed by epoll on linux
+ * and WSAPoll on windows, and is level-triggered on both, so a socket keeps being reported for as long
+ * as it stays readable/writable.
+ *
+ * Event loop flow goes something like..
+ *
+ * make loop -> add sockets with a udata pointer -> wait for events --
+ *           --> service the ready sockets (mod to change interest, del to forget them) -> wait again -> free loop
+ *
+ * A socket has to be deleted from the loop before it is freed.
+ */
+struct SockLoop;
+
+/**
+ * One ready socket reported by loop_wait
+ */
+struct SockEvent {
+    void *udata;   // the pointer the socket was registered with
+    int events;    // SOCK_EV_* bits that are ready
+};
+
+enum {
+    SOCK_EV_READ  = 1 << 0,   // data (or a connection, for a listening tcp socket) is ready to be received
+    SOCK_EV_WRITE = 1 << 1,   // a send would not block
+    SOCK_EV_ERROR = 1 << 2,   // an error is pending on the socket, always reported
+    SOCK_EV_HUP   = 1 << 3,   // the peer hung up, always reported
+    SOCK_EV_TIMER = 1 << 4    // a timer armed with loop_timer_add expired, udata is the timer's
+};
+
+/**
+ * Creates an empty event loop
+ * @return NULL on failure
+ */
+S_SOCKET_API struct SockLoop* loop_create();
+
+/**
+ * Registers a socket with the loop
+ * @param loop the loop
+ * @param sock the socket to watch, it may only be registered once per loop
+ * @param events SOCK_EV_READ and/or SOCK_EV_WRITE
+ * @param udata pointer handed back in SockEvent.udata, usually the owning connection object
+ * @return zero on success
+ */
+S_SOCKET_API int loop_add_tcp(struct SockLoop *loop, struct TCPSocket *sock, int events, void *udata);
+S_SOCKET_API int loop_add_udp(struct SockLoop *loop, struct UDPSocket *sock, int events, void *udata);
+
+/**
+ * Changes the events and udata a registered socket is watched with, e.g. to only ask for
+ * SOCK_EV_WRITE while there is queued output
+ * @return zero on success
+ */
+S_SOCKET_API int loop_mod_tcp(struct SockLoop *loop, struct TCPSocket *sock, int events, void *udata);
+S_SOCKET_API int loop_mod_udp(struct SockLoop *loop, struct UDPSocket *sock, int events, void *udata);
+
+/**
+ * Removes a socket from the loop
+ * @return zero on success
+ */
+S_SOCKET_API int loop_del_tcp(struct SockLoop *loop, struct TCPSocket *sock);
+S_SOCKET_API int loop_del_udp(struct SockLoop *loop, struct UDPSocket *sock);
+
+/**
+ * Waits until at least one registered socket is ready, a loop timer fires or the timeout expires
+ * @param loop the loop
+ * @param events array the ready sockets are stored in
+ * @param maxevents capacity of events
+ * @param timeout_ms how long to wait in milliseconds, 0 to poll, negative to wait forever; shortened to
+ *        the next loop timer's deadline, see loop_timer_add
+ * @return number of events stored, zero on timeout, negative on failure
+ */
+S_SOCKET_API int loop_wait(struct SockLoop *loop, struct SockEvent *events, size_t maxevents, int timeout_ms);
+
+/**
+ * Makes a loop_wait blocked on another thread return, or the next one return at once if none is blocked.
+ * It is the one loop call that is safe to make from any thread, meant for telling the loop's thread that
+ * there is work for it; wakes that arrive before the loop gets to run are coalesced into one.
+ * @return zero on success
+ */
+S_SOCKET_API int loop_wake(struct SockLoop *loop);
+
+/**
+ * Frees the loop; registered sockets are not closed
+ * @return non-zero on failure
+ */
+S_SOCKET_API int loop_free(struct SockLoop *loop);
+
+/**
+ * Loop timers are one-shot millisecond deadlines kept in a hierarchical timing wheel, reported by loop_wait
+ * as SockEvents with SOCK_EV_TIMER set, alongside the ready sockets, and loop_wait never sleeps past the
+ * next deadline.
+ *
+ * The SockTimer is caller memory, usually embedded in the connection object it guards, and must be zeroed
+ * before its first use. Arming, re-arming and deleting are constant time and neither allocate nor make a
+ * system call, so pushing an idle timeout back on every receive is cheap:
+ *
+ * add socket and timer -> loop_wait -- SOCK_EV_READ  --> receive, loop_timer_add again with the same timeout
+ *                                   -- SOCK_EV_TIMER --> the connection went idle, loop_del_tcp and free it
+ *
+ * A timer belongs to one loop, and has to be deleted before its memory is freed unless it already fired.
+ */
+struct SockTimer {
+    struct SockTimer *next, *prev;  // internal, the wheel slot the timer is queued on
+    unsigned long long expires;     // internal, monotonic deadline in milliseconds
+    unsigned slot;                  // internal, zero while the timer isn't armed
+    void *udata;                    // handed back in SockEvent.udata when the timer fires
+};
+
+/**
+ * Arms a timer, or moves the deadline of one that is already armed
+ * @param loop the loop that reports the timer
+ * @param timer zeroed or previously used timer
+ * @param timeout_ms milliseconds from now until the timer fires, 0 fires on the next loop_wait
+ * @param udata pointer handed back in SockEvent.udata
+ * @return zero on success
+ */
+S_SOCKET_API int loop_timer_add(struct SockLoop *loop, struct SockTimer *timer, unsigned timeout_ms, void *udata);
+
+/**
+ * Disarms a timer, doing nothing if it isn't armed or already fired
+ * @return zero on success
+ */
+S_SOCKET_API int loop_timer_del(struct SockLoop *loop, struct SockTimer *timer);
+
+
+
+// ---------------------
+// ---- Runtime API ----
+// ---------------------
+
+/**
+ * The runtime runs one event loop per worker thread, by default one per cpu, and moves work between them.
+ * An acceptor hands each new connection to the least loaded worker, which gets it in its on_accept
+ * callback and registers it with its own loop; from then on that worker gets the connection's events
+ * (and its loop timers) in on_event. Anything else is moved between workers as SockTasks, posted to a
+ * worker's lock-free queue and run on its thread between waits.
+ *
+ * Runtime flow goes something like..
+ *
+ * create runtime -> optionally pin workers -> start with callbacks --
+ *                --> accept connections on any thread and hand them off -> free runtime once done
+ *
+ * Callbacks run on the worker's thread, and a worker's loop may only be used from there.
+ */
+struct SockRuntime;
+struct SockWorker;
+
+/**
+ * Work for another worker, usually embedded in the object it is about, so posting allocates nothing
+ */
+struct SockTask {
+    struct SockTask *next;  // internal, the worker queue link
+    void (*run)(struct SockWorker *worker, struct SockTask *task);  // called once, on the worker's thread
+};
+
+typedef void (*sock_accept_fn)(struct SockWorker *worker, struct TCPSocket *sock, void *udata);
+typedef void (*sock_event_fn)(struct SockWorker *worker, struct SockEvent *event);
+
+/**
+ * Creates the workers and their loops; their threads start with sock_runtime_start
+ * @param nthreads number of workers, zero or less for one per cpu (see sock_ncpu)
+ * @return NULL on failure
+ */
+S_SOCKET_API struct SockRuntime* sock_runtime_create(int nthreads);
+
+/**
+ * Sets a runtime option, before sock_runtime_start
+ * @param rt the runtime
+ * @param mod SOCK_RUNTIME_MOD_* option
+ * @param mod_value option value
+ * @return zero on success
+ */
+S_SOCKET_API int sock_runtime_mod(struct SockRuntime *rt, int mod, int mod_value);
+
+enum {
+    SOCK_RUNTIME_MOD_PIN,   // Pin worker i to one cpu of those the process may use, treated like a bool
+    SOCK_RUNTIME_MOD_NUMA   // With PIN, alternate workers between numa nodes, treated like a bool
+};
+
+/**
+ * Starts a thread per worker
+ * @param rt the runtime
+ * @param on_accept called with every socket passed to sock_runtime_handoff, can be NULL if there are none
+ * @param on_event called with every event the worker's loop reports
+ * @return zero on success
+ */
+S_SOCKET_API int sock_runtime_start(struct SockRuntime *rt, sock_accept_fn on_accept, sock_event_fn on_event);
+
+/**
+ * Hands a connected socket to the worker with the fewest connections, thread safe. The worker counts it
+ * until sock_worker_release is called for it.
+ * @param rt the runtime
+ * @param sock the socket, owned by the runtime's callbacks from here on
+ * @param udata pointer passed on to on_accept
+ * @return zero on success
+ */
+S_SOCKET_API int sock_runtime_handoff(struct SockRuntime *rt, struct TCPSocket *sock, void *udata);
+
+/**
+ * Queues a task on a worker and wakes it, thread safe; tasks from one thread run in the order posted
+ * @param worker the worker that runs the task
+ * @param task the task, which must stay valid until it has run
+ * @return zero on success
+ */
+S_SOCKET_API int sock_worker_post(struct SockWorker *worker, struct SockTask *task);
+
+/**
+ * Lets a worker count one handed off connection less, once it is closed
+ * @return zero on success
+ */
+S_SOCKET_API int sock_worker_release(struct SockWorker *worker);
+
+/**
+ * @return number of workers in the runtime
+ */
+S_SOCKET_API int sock_runtime_workers(struct SockRuntime *rt);
+
+/**
+ * @return worker number index, NULL if out of range
+ */
+S_SOCKET_API struct SockWorker* sock_runtime_worker(struct SockRuntime *rt, int index);
+
+/**
+ * @return the worker's own loop, only to be used from the worker's thread
+ */
+S_SOCKET_API struct SockLoop* sock_worker_loop(struct SockWorker *worker);
+
+/**
+ * @return the worker's index in its runtime
+ */
+S_SOCKET_API int sock_worker_index(struct SockWorker *worker);
+
+/**
+ * Stops the workers, waiting for them to finish what they are running, and frees the runtime. Tasks and
+ * handoffs queued before the call still run; sockets left in the loops are not closed.
+ * @return non-zero on failure
+ */
+S_SOCKET_API int sock_runtime_free(struct SockRuntime *rt);
+
+
+#ifdef S_SOCKET_IO_URING
+
+// ----------------------------
+// ---- Completion Ring API ----
+// ----------------------------
+
+/**
+ * The completion ring is an alternative to the event loop on linux, built on io_uring and enabled with the
+ * S_SOCKET_IO_URING cmake option. Instead of waiting for readiness and then making a call, whole operations
+ * (send, recv, accept) are queued on the ring, submitted to the kernel in one batch, and their results come
+ * back as completions. Registered buffers and fixed files shave off the per-operation buffer mapping and
+ * descriptor lookup.
+ *
+ * Ring flow goes something like..
+ *
+ * make ring -> queue operations with a udata pointer -> submit (ring_wait submits too) --
+ *           --> wait for completions -> queue follow-up operations -> ... -> free ring
+ *
+ * Buffers, AddrInfo objects and client handles passed to an operation must stay valid until its completion
+ * has been returned. Queueing returns SOCK_ERR_WOULDBLOCK when the ring is full; reap completions and retry.
+ */
+struct SockRing;
+
+/**
+ * One finished operation returned by ring_wait
+ */
+struct SockCompletion {
+    void *udata;   // the pointer the operation was queued with
+    int result;    // what the matching blocking call would have returned: bytes, zero, or negative error
+    void *buf;     // pooled receives: the buffer holding the result bytes, NULL otherwise
+};
+
+/**
+ * Creates a ring
+ * @param entries how many operations can be queued between submits, rounded up to a power of two
+ * @param flags SOCK_RING_* flags
+ * @return NULL on failure, e.g. a kernel without io_uring
+ */
+S_SOCKET_API struct SockRing* ring_create(unsigned entries, size_t flags);
+
+enum {
+    SOCK_RING_SQPOLL = 1 << 0   // A kernel thread picks up submissions, so ring_submit normally makes no syscall at all
+};
+
+/**
+ * Frees the ring. Operations still in flight are cancelled by the kernel.
+ * @return non-zero on failure
+ */
+S_SOCKET_API int ring_free(struct SockRing *ring);
+
+/**
+ * Queue operations, the arguments and results mirror tcp_send, tcp_recv, tcp_accept, udp_send and udp_recv
+ * @return zero once queued, SOCK_ERR_WOULDBLOCK if the ring is full
+ */
+S_SOCKET_API int ring_tcp_send(struct SockRing *ring, struct TCPSocket *sock, void *msgbuf, size_t buflen, size_t flags, void *udata);
+S_SOCKET_API int ring_tcp_recv(struct SockRing *ring, struct TCPSocket *sock, void *msgbuf, size_t buflen, size_t flags, void *udata);
+S_SOCKET_API int ring_tcp_accept(struct SockRing *ring, struct TCPSocket *sock, struct TCPSocket *client, struct AddrInfo *clientInfo,
+                                 size_t flags, void *udata);
+S_SOCKET_API int ring_udp_send(struct SockRing *ring, struct UDPSocket *sock, struct AddrInfo *destInfo, void *msgbuf, size_t msglen,
+                               size_t flags, void *udata);
+S_SOCKET_API int ring_udp_recv(struct SockRing *ring, struct UDPSocket *sock, void *msgbuf, size_t buflen, size_t flags,
+                               struct AddrInfo *out, void *udata);
+
+/**
+ * Registers buffers with the kernel once, so the _fixed operations skip mapping them on every call.
+ * Replaces any previously registered set.
+ * @return zero on success
+ */
+S_SOCKET_API int ring_register_buffers(struct SockRing *ring, struct SockBuf *bufs, size_t nbufs);
+
+/**
+ * Like ring_tcp_send/ring_tcp_recv but msgbuf must lie within registered buffer bufindex
+ */
+S_SOCKET_API int ring_tcp_send_fixed(struct SockRing *ring, struct TCPSocket *sock, void *msgbuf, size_t buflen, unsigned bufindex,
+                                     void *udata);
+S_SOCKET_API int ring_tcp_recv_fixed(struct SockRing *ring, struct TCPSocket *sock, void *msgbuf, size_t buflen, unsigned bufindex,
+                                     void *udata);
+
+/**
+ * Hands count buffers from pool over to the kernel (an io_uring provided buffer ring, linux 5.19+). A pooled
+ * receive picks one of them only once its data has arrived, so no buffer sits idle under a quiet socket.
+ * Can be called once per ring; at ring_free the buffers go back to pool, including any still held
+ * @param pool a pool of at most 65536 buffers
+ * @param count buffers to take out of pool, at most 32768
+ * @return zero on success, negative values for failure
+ */
+S_SOCKET_API int ring_provide_buffers(struct SockRing *ring, struct SockBufPool *pool, unsigned count);
+
+/**
+ * Like ring_tcp_recv/ring_udp_recv but the completion's buf is the provided buffer the data landed in,
+ * to be handed back with ring_buf_put. When all provided buffers are held the operation completes with
+ * the negated ENOBUFS; put some back and queue it again
+ */
+S_SOCKET_API int ring_tcp_recv_pooled(struct SockRing *ring, struct TCPSocket *sock, size_t flags, void *udata);
+S_SOCKET_API int ring_udp_recv_pooled(struct SockRing *ring, struct UDPSocket *sock, size_t flags, struct AddrInfo *out,
+                                      void *udata);
+
+/**
+ * Gives a pooled completion's buffer back to the kernel once its data has been processed
+ * @return zero on success, negative if buf is not one of the ring's provided buffers
+ */
+S_SOCKET_API int ring_buf_put(struct SockRing *ring, void *buf);
+
+/**
+ * Adds a socket to the ring's fixed file table, after which every operation on it skips the descriptor
+ * lookup. The table has as many slots as the ring has entries. Unfix a socket before freeing it.
+ * @return zero on success
+ */
+S_SOCKET_API int ring_fix_tcp(struct SockRing *ring, struct TCPSocket *sock);
+S_SOCKET_API int ring_fix_udp(struct SockRing *ring, struct UDPSocket *sock);
+S_SOCKET_API int ring_unfix_tcp(struct SockRing *ring, struct TCPSocket *sock);
+S_SOCKET_API int ring_unfix_udp(struct SockRing *ring, struct UDPSocket *sock);
+
+/**
+ * Hands all queued operations to the kernel without waiting
+ * @return number of operations submitted, negative on failure
+ */
+S_SOCKET_API int ring_submit(struct SockRing *ring);
+
+/**
+ * Submits queued operations and waits until at least one has completed or the timeout expires
+ * @param ring the ring
+ * @param out array the completions are stored in
+ * @param n capacity of out
+ * @param timeout_ms how long to wait in milliseconds, 0 to poll, negative to wait forever
+ * @return number of completions stored, zero on timeout, negative on failure
+ */
+S_SOCKET_API int ring_wait(struct SockRing *ring, struct SockCompletion *out, size_t n, int timeout_ms);
+
+#endif // S_SOCKET_IO_URING
+
+
+// -------------------
+// ---- Stats API ----
+// -------------------
+
+/**
+ * With the S_SOCKET_STATS cmake option every data call (the udp/tcp send and receive calls in all their
+ * forms, tcp_sendfile, and everything built on them like streams and pooled receives) is counted, per
+ * socket and process-wide. Without it nothing is counted, handles stay smaller and the stats calls return
+ * SOCK_ERR_UNSUPPORTED. Operations on the completion ring are not counted.
+ *
+ * Per socket counters are relaxed atomics. Process-wide totals are kept per thread and summed when read,
+ * so counting never contends on a shared cache line. Counters only grow; diff two reads for rates
+ */
+struct SockStats {
+    unsigned long long bytes_sent;
+    unsigned long long bytes_received;
+    unsigned long long sends;           // send calls (datagrams, for batch calls) that succeeded
+    unsigned long long receives;        // receive calls (datagrams, for batch calls) that succeeded, tcp eof included
+    unsigned long long short_sends;     // tcp sends that moved fewer bytes than asked
+    unsigned long long short_receives;  // tcp receives that returned less than the buffer could hold
+    unsigned long long wouldblock;      // calls that returned SOCK_ERR_WOULDBLOCK
+    unsigned long long errors;          // calls that failed otherwise
+};
+
+/**
+ * Reads the process-wide totals, which include sockets that have since been freed
+ * @return zero on success, SOCK_ERR_UNSUPPORTED without S_SOCKET_STATS
+ */
+S_SOCKET_API int sock_stats(struct SockStats *out);
+
+/**
+ * Reads one socket's counters, which tcp_accept resets for the connection it hands over
+ * @return zero on success, SOCK_ERR_UNSUPPORTED without S_SOCKET_STATS
+ */
+S_SOCKET_API int tcp_stats(struct TCPSocket *sock, struct SockStats *out);
+S_SOCKET_API int udp_stats(struct UDPSocket *sock, struct SockStats *out);
+
+/**
+ * The kernel's view of a tcp connection (TCP_INFO on linux, SIO_TCP_INFO on windows 10 1703 and up),
+ * available with or without S_SOCKET_STATS
+ */
+struct SockTcpInfo {
+    unsigned rtt_us;       // smoothed round trip time
+    unsigned rtt_var_us;   // round trip time variation (linux only, 0 elsewhere)
+    unsigned cwnd;         // congestion window in bytes
+    unsigned mss;          // maximum segment size being sent
+    unsigned retransmits;  // segments retransmitted over the connection's life (estimated from bytes on windows)
+    unsigned lost;         // segments currently presumed lost (linux only, 0 elsewhere)
+};
+
+/**
+ * @return zero on success, SOCK_ERR_UNSUPPORTED where the system doesn't report it, negative values for failure
+ */
+S_SOCKET_API int tcp_get_info(struct TCPSocket *sock, struct SockTcpInfo *out);
+
+
+// -------------------
+// ---- Error API ----
+// -------------------
+
+/**
+ * Calls that fail return a negative value: either the negated platform error code (errno on linux,
+ * WSAGetLastError() on windows) or one of the portable SOCK_ERR_* codes below. Conditions that callers
+ * routinely branch on, like a non-blocking call that would block, always use the portable code.
+ */
+enum {
+    SOCK_ERR_RESOLVE = -0x10000,  // setaddrinfo could not resolve the host
+    SOCK_ERR_WOULDBLOCK,          // a non-blocking call can't complete yet (EAGAIN/EWOULDBLOCK, WSAEWOULDBLOCK)
+    SOCK_ERR_INPROGRESS,          // a non-blocking tcp_connect was started, see tcp_connect_finish
+    SOCK_ERR_UNSUPPORTED,         // the option or call is not available on this platform
+    SOCK_ERR_CLOSED,              // the handle is being freed by another thread
+};
+
+/**
+ * Get a string description of an error
+ * @param errnum the negative value returned by a failing call
+ * @return null-terminated error string
+ */
+S_SOCKET_API char* get_error(int errnum);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+// ------------------------
+// ---- Implementation ----
+// ------------------------
+
+// The sources include this header again, the guard keeps that to their own definitions
+#ifdef S_SOCKET_IMPLEMENTATION
+#ifdef __cplusplus
+#error "the s-socket sources are C, compile S_SOCKET_IMPLEMENTATION in a .c file"
+#endif
+#ifdef _WIN32
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "mswsock.lib")
+#endif
+#include "s-socket-win.c"
+#else
+#include "s-socket-linux.c"
+#ifdef S_SOCKET_IO_URING
+#include "s-socket-uring.c"
+#endif
+#endif
+#include "s-socket-dns.c"
+#include "s-socket-pool.c"
+#include "s-socket-runtime.c"
+#include "s-socket-stats.c"
+#include "s-socket-stream.c"
+#include "s-socket-timer.c"
+#endif // S_SOCKET_IMPLEMENTATION
+
+#endif // S_SOCKET_H
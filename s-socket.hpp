@@ -0,0 +1,872 @@
+// This file provides the S-Socket C++ API, header-only wrappers over the C API in s-socket.h
+// ------------------------------------------------------------------------------
+//
+// Needs C++20 and the s-socket library, like the C API. Handles are move-only and free their socket when
+// they go out of scope, calls take std::span buffers and return a Result instead of throwing, and none
+// of them allocates: a wrapper is the C handle pointer and nothing else.
+
+#ifndef S_SOCKET_HPP
+#define S_SOCKET_HPP
+
+#include "s-socket.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <exception>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+namespace ssock {
+
+// ------------------
+// ---- Result ----
+// ------------------
+
+/**
+ * A failed call's negative code, as the C API returns it: a negated errno/WSA code or a SOCK_ERR_* value
+ */
+struct Error {
+    int code = 0;
+
+    /**
+     * @return null-terminated description of the code, see get_error
+     */
+    const char* message() const noexcept { return get_error(code); }
+};
+
+/**
+ * Either a call's value or its Error, shaped after std::expected but without exceptions: value() of a
+ * failed Result is only ever the default value, check has_value() or the bool conversion first
+ */
+template <class T>
+class [[nodiscard]] Result {
+public:
+    Result(T value) noexcept : value_(std::move(value)) {}
+    Result(Error error) noexcept : error_(error.code) {}
+
+    bool has_value() const noexcept { return error_ == 0; }
+    explicit operator bool() const noexcept { return has_value(); }
+
+    T& value() & noexcept { return value_; }
+    const T& value() const & noexcept { return value_; }
+    T&& value() && noexcept { return std::move(value_); }
+    T& operator*() & noexcept { return value_; }
+    const T& operator*() const & noexcept { return value_; }
+    T&& operator*() && noexcept { return std::move(value_); }
+    T* operator->() noexcept { return &value_; }
+    const T* operator->() const noexcept { return &value_; }
+
+    template <class U>
+    T value_or(U &&alternative) const & { return has_value() ? value_ : static_cast<T>(std::forward<U>(alternative)); }
+
+    Error error() const noexcept { return Error{error_}; }
+
+private:
+    T value_{};
+    int error_ = 0;
+};
+
+template <>
+class [[nodiscard]] Result<void> {
+public:
+    Result() noexcept = default;
+    Result(Error error) noexcept : error_(error.code) {}
+
+    bool has_value() const noexcept { return error_ == 0; }
+    explicit operator bool() const noexcept { return has_value(); }
+    Error error() const noexcept { return Error{error_}; }
+
+private:
+    int error_ = 0;
+};
+
+namespace detail {
+
+// Where an allocating C call returns NULL, the code the C API itself uses for running out of memory
+#ifdef _WIN32
+inline constexpr int no_memory = -8; // -WSA_NOT_ENOUGH_MEMORY
+#else
+inline constexpr int no_memory = -ENOMEM;
+#endif
+
+inline Result<void> status(int rc) noexcept
+{
+    if (rc < 0)
+        return Error{rc};
+    return {};
+}
+
+inline Result<std::size_t> count(long long rc) noexcept
+{
+    if (rc < 0)
+        return Error{static_cast<int>(rc)};
+    return static_cast<std::size_t>(rc);
+}
+
+// A call that would block, to retry once the socket is ready
+inline bool pending(long long rc) noexcept
+{
+    return rc == SOCK_ERR_WOULDBLOCK || rc == SOCK_ERR_INPROGRESS;
+}
+
+} // namespace detail
+
+
+// -----------------------
+// ---- Library ----
+// -----------------------
+
+/**
+ * sock_startup for as long as it lives, sock_cleanup after
+ */
+class Startup {
+public:
+    Startup() noexcept : rc_(sock_startup()) {}
+    ~Startup() { if (rc_ == 0) sock_cleanup(); }
+    Startup(const Startup&) = delete;
+    Startup& operator=(const Startup&) = delete;
+
+    Result<void> status() const noexcept { return detail::status(rc_); }
+
+private:
+    int rc_;
+};
+
+/**
+ * A SockBuf over a span, for the vectored calls; the send side never writes through it
+ */
+inline SockBuf buf(std::span<std::byte> bytes) noexcept
+{
+    return SockBuf{bytes.data(), bytes.size()};
+}
+
+inline SockBuf buf(std::span<const std::byte> bytes) noexcept
+{
+    return SockBuf{const_cast<std::byte*>(bytes.data()), bytes.size()};
+}
+
+/**
+ * The bytes of a string, without a terminator
+ */
+inline std::span<const std::byte> bytes(std::string_view text) noexcept
+{
+    return std::as_bytes(std::span<const char>(text.data(), text.size()));
+}
+
+
+// -----------------
+// ---- Address ----
+// -----------------
+
+/**
+ * Owns an AddrInfo. A default constructed Address holds none, make() allocates an empty one for
+ * receive calls to fill in
+ */
+class Address {
+public:
+    Address() noexcept = default;
+    explicit Address(AddrInfo *info) noexcept : info_(info) {}
+    Address(Address &&other) noexcept : info_(std::exchange(other.info_, nullptr)) {}
+    Address& operator=(Address &&other) noexcept
+    {
+        std::swap(info_, other.info_);
+        return *this;
+    }
+    Address(const Address&) = delete;
+    Address& operator=(const Address&) = delete;
+    ~Address() { if (info_) addrinfo_free(info_); }
+
+    static Result<Address> make() noexcept
+    {
+        AddrInfo *info = mkaddrinfo();
+        if (!info)
+            return Error{detail::no_memory};
+        return Address(info);
+    }
+
+    /**
+     * setaddrinfo into a new Address
+     */
+    static Result<Address> resolve(const char *host, std::size_t port) noexcept
+    {
+        Result<Address> out = make();
+        int rc;
+        if (out && (rc = setaddrinfo(const_cast<char*>(host), port, out->info_)) != 0)
+            return Error{rc};
+        return out;
+    }
+
+    /**
+     * setaddrinfo_unix into a new Address
+     */
+    static Result<Address> unix_path(const char *path) noexcept
+    {
+        Result<Address> out = make();
+        int rc;
+        if (out && (rc = setaddrinfo_unix(const_cast<char*>(path), out->info_)) != 0)
+            return Error{rc};
+        return out;
+    }
+
+    const char* host() noexcept { return gethost(info_); }
+    int port() noexcept { return getport(info_); }
+    int count() noexcept { return addrinfo_count(info_); }
+    Result<void> select(std::size_t index) noexcept { return detail::status(addrinfo_select(info_, index)); }
+
+    AddrInfo* native() const noexcept { return info_; }
+    explicit operator bool() const noexcept { return info_ != nullptr; }
+
+private:
+    AddrInfo *info_ = nullptr;
+};
+
+
+// --------------------
+// ---- TcpSocket ----
+// --------------------
+
+/**
+ * Owns a TCPSocket, tcp_free runs when it goes out of scope. The threading rules of the C handle apply
+ */
+class TcpSocket {
+public:
+    TcpSocket() noexcept = default;
+    explicit TcpSocket(TCPSocket *sock) noexcept : sock_(sock) {}
+    TcpSocket(TcpSocket &&other) noexcept : sock_(std::exchange(other.sock_, nullptr)) {}
+    TcpSocket& operator=(TcpSocket &&other) noexcept
+    {
+        std::swap(sock_, other.sock_);
+        return *this;
+    }
+    TcpSocket(const TcpSocket&) = delete;
+    TcpSocket& operator=(const TcpSocket&) = delete;
+    ~TcpSocket() { if (sock_) tcp_free(sock_); }
+
+    static Result<TcpSocket> make() noexcept
+    {
+        TCPSocket *sock = tcp_mksocket();
+        if (!sock)
+            return Error{detail::no_memory};
+        return TcpSocket(sock);
+    }
+
+    Result<void> bind(const Address &local) noexcept { return detail::status(tcp_bind(sock_, local.native())); }
+    Result<void> listen(int backlog) noexcept { return detail::status(tcp_listen(sock_, backlog)); }
+    Result<void> connect(const Address &dest) noexcept { return detail::status(tcp_connect(sock_, dest.native())); }
+    Result<void> connect_finish() noexcept { return detail::status(tcp_connect_finish(sock_)); }
+
+    Result<void> connect_fastest(const Address &dest, int stagger_ms, int timeout_ms) noexcept
+    {
+        return detail::status(tcp_connect_fastest(sock_, dest.native(), stagger_ms, timeout_ms));
+    }
+
+    /**
+     * tcp_accept into client, a handle from make(), filling from with the peer's address if given
+     */
+    Result<void> accept(TcpSocket &client, Address *from = nullptr, std::size_t flags = 0) noexcept
+    {
+        return detail::status(tcp_accept(sock_, client.sock_, from ? from->native() : nullptr, flags));
+    }
+
+    Result<std::size_t> send(std::span<const std::byte> data, std::size_t flags = 0) noexcept
+    {
+        return detail::count(tcp_send(sock_, const_cast<std::byte*>(data.data()), data.size(), flags));
+    }
+
+    Result<std::size_t> recv(std::span<std::byte> data, std::size_t flags = 0) noexcept
+    {
+        return detail::count(tcp_recv(sock_, data.data(), data.size(), flags));
+    }
+
+    Result<std::size_t> sendv(std::span<SockBuf> bufs, std::size_t flags = 0) noexcept
+    {
+        return detail::count(tcp_sendv(sock_, bufs.data(), bufs.size(), flags));
+    }
+
+    Result<std::size_t> recvv(std::span<SockBuf> bufs, std::size_t flags = 0) noexcept
+    {
+        return detail::count(tcp_recvv(sock_, bufs.data(), bufs.size(), flags));
+    }
+
+    Result<std::size_t> sendfile(sock_file_t file, long long offset, std::size_t count) noexcept
+    {
+        return detail::count(tcp_sendfile(sock_, file, offset, count));
+    }
+
+    Result<void> mod(int mod, int value) noexcept { return detail::status(tcp_mod_sock(sock_, mod, value)); }
+
+    Result<int> get(int mod) noexcept
+    {
+        int value = 0;
+        int rc = tcp_get_sock(sock_, mod, &value);
+        if (rc < 0)
+            return Error{rc};
+        return value;
+    }
+
+    Result<void> set_nonblocking(bool enable) noexcept { return mod(TCP_MOD_NONBLOCK, enable); }
+
+    TCPSocket* native() const noexcept { return sock_; }
+    explicit operator bool() const noexcept { return sock_ != nullptr; }
+
+    /**
+     * Gives up ownership, the caller frees the handle
+     */
+    TCPSocket* release() noexcept { return std::exchange(sock_, nullptr); }
+
+private:
+    TCPSocket *sock_ = nullptr;
+};
+
+
+// --------------------
+// ---- UdpSocket ----
+// --------------------
+
+/**
+ * Owns a UDPSocket, udp_free runs when it goes out of scope
+ */
+class UdpSocket {
+public:
+    UdpSocket() noexcept = default;
+    explicit UdpSocket(UDPSocket *sock) noexcept : sock_(sock) {}
+    UdpSocket(UdpSocket &&other) noexcept : sock_(std::exchange(other.sock_, nullptr)) {}
+    UdpSocket& operator=(UdpSocket &&other) noexcept
+    {
+        std::swap(sock_, other.sock_);
+        return *this;
+    }
+    UdpSocket(const UdpSocket&) = delete;
+    UdpSocket& operator=(const UdpSocket&) = delete;
+    ~UdpSocket() { if (sock_) udp_free(sock_); }
+
+    static Result<UdpSocket> make() noexcept
+    {
+        UDPSocket *sock = udp_mksocket();
+        if (!sock)
+            return Error{detail::no_memory};
+        return UdpSocket(sock);
+    }
+
+    Result<void> bind(const Address &local) noexcept { return detail::status(udp_bind(sock_, local.native())); }
+
+    /**
+     * udp_send to dest, nullptr on a sock_pair_dgram end
+     */
+    Result<std::size_t> send(const Address *dest, std::span<const std::byte> data, std::size_t flags = 0) noexcept
+    {
+        return detail::count(udp_send(sock_, dest ? dest->native() : nullptr, const_cast<std::byte*>(data.data()),
+                                      data.size(), flags));
+    }
+
+    /**
+     * udp_recv, filling from with the sender's address if given
+     */
+    Result<std::size_t> recv(std::span<std::byte> data, Address *from = nullptr, std::size_t flags = 0) noexcept
+    {
+        return detail::count(udp_recv(sock_, data.data(), data.size(), flags, from ? from->native() : nullptr));
+    }
+
+    Result<std::size_t> sendv(const Address *dest, std::span<SockBuf> bufs, std::size_t flags = 0) noexcept
+    {
+        return detail::count(udp_sendv(sock_, dest ? dest->native() : nullptr, bufs.data(), bufs.size(), flags));
+    }
+
+    /**
+     * udp_send_batch/udp_recv_batch over the messages, each slot's own result is in its UDPMsg
+     * @return number of datagrams sent or received
+     */
+    Result<std::size_t> send_batch(std::span<UDPMsg> msgs, std::size_t flags = 0) noexcept
+    {
+        return detail::count(udp_send_batch(sock_, msgs.data(), msgs.size(), flags));
+    }
+
+    Result<std::size_t> recv_batch(std::span<UDPMsg> msgs, std::size_t flags = 0) noexcept
+    {
+        return detail::count(udp_recv_batch(sock_, msgs.data(), msgs.size(), flags));
+    }
+
+    Result<void> mod(int mod, int value) noexcept { return detail::status(udp_mod_sock(sock_, mod, value)); }
+
+    Result<int> get(int mod) noexcept
+    {
+        int value = 0;
+        int rc = udp_get_sock(sock_, mod, &value);
+        if (rc < 0)
+            return Error{rc};
+        return value;
+    }
+
+    Result<void> set_nonblocking(bool enable) noexcept { return mod(UDP_MOD_NONBLOCK, enable); }
+
+    UDPSocket* native() const noexcept { return sock_; }
+    explicit operator bool() const noexcept { return sock_ != nullptr; }
+    UDPSocket* release() noexcept { return std::exchange(sock_, nullptr); }
+
+private:
+    UDPSocket *sock_ = nullptr;
+};
+
+/**
+ * sock_pair into two new handles
+ */
+inline Result<std::pair<TcpSocket, TcpSocket>> pair() noexcept
+{
+    Result<TcpSocket> a = TcpSocket::make(), b = TcpSocket::make();
+    int rc;
+    if (!a)
+        return a.error();
+    if (!b)
+        return b.error();
+    if ((rc = sock_pair(a->native(), b->native())) != 0)
+        return Error{rc};
+    return std::pair<TcpSocket, TcpSocket>(std::move(*a), std::move(*b));
+}
+
+/**
+ * sock_pair_dgram into two new handles
+ */
+inline Result<std::pair<UdpSocket, UdpSocket>> pair_dgram() noexcept
+{
+    Result<UdpSocket> a = UdpSocket::make(), b = UdpSocket::make();
+    int rc;
+    if (!a)
+        return a.error();
+    if (!b)
+        return b.error();
+    if ((rc = sock_pair_dgram(a->native(), b->native())) != 0)
+        return Error{rc};
+    return std::pair<UdpSocket, UdpSocket>(std::move(*a), std::move(*b));
+}
+
+
+#if defined(__cpp_impl_coroutine)
+
+// ---------------------
+// ---- Coroutines ----
+// ---------------------
+
+/**
+ * Coroutines on top of the event loop: an EventLoop's awaitables try their call at once and, only if it
+ * would block, register the socket (or arm a loop timer) and suspend until run_once finds it ready. An
+ * awaitable lives in the awaiting coroutine's frame, so no operation allocates; the frames of Task
+ * coroutines themselves are the only allocations.
+ *
+ * Sockets have to be in TCP_MOD_NONBLOCK/UDP_MOD_NONBLOCK mode, and a socket can be awaited by one
+ * coroutine at a time per loop, since each wait registers it with the loop and deletes it again after.
+ * Every SockEvent udata on a loop driven by run_once is a Waiter.
+ */
+struct Waiter {
+    bool (*attempt)(Waiter *self) = nullptr; // retries the call once ready, false while it would still block
+    std::coroutine_handle<> handle;          // resumed once the call completed
+    int events = 0;                          // SOCK_EV_* bits of the last event
+};
+
+template <class T = void>
+class Task;
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    bool detached = false;
+
+    // the awaiting coroutine runs next, a detached task frees its frame instead
+    struct Final {
+        bool await_ready() noexcept { return false; }
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> self) noexcept
+        {
+            PromiseBase &p = self.promise();
+            if (p.detached) {
+                self.destroy();
+                return std::noop_coroutine();
+            }
+            return p.continuation ? p.continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    Final final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { std::terminate(); }
+};
+
+template <class T>
+struct Promise : PromiseBase {
+    T value{};
+    Task<T> get_return_object() noexcept;
+    void return_value(T v) noexcept { value = std::move(v); }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object() noexcept;
+    void return_void() noexcept {}
+};
+
+} // namespace detail
+
+/**
+ * A lazily started coroutine: co_await it from another coroutine for its result, or detach() it to run
+ * on its own, its frame freed once it finishes
+ */
+template <class T>
+class [[nodiscard]] Task {
+public:
+    using promise_type = detail::Promise<T>;
+
+    Task(Task &&other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+    Task& operator=(Task &&other) noexcept
+    {
+        std::swap(h_, other.h_);
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { if (h_) h_.destroy(); }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        h_.promise().continuation = awaiting;
+        return h_;
+    }
+    T await_resume() noexcept
+    {
+        if constexpr (!std::is_void_v<T>)
+            return std::move(h_.promise().value);
+    }
+
+    /**
+     * Starts the task with nothing awaiting it, it runs until its first suspension before this returns
+     */
+    void detach() && noexcept
+    {
+        std::coroutine_handle<promise_type> h = std::exchange(h_, nullptr);
+        h.promise().detached = true;
+        h.resume();
+    }
+
+private:
+    friend promise_type;
+    explicit Task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+
+    std::coroutine_handle<promise_type> h_;
+};
+
+template <class T>
+Task<T> detail::Promise<T>::get_return_object() noexcept
+{
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> detail::Promise<void>::get_return_object() noexcept
+{
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+class EventLoop;
+
+namespace detail {
+
+// Calls behind the awaitables: start() is the first try, again() each retry once the socket is ready
+struct TcpWatch {
+    TCPSocket *sock;
+    int watch(SockLoop *loop, int events, Waiter *w) noexcept { return loop_add_tcp(loop, sock, events, w); }
+    void unwatch(SockLoop *loop) noexcept { loop_del_tcp(loop, sock); }
+};
+
+struct UdpWatch {
+    UDPSocket *sock;
+    int watch(SockLoop *loop, int events, Waiter *w) noexcept { return loop_add_udp(loop, sock, events, w); }
+    void unwatch(SockLoop *loop) noexcept { loop_del_udp(loop, sock); }
+};
+
+struct TcpRecvOp : TcpWatch {
+    static constexpr int events = SOCK_EV_READ;
+    std::span<std::byte> data;
+    std::size_t flags;
+    long long start() noexcept { return tcp_recv(sock, data.data(), data.size(), flags); }
+    long long again() noexcept { return start(); }
+    static Result<std::size_t> result(long long rc) noexcept { return count(rc); }
+};
+
+struct TcpSendOp : TcpWatch {
+    static constexpr int events = SOCK_EV_WRITE;
+    std::span<const std::byte> data;
+    std::size_t flags;
+    long long start() noexcept { return tcp_send(sock, const_cast<std::byte*>(data.data()), data.size(), flags); }
+    long long again() noexcept { return start(); }
+    static Result<std::size_t> result(long long rc) noexcept { return count(rc); }
+};
+
+struct TcpAcceptOp : TcpWatch {
+    static constexpr int events = SOCK_EV_READ;
+    TCPSocket *client;
+    AddrInfo *from;
+    std::size_t flags;
+    long long start() noexcept { return tcp_accept(sock, client, from, flags); }
+    long long again() noexcept { return start(); }
+    static Result<void> result(long long rc) noexcept { return status(static_cast<int>(rc)); }
+};
+
+struct TcpConnectOp : TcpWatch {
+    static constexpr int events = SOCK_EV_WRITE;
+    AddrInfo *dest;
+    long long start() noexcept { return tcp_connect(sock, dest); }
+    long long again() noexcept { return tcp_connect_finish(sock); }
+    static Result<void> result(long long rc) noexcept { return status(static_cast<int>(rc)); }
+};
+
+struct UdpRecvOp : UdpWatch {
+    static constexpr int events = SOCK_EV_READ;
+    std::span<std::byte> data;
+    AddrInfo *from;
+    std::size_t flags;
+    long long start() noexcept { return udp_recv(sock, data.data(), data.size(), flags, from); }
+    long long again() noexcept { return start(); }
+    static Result<std::size_t> result(long long rc) noexcept { return count(rc); }
+};
+
+struct UdpSendOp : UdpWatch {
+    static constexpr int events = SOCK_EV_WRITE;
+    AddrInfo *dest;
+    std::span<const std::byte> data;
+    std::size_t flags;
+    long long start() noexcept
+    {
+        return udp_send(sock, dest, const_cast<std::byte*>(data.data()), data.size(), flags);
+    }
+    long long again() noexcept { return start(); }
+    static Result<std::size_t> result(long long rc) noexcept { return count(rc); }
+};
+
+template <class Op>
+class IoAwaiter;
+
+class SleepAwaiter;
+
+} // namespace detail
+
+/**
+ * Owns a SockLoop and resumes the coroutines waiting on it
+ */
+class EventLoop {
+public:
+    EventLoop() noexcept = default;
+    explicit EventLoop(SockLoop *loop) noexcept : loop_(loop) {}
+    EventLoop(EventLoop &&other) noexcept : loop_(std::exchange(other.loop_, nullptr)) {}
+    EventLoop& operator=(EventLoop &&other) noexcept
+    {
+        std::swap(loop_, other.loop_);
+        return *this;
+    }
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+    ~EventLoop() { if (loop_) loop_free(loop_); }
+
+    static Result<EventLoop> make() noexcept
+    {
+        SockLoop *loop = loop_create();
+        if (!loop)
+            return Error{detail::no_memory};
+        return EventLoop(loop);
+    }
+
+    /**
+     * One loop_wait, resuming every coroutine whose call completed or whose sleep ended
+     * @return number of events handled
+     */
+    Result<std::size_t> run_once(int timeout_ms = -1) noexcept
+    {
+        SockEvent events[64];
+        int n = loop_wait(loop_, events, 64, timeout_ms);
+
+        if (n < 0)
+            return Error{n};
+        batch_ = events;
+        nbatch_ = n;
+        for (int i = 0; i < n; ++i) {
+            Waiter *w = static_cast<Waiter*>(events[i].udata);
+            if (!w)
+                continue; // its awaitable went away earlier in this batch
+            w->events = events[i].events;
+            if (!w->attempt || w->attempt(w))
+                w->handle.resume();
+        }
+        batch_ = nullptr;
+        nbatch_ = 0;
+        return static_cast<std::size_t>(n);
+    }
+
+    Result<void> wake() noexcept { return detail::status(loop_wake(loop_)); }
+
+    detail::IoAwaiter<detail::TcpRecvOp> recv(TcpSocket &sock, std::span<std::byte> data, std::size_t flags = 0) noexcept;
+    detail::IoAwaiter<detail::TcpSendOp> send(TcpSocket &sock, std::span<const std::byte> data, std::size_t flags = 0) noexcept;
+    detail::IoAwaiter<detail::TcpAcceptOp> accept(TcpSocket &listener, TcpSocket &client, Address *from = nullptr,
+                                                  std::size_t flags = TCP_ACCEPT_NONBLOCK) noexcept;
+    detail::IoAwaiter<detail::TcpConnectOp> connect(TcpSocket &sock, const Address &dest) noexcept;
+    detail::IoAwaiter<detail::UdpRecvOp> recv(UdpSocket &sock, std::span<std::byte> data, Address *from = nullptr,
+                                              std::size_t flags = 0) noexcept;
+    detail::IoAwaiter<detail::UdpSendOp> send(UdpSocket &sock, const Address *dest, std::span<const std::byte> data,
+                                              std::size_t flags = 0) noexcept;
+    detail::SleepAwaiter sleep(unsigned ms) noexcept;
+
+    SockLoop* native() const noexcept { return loop_; }
+    explicit operator bool() const noexcept { return loop_ != nullptr; }
+
+private:
+    template <class Op>
+    friend class detail::IoAwaiter;
+    friend class detail::SleepAwaiter;
+
+    // a waiter going away mid batch must not be resumed by the rest of it
+    void forget(Waiter *w) noexcept
+    {
+        for (int i = 0; i < nbatch_; ++i)
+            if (batch_[i].udata == w)
+                batch_[i].udata = nullptr;
+    }
+
+    SockLoop *loop_ = nullptr;
+    SockEvent *batch_ = nullptr;
+    int nbatch_ = 0;
+};
+
+namespace detail {
+
+template <class Op>
+class [[nodiscard]] IoAwaiter : private Waiter {
+public:
+    IoAwaiter(EventLoop &loop, Op op) noexcept : loop_(loop), op_(op) {}
+    IoAwaiter(const IoAwaiter&) = delete;
+    IoAwaiter& operator=(const IoAwaiter&) = delete;
+    ~IoAwaiter()
+    {
+        if (watching_) {
+            op_.unwatch(loop_.loop_);
+            loop_.forget(this);
+        }
+    }
+
+    bool await_ready() noexcept
+    {
+        rc_ = op_.start();
+        return !pending(rc_);
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept
+    {
+        int rc;
+        handle = h;
+        attempt = &IoAwaiter::retry;
+        if ((rc = op_.watch(loop_.loop_, Op::events, this)) < 0) {
+            rc_ = rc;
+            return false;
+        }
+        watching_ = true;
+        return true;
+    }
+
+    auto await_resume() noexcept { return Op::result(rc_); }
+
+private:
+    static bool retry(Waiter *w) noexcept
+    {
+        IoAwaiter *self = static_cast<IoAwaiter*>(w);
+        long long rc = self->op_.again();
+        if (pending(rc))
+            return false;
+        self->rc_ = rc;
+        self->op_.unwatch(self->loop_.loop_);
+        self->watching_ = false;
+        return true;
+    }
+
+    EventLoop &loop_;
+    Op op_;
+    long long rc_ = 0;
+    bool watching_ = false;
+};
+
+class [[nodiscard]] SleepAwaiter : private Waiter {
+public:
+    SleepAwaiter(EventLoop &loop, unsigned ms) noexcept : loop_(loop), ms_(ms) {}
+    SleepAwaiter(const SleepAwaiter&) = delete;
+    SleepAwaiter& operator=(const SleepAwaiter&) = delete;
+    ~SleepAwaiter()
+    {
+        if (timer_.slot) {
+            loop_timer_del(loop_.loop_, &timer_);
+            loop_.forget(this);
+        }
+    }
+
+    bool await_ready() noexcept { return false; }
+
+    // a timer that can't be armed ends the sleep at once
+    bool await_suspend(std::coroutine_handle<> h) noexcept
+    {
+        handle = h;
+        return loop_timer_add(loop_.loop_, &timer_, ms_, static_cast<Waiter*>(this)) == 0;
+    }
+
+    void await_resume() noexcept {}
+
+private:
+    EventLoop &loop_;
+    unsigned ms_;
+    SockTimer timer_{};
+};
+
+} // namespace detail
+
+inline detail::IoAwaiter<detail::TcpRecvOp> EventLoop::recv(TcpSocket &sock, std::span<std::byte> data, std::size_t flags) noexcept
+{
+    return {*this, detail::TcpRecvOp{{sock.native()}, data, flags}};
+}
+
+inline detail::IoAwaiter<detail::TcpSendOp> EventLoop::send(TcpSocket &sock, std::span<const std::byte> data, std::size_t flags) noexcept
+{
+    return {*this, detail::TcpSendOp{{sock.native()}, data, flags}};
+}
+
+inline detail::IoAwaiter<detail::TcpAcceptOp> EventLoop::accept(TcpSocket &listener, TcpSocket &client, Address *from,
+                                                                std::size_t flags) noexcept
+{
+    return {*this, detail::TcpAcceptOp{{listener.native()}, client.native(), from ? from->native() : nullptr, flags}};
+}
+
+inline detail::IoAwaiter<detail::TcpConnectOp> EventLoop::connect(TcpSocket &sock, const Address &dest) noexcept
+{
+    return {*this, detail::TcpConnectOp{{sock.native()}, dest.native()}};
+}
+
+inline detail::IoAwaiter<detail::UdpRecvOp> EventLoop::recv(UdpSocket &sock, std::span<std::byte> data, Address *from,
+                                                            std::size_t flags) noexcept
+{
+    return {*this, detail::UdpRecvOp{{sock.native()}, data, from ? from->native() : nullptr, flags}};
+}
+
+inline detail::IoAwaiter<detail::UdpSendOp> EventLoop::send(UdpSocket &sock, const Address *dest,
+                                                            std::span<const std::byte> data, std::size_t flags) noexcept
+{
+    return {*this, detail::UdpSendOp{{sock.native()}, dest ? dest->native() : nullptr, data, flags}};
+}
+
+inline detail::SleepAwaiter EventLoop::sleep(unsigned ms) noexcept
+{
+    return {*this, ms};
+}
+
+#endif // __cpp_impl_coroutine
+
+} // namespace ssock
+
+#endif // S_SOCKET_HPP